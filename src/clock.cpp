@@ -0,0 +1,99 @@
+#include "clock.hpp"
+
+#include "devices/pit.hpp"
+#include "log/log.hpp"
+#include "memory/offsets.hpp"
+#include "memory/physical.hpp"
+#include "utils.hpp"
+
+namespace cosmos::clock {
+    constexpr uint32_t CALIBRATION_MS = 50;
+
+    static bool invariant = false;
+
+    static uint64_t tsc_base = 0;
+    static uint64_t mult = 0;
+
+    static uint64_t page_phys = 0;
+
+    static Page* get_page() {
+        return reinterpret_cast<Page*>(memory::virt::DIRECT_MAP + page_phys);
+    }
+
+    static void publish() {
+        const auto page = get_page();
+
+        page->sequence++;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        page->shift = SHIFT;
+        page->tsc_base = tsc_base;
+        page->mult = mult;
+
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        page->sequence++;
+    }
+
+    void init() {
+        uint32_t eax, ebx, ecx, edx;
+        utils::cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+
+        if (eax >= 0x80000007) {
+            utils::cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+            invariant = (edx >> 8) & 1;
+        }
+
+        if (!invariant) WARN("TSC is not invariant, time might drift if the CPU frequency changes");
+
+        const auto start = utils::rdtsc();
+        devices::pit::wait(CALIBRATION_MS);
+        const auto end = utils::rdtsc();
+
+        const auto tsc_per_ms = (end - start) / CALIBRATION_MS;
+
+        tsc_base = end;
+        mult = (1'000'000ul << SHIFT) / tsc_per_ms;
+
+        INFO("Calibrated TSC, it runs at %llu kHz", tsc_per_ms);
+
+        page_phys = memory::phys::alloc_pages(1);
+        if (page_phys == 0) utils::panic(nullptr, "Failed to allocate clock page");
+
+        utils::memset(get_page(), 0, 4096);
+        publish();
+    }
+
+    bool is_invariant() {
+        return invariant;
+    }
+
+    uint64_t get_tsc_base() {
+        return tsc_base;
+    }
+
+    uint64_t get_mult() {
+        return mult;
+    }
+
+    uint64_t get_ns() {
+        const auto delta = utils::rdtsc() - tsc_base;
+
+        // Split the multiplication so it does not overflow after a few seconds
+        const auto hi = delta >> SHIFT;
+        const auto lo = delta & ((1ul << SHIFT) - 1);
+
+        return hi * mult + ((lo * mult) >> SHIFT);
+    }
+
+    bool map_page(const memory::virt::Space space) {
+        memory::phys::ref_pages(page_phys / 4096ul, 1);
+
+        if (!memory::virt::map_pages(space, memory::virt::CLOCK_PAGE / 4096ul, page_phys / 4096ul, 1, memory::virt::Flags::User)) {
+            ERROR("Failed to map clock page");
+            memory::phys::free_pages(page_phys / 4096ul, 1);
+            return false;
+        }
+
+        return true;
+    }
+} // namespace cosmos::clock
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "memory/virtual.hpp"
+
+#include <cstdint>
+
+namespace cosmos::clock {
+    /// TSC ticks are converted to nanoseconds with ((tsc - base) * mult) >> SHIFT
+    constexpr uint32_t SHIFT = 32;
+
+    /// Mapped read-only into user spaces at memory::virt::CLOCK_PAGE so that time can be read without a syscall, the shell duplicates
+    /// the layout. The sequence is odd while the parameters are written, readers retry if it was odd or changed during their read.
+    struct Page {
+        uint32_t sequence;
+        uint32_t shift;
+        uint64_t tsc_base;
+        uint64_t mult;
+    };
+
+    /// Detects whether the TSC is invariant and calibrates it against the PIT, runs before the application processors start
+    void init();
+
+    bool is_invariant();
+
+    uint64_t get_tsc_base();
+    uint64_t get_mult();
+
+    /// Monotonic nanoseconds since init, the TSCs of all CPUs are assumed to be synchronized
+    uint64_t get_ns();
+
+    inline uint64_t get_ms() {
+        return get_ns() / 1'000'000;
+    }
+
+    /// The page is referenced for every space it is mapped into, so clearing the space or forking it needs no special handling
+    bool map_page(memory::virt::Space space);
+} // namespace cosmos::clock
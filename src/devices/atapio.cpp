@@ -2,7 +2,9 @@
 
 #include "log/log.hpp"
 #include "memory/heap.hpp"
+#include "memory/virtual.hpp"
 #include "stl/bit_field.hpp"
+#include "stl/utils.hpp"
 #include "utils.hpp"
 #include "vfs/devfs.hpp"
 
@@ -140,12 +142,12 @@ namespace cosmos::devices::atapio {
         return file->cursor;
     }
 
-    uint64_t read(const stl::Rc<vfs::File>& file, void* buffer, uint64_t length) {
+    uint64_t read_at(const stl::Rc<vfs::File>& file, void* buffer, uint64_t length, const uint64_t offset) {
         const auto drive = static_cast<Drive*>(file->node->fs_handle);
 
         // Calculate LBA and sector count
-        auto sectors = (length + file->cursor % 512 + 511) / 512;
-        const auto lba = file->cursor / 512;
+        auto sectors = (length + offset % 512 + 511) / 512;
+        const auto lba = offset / 512;
 
         if (drive->lba48 && sectors > 0xFFFF) {
             sectors = 0xFFFF;
@@ -199,11 +201,10 @@ namespace cosmos::devices::atapio {
         }
 
         // Read data
-        auto to_skip = file->cursor - lba * 512;
+        auto to_skip = offset - lba * 512;
         auto dst = static_cast<uint8_t*>(buffer);
 
-        const auto read = length;
-        file->cursor += length;
+        auto read = length;
 
         while (sectors > 0) {
             for (auto i = 0; i < 4; i++) {
@@ -216,26 +217,30 @@ namespace cosmos::devices::atapio {
                 status = read_io<Status>(drive->bus_primary, IO_STATUS);
             }
 
+            uint16_t sector[256];
+
             for (auto i = 0; i < 256; i++) {
-                auto data = read_io<uint16_t>(drive->bus_primary, IO_DATA);
-
-                if (to_skip > 0) {
-                    data = data >> 8;
-                    to_skip--;
-                } else if (length > 0) {
-                    *(dst++) = data & 0xFF;
-                    data = data >> 8;
-                    length--;
-                }
+                sector[i] = read_io<uint16_t>(drive->bus_primary, IO_DATA);
+            }
+
+            // The drive expects every sector to be read, even after the buffer turned out not to be writable
+            const auto skip = stl::min(to_skip, 512ul);
+            const auto count = stl::min(length, 512ul - skip);
+
+            if (count > 0) {
+                const auto copied = memory::virt::copy_user(dst, reinterpret_cast<const uint8_t*>(sector) + skip, count);
 
-                if (to_skip > 0) {
-                    to_skip--;
-                } else if (length > 0) {
-                    *(dst++) = data;
-                    length--;
+                if (copied != count) {
+                    read -= length - copied;
+                    length = 0;
+                } else {
+                    dst += count;
+                    length -= count;
                 }
             }
 
+            to_skip -= skip;
+
             for (auto i = 0; i < 15; i++) {
                 utils::wait();
             }
@@ -246,6 +251,13 @@ namespace cosmos::devices::atapio {
         return read;
     }
 
+    uint64_t read(const stl::Rc<vfs::File>& file, void* buffer, const uint64_t length) {
+        const auto size = read_at(file, buffer, length, file->cursor);
+        file->cursor += size;
+
+        return size;
+    }
+
     uint64_t ioctl([[maybe_unused]] const stl::Rc<vfs::File>& file, [[maybe_unused]] uint64_t op, [[maybe_unused]] uint64_t arg) {
         return vfs::IOCTL_UNKNOWN;
     }
@@ -254,6 +266,8 @@ namespace cosmos::devices::atapio {
         .seek = seek,
         .read = read,
         .write = nullptr,
+        .read_at = read_at,
+        .write_at = nullptr,
         .ioctl = ioctl,
     };
 
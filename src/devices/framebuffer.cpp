@@ -2,7 +2,7 @@
 
 #include "limine.hpp"
 #include "memory/offsets.hpp"
-#include "utils.hpp"
+#include "memory/virtual.hpp"
 #include "vfs/devfs.hpp"
 
 namespace cosmos::devices::framebuffer {
@@ -16,36 +16,48 @@ namespace cosmos::devices::framebuffer {
         return file->cursor;
     }
 
-    uint64_t fb_read(const stl::Rc<vfs::File>& file, void* buffer, const uint64_t length) {
+    uint64_t fb_read_at(const stl::Rc<vfs::File>& file, void* buffer, const uint64_t length, const uint64_t offset) {
         if (file->mode == vfs::Mode::Write) return 0;
-        if (file->cursor >= fb_size()) return 0;
+        if (offset >= fb_size()) return 0;
 
-        auto size = fb_size() - file->cursor;
+        auto size = fb_size() - offset;
         if (size > length) size = length;
 
         if (size > 0) {
-            utils::memcpy(buffer, &reinterpret_cast<uint8_t*>(memory::virt::FRAMEBUFFER)[file->cursor], size);
-            file->cursor += size;
+            size = memory::virt::copy_user(buffer, &reinterpret_cast<uint8_t*>(memory::virt::FRAMEBUFFER)[offset], size);
         }
 
         return size;
     }
 
-    uint64_t fb_write(const stl::Rc<vfs::File>& file, const void* buffer, const uint64_t length) {
+    uint64_t fb_read(const stl::Rc<vfs::File>& file, void* buffer, const uint64_t length) {
+        const auto size = fb_read_at(file, buffer, length, file->cursor);
+        file->cursor += size;
+
+        return size;
+    }
+
+    uint64_t fb_write_at(const stl::Rc<vfs::File>& file, const void* buffer, const uint64_t length, const uint64_t offset) {
         if (file->mode == vfs::Mode::Read) return 0;
-        if (file->cursor >= fb_size()) return 0;
+        if (offset >= fb_size()) return 0;
 
-        auto size = fb_size() - file->cursor;
+        auto size = fb_size() - offset;
         if (size > length) size = length;
 
         if (size > 0) {
-            utils::memcpy(&reinterpret_cast<uint8_t*>(memory::virt::FRAMEBUFFER)[file->cursor], buffer, size);
-            file->cursor += size;
+            size = memory::virt::copy_user(&reinterpret_cast<uint8_t*>(memory::virt::FRAMEBUFFER)[offset], buffer, size);
         }
 
         return size;
     }
 
+    uint64_t fb_write(const stl::Rc<vfs::File>& file, const void* buffer, const uint64_t length) {
+        const auto size = fb_write_at(file, buffer, length, file->cursor);
+        file->cursor += size;
+
+        return size;
+    }
+
     uint64_t fb_ioctl([[maybe_unused]] const stl::Rc<vfs::File>& file, const uint64_t op, [[maybe_unused]] uint64_t arg) {
         switch (op) {
         case IOCTL_GET_INFO: {
@@ -67,6 +79,8 @@ namespace cosmos::devices::framebuffer {
         .seek = fb_seek,
         .read = fb_read,
         .write = fb_write,
+        .read_at = fb_read_at,
+        .write_at = fb_write_at,
         .ioctl = fb_ioctl,
     };
 
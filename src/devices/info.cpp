@@ -1,5 +1,6 @@
 #include "info.hpp"
 
+#include "memory/cache.hpp"
 #include "memory/physical.hpp"
 #include "vfs/devfs.hpp"
 
@@ -42,9 +43,40 @@ namespace cosmos::devices::info {
         .show = meminfo_show,
     };
 
+    // slabinfo
+
+    void slabinfo_reset(vfs::devfs::Sequence* seq) {
+        seq->index = 0;
+        seq->eof = false;
+    }
+
+    void slabinfo_next(vfs::devfs::Sequence* seq) {
+        seq->index++;
+        if (seq->index > memory::cache::get_cache_count()) seq->eof = true;
+    }
+
+    void slabinfo_show(vfs::devfs::Sequence* seq) {
+        if (seq->index == 0) {
+            seq->printf("name active_objects total_objects object_size objects_per_slab slabs\n");
+            return;
+        }
+
+        const auto stats = memory::cache::get_stats(seq->index - 1);
+
+        seq->printf("%s %u %u %u %u %u\n", stats.name.data(), stats.active_objects, stats.slab_count * stats.objects_per_slab,
+                    stats.object_size, stats.objects_per_slab, stats.slab_count);
+    }
+
+    static constexpr vfs::devfs::SequenceOps slabinfo_ops = {
+        .reset = slabinfo_reset,
+        .next = slabinfo_next,
+        .show = slabinfo_show,
+    };
+
     // Init
 
     void init(vfs::Node* node) {
         vfs::devfs::register_sequence_device(node, "meminfo", &meminfo_ops);
+        vfs::devfs::register_sequence_device(node, "slabinfo", &slabinfo_ops);
     }
 } // namespace cosmos::devices::info
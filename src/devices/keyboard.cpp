@@ -1,5 +1,6 @@
 #include "keyboard.hpp"
 
+#include "memory/virtual.hpp"
 #include "stl/fixed_list.hpp"
 #include "stl/ring_buffer.hpp"
 #include "task/event.hpp"
@@ -10,6 +11,9 @@ namespace cosmos::devices::keyboard {
     static stl::RingBuffer<Event, 32> events = {};
     static stl::FixedList<vfs::File*, 8, nullptr> event_files = {};
 
+    /// Woken whenever an event is added to the buffer
+    static task::WaitQueue readers = {};
+
     static uint64_t kb_seek([[maybe_unused]] const stl::Rc<vfs::File>& file, [[maybe_unused]] vfs::SeekType type,
                             [[maybe_unused]] int64_t offset) {
         return 0;
@@ -21,15 +25,12 @@ namespace cosmos::devices::keyboard {
         asm volatile("cli" ::: "memory");
 
         Event event;
-        if (events.try_get(event)) {
-            *static_cast<Event*>(buffer) = event;
-
-            asm volatile("sti" ::: "memory");
-            return sizeof(Event);
-        }
+        const auto got = events.try_get(event);
 
         asm volatile("sti" ::: "memory");
-        return 0;
+
+        if (!got) return 0;
+        return memory::virt::copy_user(buffer, &event, sizeof(Event)) == sizeof(Event) ? sizeof(Event) : 0;
     }
 
     static void event_close(const uint64_t index) {
@@ -77,11 +78,17 @@ namespace cosmos::devices::keyboard {
         }
     }
 
+    static vfs::PollMask kb_poll([[maybe_unused]] const stl::Rc<vfs::File>& file, task::WaitQueue*& queue) {
+        queue = &readers;
+        return events.size() != 0 ? vfs::PollMask::Read : vfs::PollMask::None;
+    }
+
     static constexpr vfs::FileOps file_ops = {
         .seek = kb_seek,
         .read = kb_read,
         .write = nullptr,
         .ioctl = kb_ioctl,
+        .poll = kb_poll,
     };
 
     void init(vfs::Node* node) {
@@ -94,6 +101,8 @@ namespace cosmos::devices::keyboard {
                 constexpr uint64_t number = 1;
                 event_file->ops->write(event_file, &number, sizeof(uint64_t));
             }
+
+            readers.wake_all();
         }
     }
 } // namespace cosmos::devices::keyboard
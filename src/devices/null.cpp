@@ -1,6 +1,7 @@
 #include "null.hpp"
 
-#include "utils.hpp"
+#include "memory/virtual.hpp"
+#include "stl/utils.hpp"
 #include "vfs/devfs.hpp"
 
 namespace cosmos::devices::null {
@@ -10,8 +11,18 @@ namespace cosmos::devices::null {
     }
 
     static uint64_t read([[maybe_unused]] const stl::Rc<vfs::File>& file, void* buffer, const uint64_t length) {
-        utils::memset(buffer, 0, length);
-        return length;
+        static constexpr uint8_t zeros[512] = {};
+        uint64_t total = 0;
+
+        while (total < length) {
+            const auto count = stl::min(length - total, sizeof(zeros));
+            const auto copied = memory::virt::copy_user(static_cast<uint8_t*>(buffer) + total, zeros, count);
+
+            total += copied;
+            if (copied != count) break;
+        }
+
+        return total;
     }
 
     static uint64_t write([[maybe_unused]] const stl::Rc<vfs::File>& file, [[maybe_unused]] const void* buffer, const uint64_t length) {
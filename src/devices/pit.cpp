@@ -1,40 +1,34 @@
 #include "pit.hpp"
 
+#include "clock.hpp"
 #include "interrupts/isr.hpp"
-#include "stl/fixed_list.hpp"
+#include "interrupts/lapic.hpp"
+#include "interrupts/pic.hpp"
+#include "memory/cache.hpp"
+#include "memory/virtual.hpp"
+#include "smp.hpp"
 #include "task/event.hpp"
 #include "task/scheduler.hpp"
+#include "task/timer.hpp"
 #include "utils.hpp"
 #include "vfs/devfs.hpp"
 
 namespace cosmos::devices::pit {
-    struct Repeat {
-        uint64_t ms;
-        HandlerFn fn;
-        uint64_t data;
-    };
-
-    static bool operator==(const Repeat& lhs, const Repeat& rhs) {
-        return lhs.ms == rhs.ms;
-    }
-
     constexpr uint16_t CHANNEL0 = 0x40;
     constexpr uint16_t CHANNEL1 = 0x41;
     constexpr uint16_t CHANNEL2 = 0x42;
     constexpr uint16_t COMMAND = 0x43;
+    /// Gate of channel 2 in bit 0 and its output in bit 5
+    constexpr uint16_t CHANNEL2_CONTROL = 0x61;
 
-    static uint64_t ticks = 0;
+    constexpr uint32_t FREQUENCY = 1193182;
 
-    static stl::FixedList<Repeat, 8, {}> repeats = {};
+    static memory::cache::Cache* timer_cache = nullptr;
 
+    /// Runs on every CPU, timers are only run by the bootstrap processor
     static void tick([[maybe_unused]] isr::InterruptInfo* info) {
-        ticks++;
-
-        for (const auto& repeat : repeats) {
-            if (repeat.ms != 0 && ticks % repeat.ms == 0) {
-                repeat.fn(repeat.data);
-            }
-        }
+        if (smp::get_current()->index == 0) task::run_timers(clock::get_ms());
+        task::tick();
     }
 
     // VFS
@@ -47,20 +41,19 @@ namespace cosmos::devices::pit {
     static uint64_t read([[maybe_unused]] const stl::Rc<vfs::File>& file, void* buffer, const uint64_t length) {
         if (length != sizeof(uint64_t)) return 0;
 
-        *static_cast<uint64_t*>(buffer) = ticks;
-        return sizeof(uint64_t);
+        const auto ms = clock::get_ms();
+        return memory::virt::copy_user(buffer, &ms, sizeof(uint64_t)) == sizeof(uint64_t) ? sizeof(uint64_t) : 0;
     }
 
-    static void event_close(const uint64_t index) {
-        asm volatile("cli" ::: "memory");
-
-        repeats.remove_at(index);
+    static void event_close(const uint64_t timer_ptr) {
+        const auto timer = reinterpret_cast<task::Timer*>(timer_ptr);
 
-        asm volatile("sti" ::: "memory");
+        task::cancel_timer(*timer);
+        memory::cache::free(timer_cache, timer);
     }
 
-    static void event_tick(const uint64_t event_file_ptr) {
-        const auto event_file = reinterpret_cast<vfs::File*>(event_file_ptr);
+    static void event_tick(task::Timer& timer) {
+        const auto event_file = reinterpret_cast<vfs::File*>(timer.data);
 
         constexpr uint64_t number = 1;
         event_file->ops->write(event_file, &number, sizeof(uint64_t));
@@ -69,17 +62,20 @@ namespace cosmos::devices::pit {
     static uint64_t ioctl([[maybe_unused]] const stl::Rc<vfs::File>& file, const uint64_t op, const uint64_t arg) {
         switch (op) {
         case IOCTL_CREATE_EVENT: {
-            const auto index = repeats.index_of({});
-            if (index == -1) return 0;
+            if (arg == 0) return 0xFFFFFFFF;
+
+            const auto timer = memory::cache::alloc<task::Timer>(timer_cache);
+            if (timer == nullptr) return 0xFFFFFFFF;
 
             uint32_t fd;
-            const auto event_file = *task::create_event(event_close, index, vfs::FileFlags::CloseOnExecute, fd);
+            const auto event_file = *task::create_event(event_close, reinterpret_cast<uint64_t>(timer), vfs::FileFlags::CloseOnExecute, fd);
 
             if (event_file == nullptr) {
+                memory::cache::free(timer_cache, timer);
                 return fd;
             }
 
-            run_every_x_ms(arg, event_tick, reinterpret_cast<uint64_t>(event_file));
+            task::add_timer(*timer, arg, arg, event_tick, reinterpret_cast<uint64_t>(event_file));
 
             return fd;
         }
@@ -99,30 +95,47 @@ namespace cosmos::devices::pit {
     // Header
 
     void init(vfs::Node* node) {
+        timer_cache = memory::cache::create<task::Timer>("timer");
+        if (timer_cache == nullptr) utils::panic(nullptr, "[pit] Failed to create timer cache");
+
         asm volatile("cli" ::: "memory");
-        utils::byte_out(COMMAND, 0b00'11'011'0);
 
-        constexpr uint32_t divisor = 1193180u / 1000u;
-        utils::byte_out(CHANNEL0, divisor & 0xFF);
-        utils::byte_out(CHANNEL0, (divisor >> 8) & 0xFF);
+        // The local APIC timers take over, the firmware might have left channel 0 running
+        pic::mask(0);
 
-        isr::set(0, tick);
+        isr::set(lapic::TIMER_IRQ, tick);
         asm volatile("sti" ::: "memory");
 
         vfs::devfs::register_device(node, "timer", &ops, nullptr);
     }
 
-    bool run_every_x_ms(const uint64_t ms, const HandlerFn fn, const uint64_t data) {
-        asm volatile("cli" ::: "memory");
+    void wait(const uint32_t ms) {
+        const auto count = FREQUENCY / 1000u * ms;
 
-        const auto result = repeats.add({
-            .ms = ms,
-            .fn = fn,
-            .data = data,
-        });
+        // Disable the speaker and lower the gate so that the count only starts once it is raised again
+        const auto control = utils::byte_in(CHANNEL2_CONTROL) & ~0b11;
+        utils::byte_out(CHANNEL2_CONTROL, control);
 
-        asm volatile("sti" ::: "memory");
+        // Channel 2, low and high byte, interrupt on terminal count
+        utils::byte_out(COMMAND, 0b10'11'000'0);
+        utils::byte_out(CHANNEL2, count & 0xFF);
+        utils::byte_out(CHANNEL2, (count >> 8) & 0xFF);
+
+        utils::byte_out(CHANNEL2_CONTROL, control | 1);
+
+        while ((utils::byte_in(CHANNEL2_CONTROL) & 0x20) == 0) {
+            asm volatile("pause" ::: "memory");
+        }
+
+        utils::byte_out(CHANNEL2_CONTROL, control);
+    }
+
+    void start_tick() {
+        lapic::set_periodic(1);
+    }
 
-        return result;
+    void stop_tick() {
+        if (smp::get_current()->index == 0) lapic::set_one_shot(task::get_next_timer(clock::get_ms()));
+        else lapic::set_one_shot(0);
     }
 } // namespace cosmos::devices::pit
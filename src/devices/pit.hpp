@@ -7,9 +7,16 @@
 namespace cosmos::devices::pit {
     constexpr uint64_t IOCTL_CREATE_EVENT = 1;
 
-    using HandlerFn = void (*)(uint64_t);
-
+    /// Takes over the local APIC timers, the PIT itself no longer interrupts and is only used to calibrate the other timers
     void init(vfs::Node* node);
 
-    bool run_every_x_ms(uint64_t ms, HandlerFn fn, uint64_t data);
+    /// Busy waits for up to 50 milliseconds using channel 2
+    void wait(uint32_t ms);
+
+    /// Makes the timer of the calling CPU fire every millisecond, for CPUs which have processes to run
+    void start_tick();
+
+    /// Stops the periodic timer of the calling CPU before it goes idle,
+    /// the bootstrap processor keeps it armed for the next task timer
+    void stop_tick();
 } // namespace cosmos::devices::pit
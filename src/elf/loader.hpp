@@ -1,9 +1,10 @@
 #pragma once
 
-#include "memory/virtual.hpp"
+#include "task/region.hpp"
 #include "types.hpp"
 #include "vfs/types.hpp"
 
 namespace cosmos::elf {
-    bool load(memory::virt::Space space, const stl::Rc<vfs::File>& file, const Binary* binary);
+    /// Adds a lazily populated region for every loadable segment, the regions keep a reference to the file
+    bool load(task::RegionTree& regions, const stl::Rc<vfs::File>& file, const Binary* binary);
 } // namespace cosmos::elf
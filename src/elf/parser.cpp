@@ -2,6 +2,7 @@
 
 #include "log/log.hpp"
 #include "memory/heap.hpp"
+#include "vfs/vfs.hpp"
 
 namespace cosmos::elf {
     enum class Class : uint8_t {
@@ -112,18 +113,14 @@ namespace cosmos::elf {
         binary->section_headers = { sections_ptr, header->section_header_count };
 
         // Read program headers
-        file->ops->seek(file, vfs::SeekType::Start, static_cast<int64_t>(header->file_program_headers_offset));
-
-        if (file->ops->read(file, programs_ptr, programs_size) != programs_size) {
+        if (vfs::read_at(file, programs_ptr, programs_size, header->file_program_headers_offset) != programs_size) {
             ERROR("Failed to read program headers");
             memory::heap::free(binary);
             return nullptr;
         }
 
         // Read section headers
-        file->ops->seek(file, vfs::SeekType::Start, static_cast<int64_t>(header->file_section_headers_offset));
-
-        if (file->ops->read(file, sections_ptr, sections_size) != sections_size) {
+        if (vfs::read_at(file, sections_ptr, sections_size, header->file_section_headers_offset) != sections_size) {
             ERROR("Failed to read section headers");
             memory::heap::free(binary);
             return nullptr;
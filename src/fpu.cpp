@@ -0,0 +1,109 @@
+#include "fpu.hpp"
+
+#include "log/log.hpp"
+#include "utils.hpp"
+
+namespace cosmos::fpu {
+    constexpr uint64_t CR0_MP = 1ul << 1;
+    constexpr uint64_t CR0_EM = 1ul << 2;
+    constexpr uint64_t CR0_TS = 1ul << 3;
+    constexpr uint64_t CR0_NE = 1ul << 5;
+
+    constexpr uint64_t CR4_OSFXSR = 1ul << 9;
+    constexpr uint64_t CR4_OSXMMEXCPT = 1ul << 10;
+    constexpr uint64_t CR4_OSXSAVE = 1ul << 18;
+
+    /// x87, SSE, AVX and the three AVX-512 components, all of them fit in a single page
+    constexpr uint64_t XCR0_USER_MASK = 0b11100111;
+
+    constexpr uint32_t FXSAVE_AREA_SIZE = 512;
+
+    constexpr uint16_t DEFAULT_FCW = 0x37F;
+    constexpr uint32_t DEFAULT_MXCSR = 0x1F80;
+
+    static bool first_init = true;
+
+    static bool xsave_supported = false;
+    static bool xsaveopt_supported = false;
+
+    static uint64_t xcr0 = 0;
+    static uint32_t area_size = FXSAVE_AREA_SIZE;
+
+    static void detect_features() {
+        uint32_t eax, ebx, ecx, edx;
+        utils::cpuid(1, &eax, &ebx, &ecx, &edx);
+        xsave_supported = (ecx >> 26) & 1;
+
+        if (!xsave_supported) {
+            INFO("XSAVE not supported, saving SSE state with FXSAVE");
+            return;
+        }
+
+        utils::cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        xcr0 = ((static_cast<uint64_t>(edx) << 32) | eax) & XCR0_USER_MASK;
+
+        // AVX-512 is only usable if all three of its components are enabled together
+        if ((xcr0 & 0b11100000) != 0b11100000) xcr0 &= ~0b11100000ul;
+
+        utils::cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+        xsaveopt_supported = (eax >> 0) & 1;
+
+        INFO("XSAVE enabled with components 0x%llx", xcr0);
+    }
+
+    void init() {
+        if (first_init) {
+            detect_features();
+            first_init = false;
+        }
+
+        uint64_t cr0;
+        asm volatile("mov %%cr0, %0" : "=r"(cr0));
+        asm volatile("mov %0, %%cr0" ::"r"((cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE) : "memory");
+
+        uint64_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" ::"r"(cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT | (xsave_supported ? CR4_OSXSAVE : 0)) : "memory");
+
+        if (xsave_supported) {
+            asm volatile("xsetbv" ::"c"(0), "a"(xcr0 & 0xFFFFFFFF), "d"(xcr0 >> 32) : "memory");
+
+            // Only now CPUID reports the size for the enabled components
+            uint32_t eax, ebx, ecx, edx;
+            utils::cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+            area_size = ebx;
+        }
+
+        asm volatile("fninit" ::: "memory");
+    }
+
+    uint32_t get_area_size() {
+        return area_size;
+    }
+
+    void reset(void* area) {
+        // A zeroed XSAVE header puts every component in its initial state, only MXCSR is always loaded from the legacy region
+        utils::memset(area, 0, area_size);
+
+        *reinterpret_cast<uint16_t*>(static_cast<uint8_t*>(area) + 0) = DEFAULT_FCW;
+        *reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(area) + 24) = DEFAULT_MXCSR;
+    }
+
+    void save(void* area) {
+        if (xsaveopt_supported) {
+            asm volatile("xsaveopt64 (%0)" ::"r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+        } else if (xsave_supported) {
+            asm volatile("xsave64 (%0)" ::"r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+        } else {
+            asm volatile("fxsave64 (%0)" ::"r"(area) : "memory");
+        }
+    }
+
+    void restore(const void* area) {
+        if (xsave_supported) {
+            asm volatile("xrstor64 (%0)" ::"r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+        } else {
+            asm volatile("fxrstor64 (%0)" ::"r"(area) : "memory");
+        }
+    }
+} // namespace cosmos::fpu
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cosmos::fpu {
+    /// XSAVE requires the area to be 64 byte aligned, FXSAVE only 16 bytes
+    constexpr uint64_t AREA_ALIGNMENT = 64;
+
+    /// Enables x87, SSE and, when supported, XSAVE with AVX and AVX-512 state on the calling CPU.
+    /// The kernel itself is built without SIMD instructions, so the registers only ever hold user-land state.
+    void init();
+
+    /// Size of the areas passed to the functions below, only valid after the first call to init
+    uint32_t get_area_size();
+
+    /// Fills the area with the state user-land processes start with
+    void reset(void* area);
+
+    /// Saves the state of the calling CPU, XSAVEOPT skips components which were not modified since they were restored from the same area
+    void save(void* area);
+    void restore(const void* area);
+} // namespace cosmos::fpu
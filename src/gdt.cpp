@@ -1,6 +1,7 @@
 #include "gdt.hpp"
 
 #include "log/log.hpp"
+#include "smp.hpp"
 #include "tss.hpp"
 
 #include <cstdint>
@@ -32,8 +33,8 @@ namespace cosmos::gdt {
         void* address;
     };
 
-    static Entry entries[7];
-    static Descriptor descriptor;
+    static Entry gdts[smp::MAX_CPUS][7];
+    static Descriptor descriptors[smp::MAX_CPUS];
 
     Entry entry(const uint32_t base, const uint32_t limit, const uint8_t access, const uint8_t flags) {
         return {
@@ -46,7 +47,10 @@ namespace cosmos::gdt {
         };
     }
 
-    void init() {
+    void init(const uint32_t cpu) {
+        auto& entries = gdts[cpu];
+        auto& descriptor = descriptors[cpu];
+
         constexpr auto base_access = ACCESS_PRESENT | ACCESS_RW | ACCESS_NOTSYS | ACCESS_ACCESSED;
 
         entries[0] = entry(0, 0, 0, 0);                                                // Null
@@ -56,7 +60,7 @@ namespace cosmos::gdt {
         entries[4] = entry(0, 0, base_access | ACCESS_EXEC | ACCESS_USER, FLAGS_LONG); // User - Code
 
         // TSS
-        const uint64_t tss_base = tss::get_address();
+        const uint64_t tss_base = tss::get_address(cpu);
         const uint32_t tss_limit = tss::get_size();
         constexpr auto access = ACCESS_PRESENT | ACCESS_EXEC | ACCESS_ACCESSED;
 
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+
 namespace cosmos::gdt {
-    void init();
+    /// Loads the GDT of the CPU, each one has its own TSS entry
+    void init(uint32_t cpu);
 } // namespace cosmos::gdt
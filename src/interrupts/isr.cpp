@@ -1,7 +1,10 @@
 #include "isr.hpp"
 
+#include "lapic.hpp"
 #include "log/log.hpp"
 #include "pic.hpp"
+#include "smp.hpp"
+#include "task/scheduler.hpp"
 #include "utils.hpp"
 
 namespace cosmos::isr {
@@ -57,10 +60,19 @@ namespace cosmos::isr {
     void isr45();
     void isr46();
     void isr47();
+
+    // Local APIC interrupts 48..50 and spurious 255
+    void isr48();
+    void isr49();
+    void isr50();
+    void isr255();
     }
 
-    /// Handlers for IRQs 0..15
-    static handler_fn handlers[16];
+    /// Handlers for PIC IRQs 0..15 and local APIC IRQs 16..18
+    static handler_fn handlers[19];
+
+    /// Handlers for exceptions 0..31
+    static exception_handler_fn exception_handlers[32];
 
     /// Naked common ISR routine. RSP points to saved r15 (top of saved registers).
     extern "C" __attribute__((naked)) void isr_common() {
@@ -68,6 +80,12 @@ namespace cosmos::isr {
         # 1. Clear Direction Flag
         cld
 
+        # Switch to Kernel GS to access per-cpu data if the interrupt came from user-land (CS is above the interrupt + error)
+        testb $3, 24(%rsp)
+        jz 1f
+        swapgs
+    1:
+
         # Preserve base pointer and set new frame
         push %rbp
         mov %rsp, %rbp
@@ -119,6 +137,12 @@ namespace cosmos::isr {
         # Remove the two 8-byte values pushed by stubs: interrupt + error
         add $16, %rsp
 
+        # Switch back to User GS if returning to user-land
+        testb $3, 8(%rsp)
+        jz 2f
+        swapgs
+    2:
+
         # Return from interrupt (pops RIP, CS, RFLAGS [, RSP, SS if present])
         iretq
     )");
@@ -193,6 +217,12 @@ namespace cosmos::isr {
     ISR_NO_ERROR_CODE(46)
     ISR_NO_ERROR_CODE(47)
 
+    // Generate local APIC stubs (48..50, 255)
+    ISR_NO_ERROR_CODE(48)
+    ISR_NO_ERROR_CODE(49)
+    ISR_NO_ERROR_CODE(50)
+    ISR_NO_ERROR_CODE(255)
+
 #undef ISR_NO_ERROR_CODE
 #undef ISR_ERROR_CODE
 
@@ -200,6 +230,7 @@ namespace cosmos::isr {
     void init() {
         // zero handlers
         utils::memset(handlers, 0, sizeof(handlers));
+        utils::memset(exception_handlers, 0, sizeof(exception_handlers));
 
         pic::init();
 
@@ -255,18 +286,35 @@ namespace cosmos::isr {
         pic::set(46, reinterpret_cast<uint64_t>(isr46), 0x8E);
         pic::set(47, reinterpret_cast<uint64_t>(isr47), 0x8E);
 
+        // Local APIC (48..50, 255)
+        pic::set(48, reinterpret_cast<uint64_t>(isr48), 0x8E);
+        pic::set(49, reinterpret_cast<uint64_t>(isr49), 0x8E);
+        pic::set(50, reinterpret_cast<uint64_t>(isr50), 0x8E);
+        pic::set(255, reinterpret_cast<uint64_t>(isr255), 0x8E);
+
         pic::update();
 
         INFO("Initialized PIC");
     }
 
-    /// Register an IRQ handler (0..15)
+    void load() {
+        pic::load();
+    }
+
+    /// Register an IRQ handler (0..18)
     void set(const uint8_t num, const handler_fn handler) {
-        if (num < 16) {
+        if (num < 19) {
             handlers[num] = handler;
         }
     }
 
+    /// Register an exception handler (0..31)
+    void set_exception(const uint8_t num, const exception_handler_fn handler) {
+        if (num < 32) {
+            exception_handlers[num] = handler;
+        }
+    }
+
     /// Exception descriptions
     constexpr const char* EXCEPTIONS[] = {
         "Division By Zero",
@@ -314,8 +362,18 @@ namespace cosmos::isr {
             return;
         }
 
-        // Exceptions (0..31) -> panic
+        // Exceptions (0..31) -> panic if not handled
         if (info->interrupt < 32) {
+            const auto handler = exception_handlers[info->interrupt];
+
+            if (handler) {
+                smp::lock_kernel();
+                const auto handled = handler(info);
+                smp::unlock_kernel();
+
+                if (handled) return;
+            }
+
             auto name = "Unknown";
 
             if (info->interrupt < (sizeof(EXCEPTIONS) / sizeof(EXCEPTIONS[0]))) {
@@ -325,16 +383,27 @@ namespace cosmos::isr {
             utils::panic(info, name);
         }
 
-        // IRQs (32..47)
-        if (info->interrupt < 48) {
+        // Spurious interrupts of the local APIC are not acknowledged
+        if (info->interrupt == lapic::SPURIOUS_VECTOR) return;
+
+        // IRQs (32..50)
+        if (info->interrupt < 51) {
             const auto irq = static_cast<uint8_t>(info->interrupt - 32);
             const auto handler = handlers[irq];
 
-            if (handler) {
+            if (handler && irq == lapic::TLB_FLUSH_IRQ) {
                 handler(info);
+            } else if (handler) {
+                smp::lock_kernel();
+                handler(info);
+                smp::unlock_kernel();
             }
 
-            pic::end_irq(irq);
+            if (irq < 16) pic::end_irq(irq);
+            else lapic::end_irq();
+
+            // Preemption point, the interrupted process has no kernel state on its stack when coming from user-land
+            if ((info->iret_cs & 3) == 3) task::preempt();
         }
     }
 } // namespace cosmos::isr
@@ -5,7 +5,16 @@
 namespace cosmos::isr {
     typedef void (*handler_fn)(InterruptInfo* info);
 
+    /// Returns false if the exception could not be handled, the kernel then panics
+    typedef bool (*exception_handler_fn)(InterruptInfo* info);
+
     void init();
 
+    /// Loads the IDT on an application processor, interrupts stay disabled
+    void load();
+
+    /// IRQs 0..15 come from the PIC, the ones after from the local APIC, see lapic.hpp
     void set(uint8_t num, handler_fn handler);
+
+    void set_exception(uint8_t num, exception_handler_fn handler);
 } // namespace cosmos::isr
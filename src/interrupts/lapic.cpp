@@ -0,0 +1,117 @@
+#include "lapic.hpp"
+
+#include "devices/pit.hpp"
+#include "isr.hpp"
+#include "log/log.hpp"
+#include "memory/virt_range_alloc.hpp"
+#include "memory/virtual.hpp"
+#include "utils.hpp"
+
+namespace cosmos::lapic {
+    constexpr uint32_t MSR_APIC_BASE = 0x1B;
+
+    constexpr uint32_t REG_EOI = 0xB0;
+    constexpr uint32_t REG_SPURIOUS = 0xF0;
+    constexpr uint32_t REG_ICR_LOW = 0x300;
+    constexpr uint32_t REG_ICR_HIGH = 0x310;
+    constexpr uint32_t REG_LVT_TIMER = 0x320;
+    constexpr uint32_t REG_TIMER_INITIAL = 0x380;
+    constexpr uint32_t REG_TIMER_CURRENT = 0x390;
+    constexpr uint32_t REG_TIMER_DIVIDE = 0x3E0;
+
+    constexpr uint32_t SPURIOUS_ENABLE = 1u << 8;
+    constexpr uint32_t ICR_PENDING = 1u << 12;
+    constexpr uint32_t ICR_ASSERT = 1u << 14;
+    constexpr uint32_t TIMER_MASKED = 1u << 16;
+    constexpr uint32_t TIMER_PERIODIC = 1u << 17;
+    constexpr uint32_t TIMER_DIVIDE_16 = 0b0011;
+
+    constexpr uint32_t CALIBRATION_MS = 10;
+
+    static uint64_t base = 0;
+    static uint32_t ticks_per_ms = 0;
+
+    static uint32_t read(const uint32_t reg) {
+        return *reinterpret_cast<volatile uint32_t*>(base + reg);
+    }
+
+    static void write(const uint32_t reg, const uint32_t value) {
+        *reinterpret_cast<volatile uint32_t*>(base + reg) = value;
+    }
+
+    static void enable() {
+        write(REG_SPURIOUS, SPURIOUS_ENABLE | SPURIOUS_VECTOR);
+
+        write(REG_TIMER_DIVIDE, TIMER_DIVIDE_16);
+        write(REG_LVT_TIMER, TIMER_MASKED | (32 + TIMER_IRQ));
+        write(REG_TIMER_INITIAL, 0);
+    }
+
+    static void calibrate() {
+        write(REG_TIMER_INITIAL, 0xFFFFFFFF);
+        devices::pit::wait(CALIBRATION_MS);
+
+        const auto elapsed = 0xFFFFFFFF - read(REG_TIMER_CURRENT);
+        write(REG_TIMER_INITIAL, 0);
+
+        ticks_per_ms = elapsed / CALIBRATION_MS;
+    }
+
+    static void tlb_flush([[maybe_unused]] isr::InterruptInfo* info) {
+        memory::virt::handle_shootdown();
+    }
+
+    // Header
+
+    void init() {
+        const auto phys = utils::msr_read(MSR_APIC_BASE) & ~0xFFFul;
+
+        const auto virt = memory::virt::alloc_range(1);
+        if (virt == 0) utils::panic(nullptr, "[lapic] Failed to allocate virtual range");
+
+        const auto flags = memory::virt::Flags::Write | memory::virt::Flags::Uncached | memory::virt::Flags::Global;
+
+        if (!memory::virt::map_pages(memory::virt::get_current(), virt, phys / 4096ul, 1, flags)) {
+            utils::panic(nullptr, "[lapic] Failed to map registers");
+        }
+
+        base = virt * 4096ul;
+
+        enable();
+        calibrate();
+
+        isr::set(TLB_FLUSH_IRQ, tlb_flush);
+
+        INFO("Initialized local APIC, timer runs at %u kHz", ticks_per_ms);
+    }
+
+    void init_ap() {
+        enable();
+    }
+
+    void set_periodic(const uint32_t ms) {
+        write(REG_LVT_TIMER, TIMER_PERIODIC | (32 + TIMER_IRQ));
+        write(REG_TIMER_INITIAL, ms * ticks_per_ms);
+    }
+
+    void set_one_shot(const uint32_t ms) {
+        // The counter is 32 bits wide, longer timeouts fire early and get rearmed by the handler
+        const auto ticks = static_cast<uint64_t>(ms) * ticks_per_ms;
+
+        write(REG_LVT_TIMER, 32 + TIMER_IRQ);
+        write(REG_TIMER_INITIAL, ticks < 0xFFFFFFFF ? ticks : 0xFFFFFFFF);
+    }
+
+    void send_ipi(const uint32_t lapic_id, const uint8_t irq) {
+        write(REG_ICR_HIGH, lapic_id << 24);
+        write(REG_ICR_LOW, ICR_ASSERT | (32 + irq));
+
+        while ((read(REG_ICR_LOW) & ICR_PENDING) != 0) {
+            asm volatile("pause" ::: "memory");
+        }
+    }
+
+    void end_irq() {
+        write(REG_EOI, 0);
+    }
+} // namespace cosmos::lapic
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cosmos::lapic {
+    /// IRQ numbers of the local interrupts as passed to isr::set, they come after the 16 PIC IRQs
+    constexpr uint8_t TIMER_IRQ = 16;
+    constexpr uint8_t RESCHEDULE_IRQ = 17;
+    /// Runs without the kernel lock, the CPU sending it holds the lock while waiting for the flush
+    constexpr uint8_t TLB_FLUSH_IRQ = 18;
+
+    constexpr uint8_t SPURIOUS_VECTOR = 0xFF;
+
+    /// Maps and enables the local APIC of the bootstrap processor and calibrates its timer against the PIT
+    void init();
+
+    /// Enables the local APIC of an application processor, the timer stays stopped
+    void init_ap();
+
+    /// Fires the timer IRQ on the calling CPU every ms milliseconds
+    void set_periodic(uint32_t ms);
+
+    /// Fires the timer IRQ on the calling CPU once after ms milliseconds, 0 stops the timer
+    void set_one_shot(uint32_t ms);
+
+    /// Sends a fixed interrupt to the CPU with the local APIC id
+    void send_ipi(uint32_t lapic_id, uint8_t irq);
+
+    void end_irq();
+} // namespace cosmos::lapic
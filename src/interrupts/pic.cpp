@@ -76,11 +76,20 @@ namespace cosmos::pic {
         };
     }
 
-    void update() {
+    void load() {
         asm volatile("lidt %0" ::"m"(ptr) : "memory");
+    }
+
+    void update() {
+        load();
         asm volatile("sti");
     }
 
+    void mask(const uint8_t number) {
+        const auto port = number < 8 ? MASTER_DATA : SLAVE_DATA;
+        utils::byte_out(port, utils::byte_in(port) | (1 << (number % 8)));
+    }
+
     void end_irq(const uint8_t number) {
         if (number >= 8) {
             utils::byte_out(SLAVE_COMMAND, 0x20);
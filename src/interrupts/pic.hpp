@@ -6,7 +6,11 @@ namespace cosmos::pic {
     void init();
 
     void set(uint8_t num, uint64_t handler, uint8_t flags);
+    /// Loads the IDT without enabling interrupts
+    void load();
     void update();
 
+    void mask(uint8_t number);
+
     void end_irq(uint8_t number);
 } // namespace cosmos::pic
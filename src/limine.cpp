@@ -43,12 +43,25 @@ static volatile limine_rsdp_request rsdp_request = {
     .revision = 0,
 };
 
+__attribute__((unused, section(".requests"))) //
+static volatile limine_mp_request mp_request = {
+    .id = LIMINE_MP_REQUEST_ID,
+    .revision = 0,
+    .flags = 0,
+};
+
 __attribute__((unused, section(".requests_end"))) //
 static volatile uint64_t requests_end[] = LIMINE_REQUESTS_END_MARKER;
 
 namespace cosmos::limine {
     static Framebuffer fb;
 
+    static CpuEntryFn cpu_entry = nullptr;
+
+    static void cpu_trampoline(limine_mp_info* info) {
+        cpu_entry(info->extra_argument);
+    }
+
     void init_framebuffer() {
         const auto limine_fb = framebuffer_request.response->framebuffers[0];
 
@@ -178,4 +191,29 @@ namespace cosmos::limine {
     uint64_t get_rsdp() {
         return reinterpret_cast<uint64_t>(rsdp_request.response->address) - get_hhdm();
     }
+
+    uint32_t get_cpu_count() {
+        // Without a response only the bootstrap processor is running
+        return mp_request.response != nullptr ? mp_request.response->cpu_count : 1;
+    }
+
+    uint32_t get_cpu_lapic_id(const uint32_t index) {
+        if (mp_request.response == nullptr) return 0;
+        return mp_request.response->cpus[index]->lapic_id;
+    }
+
+    uint32_t get_bsp_lapic_id() {
+        if (mp_request.response == nullptr) return 0;
+        return mp_request.response->bsp_lapic_id;
+    }
+
+    void start_cpu(const uint32_t index, const CpuEntryFn entry, const uint64_t arg) {
+        const auto info = mp_request.response->cpus[index];
+
+        cpu_entry = entry;
+        info->extra_argument = arg;
+
+        // The processor starts running as soon as the address is written
+        __atomic_store_n(&info->goto_address, &cpu_trampoline, __ATOMIC_SEQ_CST);
+    }
 } // namespace cosmos::limine
@@ -53,4 +53,13 @@ namespace cosmos::limine {
     const Framebuffer& get_framebuffer();
 
     uint64_t get_rsdp();
+
+    using CpuEntryFn = void (*)(uint64_t arg);
+
+    uint32_t get_cpu_count();
+    uint32_t get_cpu_lapic_id(uint32_t index);
+    uint32_t get_bsp_lapic_id();
+
+    /// Makes the processor jump to the entry on its own stack provided by the bootloader, with interrupts disabled
+    void start_cpu(uint32_t index, CpuEntryFn entry, uint64_t arg);
 } // namespace cosmos::limine
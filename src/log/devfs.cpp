@@ -1,7 +1,7 @@
 #include "devfs.hpp"
 
 #include "log.hpp"
-#include "utils.hpp"
+#include "memory/virtual.hpp"
 #include "vfs/devfs.hpp"
 
 namespace cosmos::log {
@@ -17,7 +17,7 @@ namespace cosmos::log {
         if (size > length) size = length;
 
         if (size > 0) {
-            utils::memcpy(buffer, &get_start()[file->cursor], size);
+            size = memory::virt::copy_user(buffer, &get_start()[file->cursor], size);
             file->cursor += size;
         }
 
@@ -38,8 +38,9 @@ namespace cosmos::log {
 
             const auto phys = memory::phys::alloc_pages(1);
             const auto space = memory::virt::get_current();
+            constexpr auto flags = memory::virt::Flags::Write | memory::virt::Flags::Global;
 
-            if (!memory::virt::map_pages(space, (memory::virt::LOG + capacity) / 4096, phys / 4096, 1, memory::virt::Flags::Write)) {
+            if (!memory::virt::map_pages(space, (memory::virt::LOG + capacity) / 4096, phys / 4096, 1, flags)) {
                 return;
             }
 
@@ -115,7 +116,9 @@ namespace cosmos::log {
         const auto phys = memory::virt::get_phys(reinterpret_cast<uint64_t>(initial_page));
         const auto space = memory::virt::get_current();
 
-        if (!memory::virt::map_pages(space, memory::virt::LOG / 4096, phys / 4096, 1, memory::virt::Flags::Write)) {
+        constexpr auto flags = memory::virt::Flags::Write | memory::virt::Flags::Global;
+
+        if (!memory::virt::map_pages(space, memory::virt::LOG / 4096, phys / 4096, 1, flags)) {
             return;
         }
 
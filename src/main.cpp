@@ -1,4 +1,5 @@
 #include "acpi/acpi.hpp"
+#include "clock.hpp"
 #include "devices/atapio.hpp"
 #include "devices/framebuffer.hpp"
 #include "devices/info.hpp"
@@ -7,20 +8,25 @@
 #include "devices/pci.hpp"
 #include "devices/pit.hpp"
 #include "devices/ps2kbd.hpp"
-#include "gdt.hpp"
+#include "fpu.hpp"
 #include "interrupts/isr.hpp"
+#include "interrupts/lapic.hpp"
 #include "limine.hpp"
 #include "log/devfs.hpp"
 #include "log/log.hpp"
+#include "memory/cache.hpp"
 #include "memory/heap.hpp"
 #include "memory/offsets.hpp"
 #include "memory/physical.hpp"
 #include "memory/virt_range_alloc.hpp"
 #include "memory/virtual.hpp"
 #include "serial.hpp"
+#include "smp.hpp"
 #include "syscalls/init.hpp"
+#include "task/epoll.hpp"
+#include "task/fault.hpp"
+#include "task/pipe.hpp"
 #include "task/scheduler.hpp"
-#include "tss.hpp"
 #include "utils.hpp"
 #include "vfs/devfs.hpp"
 #include "vfs/iso9660.hpp"
@@ -29,6 +35,8 @@
 
 using namespace cosmos;
 
+static memory::virt::Space kernel_space = 0;
+
 void init() {
     acpi::init();
 
@@ -65,6 +73,23 @@ void init() {
     task::exit(0);
 }
 
+/// Runs on each application processor with the kernel lock held
+[[noreturn]]
+static void ap_main() {
+    uint64_t rsp;
+    asm volatile("mov %%rsp, %0" : "=r"(rsp));
+    rsp = memory::virt::DIRECT_MAP + memory::virt::get_phys(rsp);
+    asm volatile("mov %0, %%rsp" ::"ri"(rsp));
+
+    memory::virt::init_ap(kernel_space);
+    fpu::init();
+    syscalls::init();
+
+    task::run(kernel_space);
+
+    utils::halt();
+}
+
 extern "C" [[noreturn]]
 void main() {
     asm volatile("cli" ::: "memory");
@@ -74,8 +99,8 @@ void main() {
     log::enable_display();
     INFO("Starting");
 
-    gdt::init();
-    tss::init();
+    smp::init();
+    smp::lock_kernel();
     isr::init();
 
     memory::phys::init();
@@ -85,21 +110,33 @@ void main() {
     rsp = memory::virt::DIRECT_MAP + memory::virt::get_phys(rsp);
     asm volatile("mov %0, %%rsp" ::"ri"(rsp));
 
-    const auto space = memory::virt::create();
-    if (space == 0) utils::panic(nullptr, "Failed to create virtual address space");
-    memory::virt::switch_to(space);
+    kernel_space = memory::virt::create();
+    if (kernel_space == 0) utils::panic(nullptr, "Failed to create virtual address space");
+    memory::virt::switch_to(kernel_space);
     log::enable_paging();
 
+    memory::cache::init();
     memory::heap::init();
     memory::virt::init_range_alloc();
+    vfs::init();
+    task::init_regions();
+    task::init_processes();
+    task::init_pipes();
+    task::init_epoll();
+    lapic::init();
+    clock::init();
+    fpu::init();
     syscalls::init();
+    task::init_fault_handlers();
 
-    task::spawn_reaper(space);
+    task::spawn_reaper(kernel_space);
 
     const auto pid = task::create_process(init, task::Land::Kernel, "/");
     task::enqueue(pid.value());
 
-    task::run();
+    smp::start_aps(ap_main);
+
+    task::run(kernel_space);
 
     utils::halt();
 }
@@ -0,0 +1,257 @@
+#include "cache.hpp"
+
+#include "log/log.hpp"
+#include "offsets.hpp"
+#include "physical.hpp"
+#include "stl/utils.hpp"
+
+namespace cosmos::memory::cache {
+    /// Stored at the start of every slab page, objects follow after it
+    struct Slab {
+        Cache* cache;
+        uint32_t used;
+
+        Slab* prev;
+        Slab* next;
+
+        void* free_objects;
+    };
+
+    struct Cache {
+        Cache* next;
+
+        stl::StringView name;
+        CtorFn ctor;
+
+        uint32_t object_size;
+        uint32_t stride;
+
+        /// Offset of the first object from the start of the slab
+        uint32_t start;
+
+        /// Offset of the free list pointer inside an object, it is placed past the object when there is a constructor
+        uint32_t free_offset;
+
+        uint32_t objects_per_slab;
+
+        /// Slabs with at least one free object
+        Slab* partial;
+
+        /// One completely empty slab is kept around so that an alloc / free pair at the boundary doesn't hit the physical allocator
+        Slab* empty;
+
+        uint32_t slab_count;
+        uint32_t active_objects;
+    };
+
+    /// Cache holding all other caches
+    static Cache cache_cache;
+
+    static Cache* head;
+    static Cache* tail;
+    static uint32_t cache_count;
+
+    static void*& get_next_free(const Cache* cache, void* object) {
+        return *reinterpret_cast<void**>(static_cast<uint8_t*>(object) + cache->free_offset);
+    }
+
+    // Slab
+
+    static void push_slab(Slab*& list, Slab* slab) {
+        slab->prev = nullptr;
+        slab->next = list;
+
+        if (list != nullptr) list->prev = slab;
+        list = slab;
+    }
+
+    static void remove_slab(Slab*& list, Slab* slab) {
+        if (slab->prev != nullptr) {
+            slab->prev->next = slab->next;
+        } else {
+            list = slab->next;
+        }
+
+        if (slab->next != nullptr) slab->next->prev = slab->prev;
+    }
+
+    static Slab* create_slab(Cache* cache) {
+        const auto phys = phys::alloc_pages(1);
+        if (phys == 0) return nullptr;
+
+        const auto slab = reinterpret_cast<Slab*>(virt::DIRECT_MAP + phys);
+        slab->cache = cache;
+        slab->used = 0;
+        slab->free_objects = nullptr;
+
+        // Thread the free list through the objects in reverse so that allocations are handed out in address order
+        for (auto i = cache->objects_per_slab; i > 0; i--) {
+            const auto object = reinterpret_cast<uint8_t*>(slab) + cache->start + (i - 1) * cache->stride;
+            if (cache->ctor != nullptr) cache->ctor(object);
+
+            get_next_free(cache, object) = slab->free_objects;
+            slab->free_objects = object;
+        }
+
+        cache->slab_count++;
+        return slab;
+    }
+
+    static void destroy_slab(Cache* cache, Slab* slab) {
+        phys::free_pages((reinterpret_cast<uint64_t>(slab) - virt::DIRECT_MAP) / 4096ul, 1);
+        cache->slab_count--;
+    }
+
+    // Cache
+
+    static bool init_cache(Cache* cache, const stl::StringView name, const uint64_t size, uint64_t alignment, const CtorFn ctor) {
+        alignment = stl::max(alignment, alignof(void*));
+
+        cache->name = name;
+        cache->ctor = ctor;
+
+        cache->object_size = size;
+        cache->free_offset = ctor != nullptr ? stl::align_up(size, alignof(void*)) : 0;
+        cache->stride = stl::align_up(stl::max(size, cache->free_offset + sizeof(void*)), alignment);
+
+        cache->start = stl::align_up(sizeof(Slab), alignment);
+        cache->objects_per_slab = cache->start < 4096ul ? (4096ul - cache->start) / cache->stride : 0;
+
+        cache->partial = nullptr;
+        cache->empty = nullptr;
+
+        cache->slab_count = 0;
+        cache->active_objects = 0;
+
+        if (cache->objects_per_slab == 0) {
+            ERROR("Object of cache '%s' does not fit in a slab, size: %d, alignment: %d", name.data(), size, alignment);
+            return false;
+        }
+
+        // Register
+        cache->next = nullptr;
+
+        if (tail == nullptr) {
+            head = cache;
+            tail = cache;
+        } else {
+            tail->next = cache;
+            tail = cache;
+        }
+
+        cache_count++;
+        return true;
+    }
+
+    // Header
+
+    void init() {
+        head = nullptr;
+        tail = nullptr;
+        cache_count = 0;
+
+        init_cache(&cache_cache, "cache", sizeof(Cache), alignof(Cache), nullptr);
+    }
+
+    Cache* create(const stl::StringView name, const uint64_t size, const uint64_t alignment, const CtorFn ctor) {
+        const auto cache = alloc<Cache>(&cache_cache);
+        if (cache == nullptr) return nullptr;
+
+        if (!init_cache(cache, name, size, alignment, ctor)) {
+            free(&cache_cache, cache);
+            return nullptr;
+        }
+
+        return cache;
+    }
+
+    void* alloc(Cache* cache) {
+        auto slab = cache->partial;
+
+        if (slab == nullptr) {
+            if (cache->empty != nullptr) {
+                slab = cache->empty;
+                cache->empty = nullptr;
+            } else {
+                slab = create_slab(cache);
+
+                if (slab == nullptr) {
+                    ERROR("Failed to allocate slab for cache '%s'", cache->name.data());
+                    return nullptr;
+                }
+            }
+
+            push_slab(cache->partial, slab);
+        }
+
+        const auto object = slab->free_objects;
+        slab->free_objects = get_next_free(cache, object);
+        slab->used++;
+
+        if (slab->free_objects == nullptr) {
+            remove_slab(cache->partial, slab);
+        }
+
+        cache->active_objects++;
+        return object;
+    }
+
+    void free(Cache* cache, void* ptr) {
+        if (ptr == nullptr) return;
+
+        const auto slab = reinterpret_cast<Slab*>(stl::align_down(reinterpret_cast<uint64_t>(ptr) - 1, 4096ul));
+
+        if (slab->cache != cache) {
+            ERROR("Object freed to cache '%s' does not belong to it", cache->name.data());
+            return;
+        }
+
+        const auto was_full = slab->free_objects == nullptr;
+
+        get_next_free(cache, ptr) = slab->free_objects;
+        slab->free_objects = ptr;
+        slab->used--;
+
+        cache->active_objects--;
+
+        if (was_full) {
+            push_slab(cache->partial, slab);
+        }
+
+        if (slab->used == 0) {
+            remove_slab(cache->partial, slab);
+
+            if (cache->empty == nullptr) {
+                cache->empty = slab;
+            } else {
+                destroy_slab(cache, slab);
+            }
+        }
+    }
+
+    Cache* get_owner(const void* ptr) {
+        return *reinterpret_cast<Cache**>(stl::align_down(reinterpret_cast<uint64_t>(ptr) - 1, 4096ul));
+    }
+
+    uint32_t get_cache_count() {
+        return cache_count;
+    }
+
+    Stats get_stats(const uint32_t index) {
+        auto cache = head;
+
+        for (auto i = 0u; i < index && cache != nullptr; i++) {
+            cache = cache->next;
+        }
+
+        if (cache == nullptr) return {};
+
+        return {
+            .name = cache->name,
+            .object_size = cache->object_size,
+            .objects_per_slab = cache->objects_per_slab,
+            .slab_count = cache->slab_count,
+            .active_objects = cache->active_objects,
+        };
+    }
+} // namespace cosmos::memory::cache
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "stl/string_view.hpp"
+
+#include <cstdint>
+
+namespace cosmos::memory::cache {
+    /// Called once for every object when a slab is created, freed objects are expected to be returned in their constructed state
+    using CtorFn = void (*)(void* object);
+
+    struct Cache;
+
+    struct Stats {
+        stl::StringView name;
+
+        uint32_t object_size;
+        uint32_t objects_per_slab;
+
+        uint32_t slab_count;
+        uint32_t active_objects;
+    };
+
+    void init();
+
+    /// Objects are carved from single page slabs, the name is not copied and needs to outlive the cache.
+    /// @return nullptr if a single object does not fit in a slab
+    Cache* create(stl::StringView name, uint64_t size, uint64_t alignment, CtorFn ctor = nullptr);
+
+    void* alloc(Cache* cache);
+    void free(Cache* cache, void* ptr);
+
+    /// Slab pages start with a pointer to their cache, pages which are not owned by a cache must start with nullptr instead.
+    /// @return cache the object was allocated from or nullptr
+    Cache* get_owner(const void* ptr);
+
+    uint32_t get_cache_count();
+    Stats get_stats(uint32_t index);
+
+    template <typename T>
+    Cache* create(const stl::StringView name, const CtorFn ctor = nullptr) {
+        return create(name, sizeof(T), alignof(T), ctor);
+    }
+
+    template <typename T>
+    T* alloc(Cache* cache) {
+        return static_cast<T*>(alloc(cache));
+    }
+} // namespace cosmos::memory::cache
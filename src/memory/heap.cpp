@@ -1,149 +1,106 @@
 #include "heap.hpp"
 
+#include "cache.hpp"
+#include "log/log.hpp"
 #include "offsets.hpp"
 #include "physical.hpp"
 #include "stl/utils.hpp"
-#include "virtual.hpp"
+#include "utils.hpp"
 
 namespace cosmos::memory::heap {
-    struct Region {
-        Region* next;
+    /// Smallest size class, also the smallest alignment every allocation gets
+    constexpr uint64_t MIN_CLASS_SIZE = 16;
 
-        bool used : 1;
-        uint64_t size : 63;
-    };
+    /// Largest size class served from caches, bigger allocations get whole pages
+    constexpr uint64_t MAX_CLASS_SIZE = 1024;
 
-    static Region* head;
-    static Region* tail;
-    static uint64_t page_count;
-
-    bool grow() {
-        const auto phys = phys::alloc_pages(1);
-        if (phys == 0) return false;
-
-        const auto space = virt::get_current();
-        if (!virt::map_pages(space, virt::HEAP / 4096ul + page_count, phys / 4096ul, 1, virt::Flags::Write)) return false;
-
-        if (tail == nullptr || tail->used) {
-            const auto region = reinterpret_cast<Region*>(virt::HEAP + page_count * 4096ul);
-            region->next = nullptr;
-            region->used = false;
-            region->size = 4096ul - sizeof(Region);
-
-            if (tail == nullptr) {
-                head = region;
-                tail = region;
-            } else {
-                tail->next = region;
-                tail = region;
-            }
-        } else {
-            tail->size += 4096ul;
-        }
+    /// Size classes are powers of two from MIN_CLASS_SIZE to MAX_CLASS_SIZE
+    constexpr uint32_t CLASS_COUNT = 7;
 
-        page_count++;
-        return true;
-    }
+    /// Stored in the page holding the byte just before the returned pointer of large allocations
+    struct Large {
+        /// Always nullptr so that cache::get_owner doesn't mistake the page for a slab
+        cache::Cache* cache;
 
-    void init() {
-        head = nullptr;
-        tail = nullptr;
-        page_count = 0;
+        uint64_t first_page;
+        uint32_t page_count;
+    };
 
-        grow();
-    }
+    static constexpr const char* class_names[CLASS_COUNT] = {
+        "heap-16", "heap-32", "heap-64", "heap-128", "heap-256", "heap-512", "heap-1024",
+    };
 
-    void* alloc_from_node(Region* current, const uint64_t size) {
-        if (current->size - size < sizeof(Region) + 8) {
-            current->used = true;
-        } else {
-            const auto free = reinterpret_cast<Region*>(reinterpret_cast<uint64_t>(current + 1) + size);
-            free->next = current->next;
-            free->used = false;
-            free->size = current->size - size - sizeof(Region);
-
-            current->next = free;
-            current->used = true;
-            current->size = size;
-
-            if (current == tail) {
-                tail = free;
-            }
-        }
+    static cache::Cache* classes[CLASS_COUNT];
 
-        return current + 1;
+    static uint32_t get_class(const uint64_t size) {
+        if (size <= MIN_CLASS_SIZE) return 0;
+        return 64 - __builtin_clzll(size - 1) - __builtin_ctzll(MIN_CLASS_SIZE);
     }
 
-    void* alloc(const uint64_t size, const uint64_t alignment) {
-#define REGION_START(region) reinterpret_cast<uint64_t>(region + 1)
-#define CALC_PADDING(region) (stl::align_up(REGION_START(region), alignment) - REGION_START(region))
-#define CHECK_REGION(region) (!region->used && region->size >= size + CALC_PADDING(region))
-
-        auto current = head;
+    static Large* get_large(const void* ptr) {
+        return reinterpret_cast<Large*>(stl::align_down(reinterpret_cast<uint64_t>(ptr) - 1, 4096ul));
+    }
 
-        do {
-            if (CHECK_REGION(current)) {
-                break;
-            }
+    // Large
 
-            current = current->next;
-        } while (current != nullptr);
+    static void* alloc_large(const uint64_t size, const uint64_t alignment) {
+        // Pages are always at least page aligned so the padding before the pointer never exceeds this
+        const auto offset = stl::align_up(sizeof(Large), alignment);
+        const auto page_count = stl::ceil_div(offset + size, 4096ul);
 
-        if (current == nullptr) {
-            do {
-                if (!grow()) return nullptr;
-            } while (!CHECK_REGION(tail));
+        const auto phys = phys::alloc_pages(page_count);
+        if (phys == 0) return nullptr;
 
-            current = tail;
-        }
+        const auto first = virt::DIRECT_MAP + phys;
+        const auto ptr = stl::align_up(first + sizeof(Large), alignment);
 
-        const auto padding = CALC_PADDING(current);
-        return reinterpret_cast<void*>(padding + reinterpret_cast<uint64_t>(alloc_from_node(current, padding + size)));
+        const auto large = get_large(reinterpret_cast<void*>(ptr));
+        large->cache = nullptr;
+        large->first_page = phys / 4096ul;
+        large->page_count = page_count;
 
-#undef CHECK_REGION
-#undef CALC_PADDING
-#undef REGION_START
+        return reinterpret_cast<void*>(ptr);
     }
 
-    void merge_forward(Region* region) {
-        region->size += sizeof(Region) + region->next->size;
-
-        if (region->next == tail) {
-            tail = region;
-        }
-
-        region->next = region->next->next;
+    static void free_large(const Large* large) {
+        phys::free_pages(large->first_page, large->page_count);
     }
 
-    void free(void* ptr) {
-        Region* prev = nullptr;
-        Region* current = head;
+    // Header
 
-        const auto ptr_address = reinterpret_cast<uint64_t>(ptr);
+    void init() {
+        for (auto i = 0u; i < CLASS_COUNT; i++) {
+            const auto size = MIN_CLASS_SIZE << i;
+            classes[i] = cache::create(class_names[i], size, size);
 
-        do {
-            const auto start = reinterpret_cast<uint64_t>(current + 1);
-            const auto end = start + current->size;
+            if (classes[i] == nullptr) utils::panic(nullptr, "[heap] Failed to create %s cache", class_names[i]);
+        }
+    }
 
-            if (ptr_address >= start && ptr_address < end) {
-                break;
-            }
+    void* alloc(const uint64_t size, const uint64_t alignment) {
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+            ERROR("Invalid heap allocation alignment %d", alignment);
+            return nullptr;
+        }
 
-            prev = current;
-            current = current->next;
-        } while (current != nullptr);
+        // Objects in a slab are aligned to the size of their class
+        const auto class_size = stl::max(size, alignment);
 
-        if (current == nullptr || !current->used) {
-            return;
+        if (class_size <= MAX_CLASS_SIZE) {
+            return cache::alloc(classes[get_class(class_size)]);
         }
 
-        current->used = false;
+        return alloc_large(size, stl::max(alignment, MIN_CLASS_SIZE));
+    }
+
+    void free(void* ptr) {
+        if (ptr == nullptr) return;
 
-        if (prev != nullptr && !prev->used) {
-            merge_forward(prev);
-            if (prev->next != nullptr && !prev->next->used) merge_forward(prev);
-        } else if (current->next != nullptr && !current->next->used) {
-            merge_forward(current);
+        // Objects allocated directly from other caches can be freed here as well
+        if (const auto cache = cache::get_owner(ptr)) {
+            cache::free(cache, ptr);
+        } else {
+            free_large(get_large(ptr));
         }
     }
 } // namespace cosmos::memory::heap
@@ -7,6 +7,9 @@ namespace cosmos::memory::virt {
 
     constexpr uint64_t LOWER_HALF_END = 0x0000800000000000;
 
+    /// Read-only clock page shared with every user space, right below where mappings without a fixed address are placed
+    constexpr uint64_t CLOCK_PAGE = 0x00000FFFFFFFF000;
+
     /// Direct map starts immediately at the higher half split
     constexpr uint64_t DIRECT_MAP = 0xFFFF800000000000;
 
@@ -19,9 +22,6 @@ namespace cosmos::memory::virt {
     /// Range allocator starts 1gB after framebuffer
     constexpr uint64_t RANGE_ALLOC = LOG + (1ul * GB);
 
-    /// Heap starts 1 gB after range allocator
-    constexpr uint64_t HEAP = RANGE_ALLOC + (1ul * GB);
-
     /// Kernel starts at the last 2 gB of the entire address space
     constexpr uint64_t KERNEL = 0xFFFFFFFF80000000;
 
@@ -6,12 +6,33 @@
 #include "utils.hpp"
 
 namespace cosmos::memory::phys {
+    /// Largest block handed out by the buddy allocator, 2^18 pages = 1 gB
+    constexpr uint32_t MAX_ORDER = 18;
+
+    /// Marks a page in the order array which is not the first page of a free block
+    constexpr uint8_t NOT_FREE = 0xFF;
+
+    /// Stored inside the first page of every free block, linking it into the free list of its order
+    struct FreeBlock {
+        FreeBlock* prev;
+        FreeBlock* next;
+    };
+
     static uint64_t* entries;
     static uint32_t entry_count;
 
+    static uint8_t* orders;
+    static FreeBlock* free_lists[MAX_ORDER + 1];
+
+    /// Allocated pages start with a reference count of 1, 0 is treated as 1 for pages which were never allocated
+    /// Every reference is held by a page table entry, overflowing 32 bits would take 32 gB of page tables mapping the same page
+    static uint32_t* ref_counts;
+
     static uint32_t total_pages;
     static uint32_t used_pages;
 
+    // Bitmap
+
     bool mark_page(const uint32_t index, const bool used) {
         uint64_t& entry = entries[index / 64u];
         const uint64_t mask = 1ull << (index % 64u);
@@ -44,6 +65,197 @@ namespace cosmos::memory::phys {
         }
     }
 
+    bool is_page_used(const uint32_t index) {
+        return (entries[index / 64u] >> (index % 64u)) & 1u;
+    }
+
+    // Buddy
+
+    static FreeBlock* get_block(const uint32_t page) {
+        return reinterpret_cast<FreeBlock*>(limine::get_hhdm() + page * 4096ul);
+    }
+
+    static uint32_t get_page(const FreeBlock* block) {
+        return (reinterpret_cast<uint64_t>(block) - limine::get_hhdm()) / 4096ul;
+    }
+
+    static uint32_t get_order(const uint32_t count) {
+        if (count <= 1) return 0;
+        return 32 - __builtin_clz(count - 1);
+    }
+
+    static void push_block(const uint32_t page, const uint32_t order) {
+        const auto block = get_block(page);
+
+        block->prev = nullptr;
+        block->next = free_lists[order];
+
+        if (block->next != nullptr) block->next->prev = block;
+        free_lists[order] = block;
+
+        orders[page] = order;
+    }
+
+    static void remove_block(const uint32_t page, const uint32_t order) {
+        const auto block = get_block(page);
+
+        if (block->prev != nullptr) {
+            block->prev->next = block->next;
+        } else {
+            free_lists[order] = block->next;
+        }
+
+        if (block->next != nullptr) block->next->prev = block->prev;
+
+        orders[page] = NOT_FREE;
+    }
+
+    /// Inserts a naturally aligned block into the free lists, merging it with its buddy as long as the buddy is free
+    static void free_block(uint32_t page, uint32_t order) {
+        while (order < MAX_ORDER) {
+            const auto buddy = page ^ (1u << order);
+            if (buddy >= total_pages || orders[buddy] != order) break;
+
+            remove_block(buddy, order);
+
+            page &= ~(1u << order);
+            order++;
+        }
+
+        push_block(page, order);
+    }
+
+    /// Splits the range into the largest naturally aligned blocks and inserts them into the free lists
+    static void free_range(uint32_t first, uint32_t count) {
+        while (count > 0) {
+            auto order = first == 0 ? MAX_ORDER : stl::min(static_cast<uint32_t>(__builtin_ctz(first)), MAX_ORDER);
+            while ((1u << order) > count) order--;
+
+            free_block(first, order);
+
+            first += 1u << order;
+            count -= 1u << order;
+        }
+    }
+
+    // Self-check
+
+    constexpr uint32_t CHECK_STEPS = 256;
+    constexpr uint32_t CHECK_MAX_LIVE = 32;
+    constexpr uint32_t CHECK_MAX_PAGES = 40;
+
+    struct CheckAllocation {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    static uint64_t check_random(uint64_t& state) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        return state;
+    }
+
+    /// Walks the free lists and returns the number of pages in them.
+    /// When check_pages is set it also panics if any page of a free block is marked as used in the bitmap.
+    static uint32_t count_free_list_pages(const bool check_pages) {
+        uint32_t count = 0;
+
+        for (auto order = 0u; order <= MAX_ORDER; order++) {
+            for (auto block = free_lists[order]; block != nullptr; block = block->next) {
+                const auto page = get_page(block);
+
+                if (orders[page] != order || page % (1u << order) != 0) {
+                    utils::panic(nullptr, "[memory] Buddy self-check failed, corrupted free block at page %d", page);
+                }
+
+                for (auto i = 0u; check_pages && i < (1u << order); i++) {
+                    if (is_page_used(page + i)) {
+                        utils::panic(nullptr, "[memory] Buddy self-check failed, free page %d is marked as used", page + i);
+                    }
+                }
+
+                count += 1u << order;
+            }
+        }
+
+        return count;
+    }
+
+    static uint32_t count_bitmap_free_pages() {
+        uint32_t used = 0;
+
+        for (auto i = 0u; i < entry_count; i++) {
+            used += __builtin_popcountll(entries[i]);
+        }
+
+        // Bits past the last page are never cleared
+        used -= entry_count * 64u - total_pages;
+
+        return total_pages - used;
+    }
+
+    /// Runs a randomized alloc / free trace through the buddy allocator and compares the result against the bitmap
+    static void self_check() {
+        const auto initial_used = used_pages;
+
+        CheckAllocation allocations[CHECK_MAX_LIVE];
+        uint32_t live = 0;
+
+        uint64_t state = 0x2545F4914F6CDD1Dull ^ total_pages;
+
+        for (auto step = 0u; step < CHECK_STEPS; step++) {
+            const auto roll = check_random(state);
+
+            if (live < CHECK_MAX_LIVE && (live == 0 || roll % 3 != 0)) {
+                const auto count = 1 + static_cast<uint32_t>((roll >> 8) % CHECK_MAX_PAGES);
+                const auto phys = alloc_pages(count);
+
+                if (phys == 0) continue;
+                const auto first = static_cast<uint32_t>(phys / 4096ul);
+
+                for (auto i = 0u; i < count; i++) {
+                    if (!is_page_used(first + i) || orders[first + i] != NOT_FREE) {
+                        utils::panic(nullptr, "[memory] Buddy self-check failed, allocated page %d is still free", first + i);
+                    }
+                }
+
+                for (auto i = 0u; i < live; i++) {
+                    const auto& other = allocations[i];
+
+                    if (first < other.first + other.count && other.first < first + count) {
+                        utils::panic(nullptr, "[memory] Buddy self-check failed, page %d allocated twice", first);
+                    }
+                }
+
+                allocations[live++] = { first, count };
+            } else {
+                const auto index = static_cast<uint32_t>((roll >> 8) % live);
+
+                free_pages(allocations[index].first, allocations[index].count);
+                allocations[index] = allocations[--live];
+            }
+
+            const auto free_list_pages = count_free_list_pages(false);
+
+            if (free_list_pages != total_pages - used_pages || free_list_pages != count_bitmap_free_pages()) {
+                utils::panic(nullptr, "[memory] Buddy self-check failed, free lists disagree with bitmap after step %d", step);
+            }
+        }
+
+        while (live > 0) {
+            live--;
+            free_pages(allocations[live].first, allocations[live].count);
+        }
+
+        if (used_pages != initial_used || count_free_list_pages(true) != count_bitmap_free_pages()) {
+            utils::panic(nullptr, "[memory] Buddy self-check failed, memory was leaked");
+        }
+    }
+
+    // Header
+
     void init() {
         // Calculate total memory size
         total_pages = 0;
@@ -58,29 +270,38 @@ namespace cosmos::memory::phys {
 
         entry_count = stl::ceil_div(total_pages, 64u);
 
-        // Find usable range to store entries in
-        const uint32_t entries_page_count = stl::ceil_div(entry_count * 8ul, 4096ul);
-        uint32_t entries_page_index = 0xFFFFFFFF;
+        // Find usable range to store the bitmask, order array and reference counts in
+        const auto orders_size = stl::align_up(static_cast<uint64_t>(total_pages), 8ul);
+        const uint32_t metadata_page_count = stl::ceil_div(entry_count * 8ul + orders_size + total_pages * 4ul, 4096ul);
+        uint32_t metadata_page_index = 0xFFFFFFFF;
 
         for (auto i = 0u; i < limine::get_memory_range_count(); i++) {
             const auto [type, first_page, page_count] = limine::get_memory_range(i);
 
-            if (type == limine::MemoryType::Usable && first_page >= 1 && page_count >= entries_page_count) {
+            if (type == limine::MemoryType::Usable && first_page >= 1 && page_count >= metadata_page_count) {
                 entries = reinterpret_cast<uint64_t*>(limine::get_hhdm() + first_page * 4096);
-                entries_page_index = first_page;
+                orders = reinterpret_cast<uint8_t*>(entries + entry_count);
+                ref_counts = reinterpret_cast<uint32_t*>(orders + orders_size);
+                metadata_page_index = first_page;
 
                 break;
             }
         }
 
-        if (entries_page_index == 0xFFFFFFFF) {
-            utils::panic(nullptr, "[memory] Failed to find enough memory to store physical memory bitmask");
+        if (metadata_page_index == 0xFFFFFFFF) {
+            utils::panic(nullptr, "[memory] Failed to find enough memory to store physical memory metadata");
         }
 
         // Mark all pages as used
         utils::memset(entries, 0xFF, entry_count * 8ul);
+        utils::memset(orders, NOT_FREE, total_pages);
+        utils::memset(ref_counts, 0, total_pages * 4ul);
         used_pages = total_pages;
 
+        for (auto& free_list : free_lists) {
+            free_list = nullptr;
+        }
+
         // Mark usable ranges as unused
         for (auto i = 0u; i < limine::get_memory_range_count(); i++) {
             const auto [type, first_page, page_count] = limine::get_memory_range(i);
@@ -90,49 +311,146 @@ namespace cosmos::memory::phys {
             }
         }
 
-        // Mark entries bitmask as used
-        mark_pages(entries_page_index, entries_page_count, true);
+        // Mark metadata as used
+        mark_pages(metadata_page_index, metadata_page_count, true);
 
         // Mark first page as used
         mark_pages(0, 1, true);
 
+        // Build free lists from the runs of unused pages
+        auto run_first = 0u;
+        auto run_count = 0u;
+
+        for (auto i = 0u; i < total_pages; i++) {
+            if (i % 64u == 0 && entries[i / 64u] == 0xFFFFFFFFFFFFFFFF) {
+                if (run_count > 0) {
+                    free_range(run_first, run_count);
+                    run_count = 0;
+                }
+
+                i += 63;
+                continue;
+            }
+
+            if (!is_page_used(i)) {
+                if (run_count == 0) run_first = i;
+                run_count++;
+            } else if (run_count > 0) {
+                free_range(run_first, run_count);
+                run_count = 0;
+            }
+        }
+
+        if (run_count > 0) {
+            free_range(run_first, run_count);
+        }
+
+        self_check();
+
         INFO("Initialized PMM with %d pages, %d mB", total_pages, static_cast<uint64_t>(total_pages) * 4096ull / 1024ull / 1024ull);
     }
 
     uint64_t alloc_pages(const uint32_t count) {
-        uint32_t first_empty = 0;
-        uint32_t empty_count = 0;
+        const auto order = get_order(count);
 
-        for (auto i = 0u; i < entry_count; i++) {
-            uint64_t entry = entries[i];
-
-            for (auto j = 0; j < 64; j++) {
-                if ((entry & 1u) == 0) {
-                    if (empty_count == 0) {
-                        first_empty = i * 64 + j;
-                        empty_count = 1;
-                    } else {
-                        empty_count++;
-                    }
-                } else {
-                    empty_count = 0;
-                }
+        if (count == 0 || order > MAX_ORDER) {
+            ERROR("Failed to allocate %d pages", count);
+            return 0;
+        }
+
+        // Find the smallest free block which fits
+        auto current = order;
 
-                if (empty_count >= count) {
-                    mark_pages(first_empty, count, true);
-                    return static_cast<uint64_t>(first_empty) * 4096ul;
+        while (current <= MAX_ORDER && free_lists[current] == nullptr) {
+            current++;
+        }
+
+        if (current > MAX_ORDER) {
+            ERROR("Failed to allocate %d pages", count);
+            return 0;
+        }
+
+        const auto first = get_page(free_lists[current]);
+        remove_block(first, current);
+
+        // Split it down to the requested order
+        while (current > order) {
+            current--;
+            push_block(first + (1u << current), current);
+        }
+
+        // Give back the pages past the requested count
+        free_range(first + count, (1u << order) - count);
+
+        mark_pages(first, count, true);
+
+        for (auto i = 0u; i < count; i++) {
+            ref_counts[first + i] = 1;
+        }
+
+        return static_cast<uint64_t>(first) * 4096ul;
+    }
+
+    void free_pages(const uint32_t first, uint32_t count) {
+        if (first >= total_pages) return;
+        count = stl::min(count, total_pages - first);
+
+        // Only pages which were actually marked as used are given back to the free lists
+        auto run_first = first;
+        auto run_count = 0u;
+        auto freed = 0u;
+
+        for (auto i = 0u; i < count; i++) {
+            // Shared pages only lose a reference
+            if (ref_counts[first + i] > 1) {
+                ref_counts[first + i]--;
+
+                if (run_count > 0) {
+                    free_range(run_first, run_count);
+                    run_count = 0;
                 }
 
-                entry >>= 1;
+                continue;
+            }
+
+            ref_counts[first + i] = 0;
+
+            if (mark_page(first + i, false)) {
+                if (run_count == 0) run_first = first + i;
+                run_count++;
+                freed++;
+            } else if (run_count > 0) {
+                free_range(run_first, run_count);
+                run_count = 0;
             }
         }
 
-        ERROR("Failed to allocate %d pages", count);
-        return 0;
+        if (run_count > 0) {
+            free_range(run_first, run_count);
+        }
+
+        used_pages -= freed;
+    }
+
+    void ref_pages(const uint32_t first, uint32_t count) {
+        if (first >= total_pages) return;
+        count = stl::min(count, total_pages - first);
+
+        for (auto i = 0u; i < count; i++) {
+            auto& ref_count = ref_counts[first + i];
+
+            if (!is_page_used(first + i)) {
+                ERROR("Failed to reference page %d", first + i);
+                continue;
+            }
+
+            ref_count = stl::max(ref_count, 1u) + 1;
+        }
     }
 
-    void free_pages(const uint32_t first, const uint32_t count) {
-        mark_pages(first, count, false);
+    uint32_t get_ref_count(const uint32_t page) {
+        if (page >= total_pages) return 0;
+        return ref_counts[page];
     }
 
     uint32_t get_total_pages() {
@@ -6,12 +6,19 @@ namespace cosmos::memory::phys {
     void init();
 
     /**
+     * Allocated pages are physically contiguous and the first page is aligned to count rounded up to the next power of two.
      * @return physical address to the page or 0 if it failed to do so
      */
     uint64_t alloc_pages(uint32_t count);
 
+    /// Pages which were shared with ref_pages are only given back once their reference count drops to zero
     void free_pages(uint32_t first, uint32_t count);
 
+    /// Increments the reference count of allocated pages, every reference needs to be released with free_pages
+    void ref_pages(uint32_t first, uint32_t count);
+
+    uint32_t get_ref_count(uint32_t page);
+
     uint32_t get_total_pages();
     uint32_t get_used_pages();
 
@@ -1,9 +1,11 @@
 #include "virtual.hpp"
 
+#include "interrupts/lapic.hpp"
 #include "limine.hpp"
 #include "log/log.hpp"
 #include "offsets.hpp"
 #include "physical.hpp"
+#include "smp.hpp"
 #include "utils.hpp"
 
 namespace cosmos::memory::virt {
@@ -63,7 +65,11 @@ namespace cosmos::memory::virt {
     constexpr uint64_t FLAG_WRITE_THROUGH = 1ul << 3;
     constexpr uint64_t FLAG_CACHE_DISABLE = 1ul << 4;
     constexpr uint64_t FLAG_ACCESSED = 1ul << 5;
+    constexpr uint64_t FLAG_DIRTY = 1ul << 6;
     constexpr uint64_t FLAG_DIRECT = 1ul << 7;
+    constexpr uint64_t FLAG_GLOBAL = 1ul << 8;
+    constexpr uint64_t FLAG_COPY_ON_WRITE = 1ul << 9; // Available to software
+    constexpr uint64_t FLAG_SHARED = 1ul << 10; // Available to software
     constexpr uint64_t FLAG_NO_EXECUTE = 1ul << 63;
 
     constexpr uint64_t ADDRESS_MASK /*************/ = 0b00000000'00000111'11111111'11111111'11111111'11111111'11110000'00000000;
@@ -98,10 +104,52 @@ namespace cosmos::memory::virt {
         return (entry & FLAG_DIRECT) == FLAG_DIRECT;
     }
 
+    bool entry_is_copy_on_write(const uint64_t entry) {
+        return (entry & FLAG_COPY_ON_WRITE) == FLAG_COPY_ON_WRITE;
+    }
+
+    bool entry_is_dirty(const uint64_t entry) {
+        return (entry & FLAG_DIRTY) == FLAG_DIRTY;
+    }
+
+    bool entry_is_shared(const uint64_t entry) {
+        return (entry & FLAG_SHARED) == FLAG_SHARED;
+    }
+
     bool entry_is_no_execute(const uint64_t entry) {
         return (entry & FLAG_NO_EXECUTE) == FLAG_NO_EXECUTE;
     }
 
+    // PCID
+
+    constexpr uint64_t CR3_PCID_MASK = 0xFFF;
+    constexpr uint64_t CR3_NO_FLUSH = 1ul << 63;
+
+    constexpr uint64_t CR4_PGE = 1ul << 7;
+    constexpr uint64_t CR4_PCIDE = 1ul << 17;
+
+    constexpr uint64_t MAX_PCID = 4095;
+
+    /// Not present PML4 entry in the kernel half which no mapping uses, holds the PCID of the space, the CPU it was last switched to on
+    /// and the generation it belongs to. An entry from an older generation means the space has no PCID and gets a new one the next time
+    /// it is switched to.
+    constexpr uint32_t PCID_ENTRY = 510;
+    constexpr uint64_t PCID_ENTRY_CPU_OFFSET = 16;
+    constexpr uint64_t PCID_ENTRY_CPU_MASK = 0xFF;
+    constexpr uint64_t PCID_ENTRY_GENERATION_OFFSET = 32;
+
+    static bool pcid_supported = false;
+
+    /// PCIDs are handed out in order and only reused after all of them were flushed when starting a new generation
+    static uint64_t pcid_generation = 1;
+    static uint64_t next_pcid = 1;
+
+    /// Generation each CPU last flushed its TLB for, entries cached under PCIDs of older generations belong to other spaces
+    static uint64_t cpu_pcid_generations[smp::MAX_CPUS] = {};
+
+    /// Space each CPU last switched to, threads can run the same space on several CPUs at once
+    static Space cpu_spaces[smp::MAX_CPUS] = {};
+
     // Space
 
     static bool first_create = true;
@@ -117,13 +165,72 @@ namespace cosmos::memory::virt {
         return reinterpret_cast<T*>(limine::get_hhdm() + phys);
     }
 
+    /// Drops the PCID of the space so that no stale entries of it are used once the space is switched to again
+    static void forget_pcid(const Space space) {
+        get_ptr_from_phys<uint64_t>(space)[PCID_ENTRY] = 0;
+    }
+
+    /// Entries of spaces which are not current can still be cached under their PCID
+    static void invalidate_page(const Space space, const bool current, const uint64_t virt) {
+        if (current) asm volatile("invlpg (%0)" ::"r"(virt) : "memory");
+        else forget_pcid(space);
+    }
+
+    /// Flushes all TLB entries of all PCIDs, including global ones
+    static void flush_all() {
+        uint64_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" ::"r"(cr4 & ~CR4_PGE) : "memory");
+        asm volatile("mov %0, %%cr4" ::"r"(cr4) : "memory");
+    }
+
+    /// Flushes all non-global TLB entries of the current PCID
+    static void flush_current() {
+        uint64_t cr3;
+        asm volatile("mov %%cr3, %0" : "=r"(cr3));
+        asm volatile("mov %0, %%cr3" ::"r"(cr3 & ~CR3_NO_FLUSH) : "memory");
+    }
+
+    /// Makes the other CPUs running the space flush their TLB and waits until they did, called after changing existing entries.
+    /// The kernel lock is held, CPUs spinning on it flush while they wait so the two can't deadlock.
+    static void shootdown(const Space space) {
+        const auto current = smp::get_current();
+
+        // Only the CPU which last switched to the space keeps its entries across switches, the others flush when switching to it
+        if (pcid_supported && ((get_ptr_from_phys<uint64_t>(space)[PCID_ENTRY] >> PCID_ENTRY_CPU_OFFSET) & PCID_ENTRY_CPU_MASK) != current->index) {
+            forget_pcid(space);
+        }
+
+        auto pending = false;
+
+        for (auto i = 0u; i < smp::get_cpu_count(); i++) {
+            const auto cpu = smp::get_cpu(i);
+            if (cpu == current || cpu_spaces[i] != space) continue;
+
+            __atomic_store_n(&cpu->flush_tlb, true, __ATOMIC_RELEASE);
+            lapic::send_ipi(cpu->lapic_id, lapic::TLB_FLUSH_IRQ);
+
+            pending = true;
+        }
+
+        if (!pending) return;
+
+        for (auto i = 0u; i < smp::get_cpu_count(); i++) {
+            const auto cpu = smp::get_cpu(i);
+
+            while (__atomic_load_n(&cpu->flush_tlb, __ATOMIC_ACQUIRE)) {
+                asm volatile("pause" ::: "memory");
+            }
+        }
+    }
+
     bool map_kernel(const Space space) {
         for (auto i = 0u; i < limine::get_memory_range_count(); i++) {
             const auto [type, first_page, page_count] = limine::get_memory_range(i);
 
             if (type == limine::MemoryType::ExecutableAndModules) {
                 constexpr auto virt = KERNEL / 4096ul;
-                return map_pages(space, virt, first_page, page_count, Flags::Write | Flags::Execute);
+                return map_pages(space, virt, first_page, page_count, Flags::Write | Flags::Execute | Flags::Global);
             }
         }
 
@@ -137,7 +244,7 @@ namespace cosmos::memory::virt {
 
             if (type == limine::MemoryType::Framebuffer) {
                 constexpr auto virt = FRAMEBUFFER / 4096ul;
-                return map_pages(space, virt, first_page, page_count, Flags::Write | Flags::Uncached);
+                return map_pages(space, virt, first_page, page_count, Flags::Write | Flags::Uncached | Flags::Global);
             }
         }
 
@@ -152,19 +259,40 @@ namespace cosmos::memory::virt {
             const auto [type, first_page, page_count] = limine::get_memory_range(i);
 
             if (limine::memory_type_ram(type)) {
-                if (!map_pages(space, virt + first_page, first_page, page_count, Flags::Write)) return false;
+                if (!map_pages(space, virt + first_page, first_page, page_count, Flags::Write | Flags::Global)) return false;
             }
         }
 
         return true;
     }
 
+    static void enable_features() {
+        // Make the kernel respect read-only pages too, otherwise its writes to user memory would bypass copy-on-write
+        uint64_t cr0;
+        asm volatile("mov %%cr0, %0" : "=r"(cr0));
+        asm volatile("mov %0, %%cr0" ::"r"(cr0 | (1ul << 16)) : "memory");
+
+        // Keep kernel mappings in the TLB across address space switches and tag user entries with PCIDs
+        uint64_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" ::"r"(cr4 | CR4_PGE | (pcid_supported ? CR4_PCIDE : 0)) : "memory");
+    }
+
     Space create() {
         if (first_create) {
             uint32_t eax, ebx, ecx, edx;
             utils::cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
             gb_pages_supported = (edx >> 26) & 1;
 
+            // PCIDs can only be enabled while the current PCID is 0
+            utils::cpuid(1, &eax, &ebx, &ecx, &edx);
+            pcid_supported = (ecx >> 17) & 1;
+
+            uint64_t cr3;
+            asm volatile("mov %%cr3, %0" : "=r"(cr3));
+            if ((cr3 & CR3_PCID_MASK) != 0) pcid_supported = false;
+
+            enable_features();
             first_create = false;
         }
 
@@ -205,7 +333,7 @@ namespace cosmos::memory::virt {
         Space space;
         asm volatile("mov %%cr3, %0" : "=r"(space));
 
-        return space;
+        return space & ~CR3_PCID_MASK;
     }
 
     static uint64_t* get_child_table(uint64_t& entry) {
@@ -226,26 +354,19 @@ namespace cosmos::memory::virt {
         return get_ptr_from_phys<uint64_t>(entry & ADDRESS_MASK);
     }
 
+    /// Shares the page between both entries, writable pages are made read-only in both and copied on the first write.
+    /// Pages marked as shared stay writable in both.
     template <const uint64_t ADDRESS_MASK, const uint64_t PAGE_COUNT>
-    static bool copy_direct(const uint64_t old_entry, uint64_t& new_entry) {
-        uint64_t phys;
-
-        auto flags = (old_entry & FLAG_WRITABLE) | (old_entry & FLAG_USER) | (old_entry & FLAG_NO_EXECUTE);
-        if (PAGE_COUNT > 1) flags |= FLAG_DIRECT;
+    static void share_direct(uint64_t& old_entry, uint64_t& new_entry) {
+        if (!entry_is_cache_disabled(old_entry)) {
+            phys::ref_pages((old_entry & ADDRESS_MASK) / 4096ul, PAGE_COUNT);
 
-        if (entry_is_cache_disabled(old_entry)) {
-            phys = old_entry & ADDRESS_MASK;
-            flags |= FLAG_CACHE_DISABLE | FLAG_WRITE_THROUGH;
-        } else {
-            phys = phys::alloc_pages(PAGE_COUNT);
-            if (phys == 0) return false;
-
-            utils::memcpy(get_ptr_from_phys<void>(phys), get_ptr_from_phys<void>(old_entry & ADDRESS_MASK), PAGE_COUNT * 4096ULL);
+            if (entry_is_writable(old_entry) && !entry_is_shared(old_entry)) {
+                old_entry = (old_entry & ~FLAG_WRITABLE) | FLAG_COPY_ON_WRITE;
+            }
         }
 
-        new_entry = (phys & ADDRESS_MASK) | FLAG_PRESENT | flags;
-
-        return true;
+        new_entry = old_entry & ~(FLAG_ACCESSED | FLAG_DIRTY);
     }
 
     Space fork(const Space other) {
@@ -270,17 +391,13 @@ namespace cosmos::memory::virt {
             }
 
             for (auto pdp_index = 0; pdp_index < 512; pdp_index++) {
-                const auto other_pdp_entry = other_pdp_table[pdp_index];
+                auto& other_pdp_entry = other_pdp_table[pdp_index];
                 if (!entry_is_present(other_pdp_entry)) continue;
 
                 auto& new_pdp_entry = new_pdp_table[pdp_index];
 
                 if (entry_is_direct(other_pdp_entry)) {
-                    if (!copy_direct<DIRECT_PDP_ADDRESS_MASK, (1ULL << VIRT_ADDR_PDP_OFFSET) / 4096ULL>(other_pdp_entry, new_pdp_entry)) {
-                        destroy(space);
-                        return 0;
-                    }
-
+                    share_direct<DIRECT_PDP_ADDRESS_MASK, (1ULL << VIRT_ADDR_PDP_OFFSET) / 4096ULL>(other_pdp_entry, new_pdp_entry);
                     continue;
                 }
 
@@ -293,17 +410,13 @@ namespace cosmos::memory::virt {
                 }
 
                 for (auto pd_index = 0; pd_index < 512; pd_index++) {
-                    const auto other_pd_entry = other_pd_table[pd_index];
+                    auto& other_pd_entry = other_pd_table[pd_index];
                     if (!entry_is_present(other_pd_entry)) continue;
 
                     auto& new_pd_entry = new_pd_table[pd_index];
 
                     if (entry_is_direct(other_pd_entry)) {
-                        if (!copy_direct<DIRECT_PD_ADDRESS_MASK, (1ULL << VIRT_ADDR_PD_OFFSET) / 4096ULL>(other_pd_entry, new_pd_entry)) {
-                            destroy(space);
-                            return 0;
-                        }
-
+                        share_direct<DIRECT_PD_ADDRESS_MASK, (1ULL << VIRT_ADDR_PD_OFFSET) / 4096ULL>(other_pd_entry, new_pd_entry);
                         continue;
                     }
 
@@ -316,23 +429,84 @@ namespace cosmos::memory::virt {
                     }
 
                     for (auto pt_index = 0; pt_index < 512; pt_index++) {
-                        const auto other_pt_entry = other_pt_table[pt_index];
+                        auto& other_pt_entry = other_pt_table[pt_index];
                         if (!entry_is_present(other_pt_entry)) continue;
 
-                        auto& new_pt_entry = new_pt_table[pt_index];
-
-                        if (!copy_direct<ADDRESS_MASK, 1>(other_pt_entry, new_pt_entry)) {
-                            destroy(space);
-                            return 0;
-                        }
+                        share_direct<ADDRESS_MASK, 1>(other_pt_entry, new_pt_table[pt_index]);
                     }
                 }
             }
         }
 
+        // Writable pages of the other space were made read-only
+        if (get_current() == other) flush_current();
+        else forget_pcid(other);
+
+        shootdown(other);
+
         return space;
     }
 
+    template <const uint64_t ADDRESS_MASK, const uint64_t PAGE_COUNT>
+    static bool resolve_entry(uint64_t& entry, const uint64_t virt) {
+        if (!entry_is_copy_on_write(entry)) return false;
+
+        const auto old_phys = entry & ADDRESS_MASK;
+
+        if (phys::get_ref_count(old_phys / 4096ul) > 1) {
+            const auto new_phys = phys::alloc_pages(PAGE_COUNT);
+
+            if (new_phys == 0) {
+                ERROR("Failed to allocate memory for copy-on-write page");
+                return false;
+            }
+
+            utils::memcpy(get_ptr_from_phys<void>(new_phys), get_ptr_from_phys<void>(old_phys), PAGE_COUNT * 4096ULL);
+
+            entry = (entry & ~ADDRESS_MASK) | (new_phys & ADDRESS_MASK);
+            phys::free_pages(old_phys / 4096ul, PAGE_COUNT);
+        }
+
+        entry = (entry & ~FLAG_COPY_ON_WRITE) | FLAG_WRITABLE;
+        asm volatile("invlpg (%0)" ::"r"(virt) : "memory");
+
+        return true;
+    }
+
+    static bool resolve_page(const Space space, const uint64_t virt) {
+        const auto [pml4, pdp, pd, pt, offset] = unpack(virt);
+
+        const auto pml4_table = get_ptr_from_phys<uint64_t>(space);
+
+        // PML4 Entry - PDP Table
+        if (!entry_is_present(pml4_table[pml4])) return false;
+        const auto pdp_table = get_ptr_from_phys<uint64_t>(pml4_table[pml4] & ADDRESS_MASK);
+
+        // PDP Entry - PD Table
+        if (!entry_is_present(pdp_table[pdp])) return false;
+        if (entry_is_direct(pdp_table[pdp])) // Direct entry - 1 gB page
+            return resolve_entry<DIRECT_PDP_ADDRESS_MASK, (1ULL << VIRT_ADDR_PDP_OFFSET) / 4096ULL>(pdp_table[pdp], virt);
+        const auto pd_table = get_ptr_from_phys<uint64_t>(pdp_table[pdp] & ADDRESS_MASK);
+
+        // PD Entry - PT Table
+        if (!entry_is_present(pd_table[pd])) return false;
+        if (entry_is_direct(pd_table[pd])) // Direct entry - 2 mB page
+            return resolve_entry<DIRECT_PD_ADDRESS_MASK, (1ULL << VIRT_ADDR_PD_OFFSET) / 4096ULL>(pd_table[pd], virt);
+        const auto pt_table = get_ptr_from_phys<uint64_t>(pd_table[pd] & ADDRESS_MASK);
+
+        // PT Table - Page
+        if (!entry_is_present(pt_table[pt])) return false;
+        return resolve_entry<ADDRESS_MASK, 1>(pt_table[pt], virt);
+    }
+
+    bool resolve_copy_on_write(const Space space, const uint64_t virt) {
+        if (!resolve_page(space, virt)) return false;
+
+        // Other threads of the space could still read the old page
+        shootdown(space);
+        return true;
+    }
+
     void clear(const Space space) {
         const auto pml4_table = get_ptr_from_phys<uint64_t>(space);
 
@@ -379,6 +553,8 @@ namespace cosmos::memory::virt {
             phys::free_pages((pml4_entry & ADDRESS_MASK) / 4096ul, 1);
             pml4_entry = 0;
         }
+
+        forget_pcid(space);
     }
 
     void destroy(const Space space) {
@@ -394,10 +570,12 @@ namespace cosmos::memory::virt {
         if (!(flags / Flags::Execute)) entry_flags |= FLAG_NO_EXECUTE;
         if (flags / Flags::Uncached) entry_flags |= FLAG_CACHE_DISABLE | FLAG_WRITE_THROUGH;
         if (flags / Flags::User) entry_flags |= FLAG_USER;
+        if (flags / Flags::Shared) entry_flags |= FLAG_SHARED;
+        if (flags / Flags::Global) entry_flags |= FLAG_GLOBAL;
 
         // Map
         const auto pml4_table = get_ptr_from_phys<uint64_t>(space);
-        const auto invalidate = get_current() == space;
+        const auto current = get_current() == space;
 
         while (count > 0) {
             const auto addr = unpack(virt * 4096);
@@ -408,7 +586,7 @@ namespace cosmos::memory::virt {
             // 1 gB
             if (gb_pages_supported && virt % (512 * 512) == 0 && phys % (512 * 512) == 0 && count >= (512 * 512)) {
                 pdp_table[addr.pdp] = ((phys * 4096) & DIRECT_PDP_ADDRESS_MASK) | FLAG_DIRECT | entry_flags;
-                if (invalidate) asm volatile("invlpg (%0)" ::"r"(virt * 4096ul) : "memory");
+                invalidate_page(space, current, virt * 4096ul);
 
                 virt += 512 * 512;
                 phys += 512 * 512;
@@ -423,7 +601,7 @@ namespace cosmos::memory::virt {
             // 2 mB
             if (virt % 512 == 0 && phys % 512 == 0 && count >= 512) {
                 pd_table[addr.pd] = ((phys * 4096) & DIRECT_PD_ADDRESS_MASK) | FLAG_DIRECT | entry_flags;
-                if (invalidate) asm volatile("invlpg (%0)" ::"r"(virt * 4096ul) : "memory");
+                invalidate_page(space, current, virt * 4096ul);
 
                 virt += 512;
                 phys += 512;
@@ -437,7 +615,7 @@ namespace cosmos::memory::virt {
             if (pt_table == nullptr) return false;
 
             pt_table[addr.pt] = ((phys * 4096) & ADDRESS_MASK) | entry_flags;
-            if (invalidate) asm volatile("invlpg (%0)" ::"r"(virt * 4096ul) : "memory");
+            invalidate_page(space, current, virt * 4096ul);
 
             virt++;
             phys++;
@@ -447,9 +625,176 @@ namespace cosmos::memory::virt {
         return true;
     }
 
-    void switch_to(Space space) {
-        asm volatile("mov %0, %%cr3" ::"ri"(space));
+    /// @return page table containing the entry of the page or nullptr, then skip is set to the number of pages until the next table
+    static uint64_t* get_page_table(const Space space, const uint64_t virt, uint64_t& skip) {
+        const auto addr = unpack(virt * 4096ul);
+        const auto pml4_table = get_ptr_from_phys<uint64_t>(space);
+
+        // PML4 Entry - PDP Table
+        if (!entry_is_present(pml4_table[addr.pml4])) {
+            skip = 512ul * 512ul * 512ul - virt % (512ul * 512ul * 512ul);
+            return nullptr;
+        }
+
+        const auto pdp_table = get_ptr_from_phys<uint64_t>(pml4_table[addr.pml4] & ADDRESS_MASK);
+
+        // PDP Entry - PD Table
+        if (!entry_is_present(pdp_table[addr.pdp]) || entry_is_direct(pdp_table[addr.pdp])) {
+            skip = 512ul * 512ul - virt % (512ul * 512ul);
+            return nullptr;
+        }
+
+        const auto pd_table = get_ptr_from_phys<uint64_t>(pdp_table[addr.pdp] & ADDRESS_MASK);
+
+        // PD Entry - PT Table
+        if (!entry_is_present(pd_table[addr.pd]) || entry_is_direct(pd_table[addr.pd])) {
+            skip = 512ul - virt % 512ul;
+            return nullptr;
+        }
+
+        return get_ptr_from_phys<uint64_t>(pd_table[addr.pd] & ADDRESS_MASK);
+    }
+
+    void unmap_pages(const Space space, uint64_t virt, uint64_t count) {
+        const auto current = get_current() == space;
+
+        while (count > 0) {
+            uint64_t skip;
+            const auto pt_table = get_page_table(space, virt, skip);
+
+            if (pt_table == nullptr) {
+                if (skip >= count) break;
+
+                virt += skip;
+                count -= skip;
+
+                continue;
+            }
+
+            auto& entry = pt_table[unpack(virt * 4096ul).pt];
+
+            if (entry_is_present(entry)) {
+                if (!entry_is_cache_disabled(entry)) phys::free_pages((entry & ADDRESS_MASK) / 4096ul, 1);
+
+                entry = 0;
+                invalidate_page(space, current, virt * 4096ul);
+            }
+
+            virt++;
+            count--;
+        }
+
+        shootdown(space);
+    }
+
+    void protect_pages(const Space space, uint64_t virt, uint64_t count, const Flags flags) {
+        const auto current = get_current() == space;
+
+        while (count > 0) {
+            uint64_t skip;
+            const auto pt_table = get_page_table(space, virt, skip);
+
+            if (pt_table == nullptr) {
+                if (skip >= count) break;
+
+                virt += skip;
+                count -= skip;
+
+                continue;
+            }
+
+            auto& entry = pt_table[unpack(virt * 4096ul).pt];
+
+            if (entry_is_present(entry)) {
+                entry &= ~(FLAG_WRITABLE | FLAG_USER | FLAG_NO_EXECUTE);
+
+                // Private pages still shared with another space after a fork are only made writable once they were copied
+                if ((flags / Flags::Write) && !entry_is_copy_on_write(entry)) {
+                    const auto page = (entry & ADDRESS_MASK) / 4096ul;
+                    const auto copy = !entry_is_shared(entry) && !entry_is_cache_disabled(entry) && phys::get_ref_count(page) > 1;
+
+                    entry |= copy ? FLAG_COPY_ON_WRITE : FLAG_WRITABLE;
+                }
+                if (!(flags / Flags::Execute)) entry |= FLAG_NO_EXECUTE;
+                if (flags / Flags::User) entry |= FLAG_USER;
+
+                invalidate_page(space, current, virt * 4096ul);
+            }
+
+            virt++;
+            count--;
+        }
+
+        shootdown(space);
+    }
+
+    uint64_t clear_dirty(const Space space, const uint64_t virt) {
+        uint64_t skip;
+        const auto pt_table = get_page_table(space, virt / 4096ul, skip);
+        if (pt_table == nullptr) return 0;
+
+        auto& entry = pt_table[unpack(virt).pt];
+        if (!entry_is_present(entry) || !entry_is_dirty(entry)) return 0;
+
+        // The TLB can cache the dirty flag, later writes would not set it again
+        entry &= ~FLAG_DIRTY;
+        invalidate_page(space, get_current() == space, virt);
+        shootdown(space);
+
+        return entry & ADDRESS_MASK;
+    }
+
+    void init_ap(const Space space) {
+        // The PCID needs to be 0 when enabling PCIDs
+        asm volatile("mov %0, %%cr3" ::"r"(space) : "memory");
+
+        enable_features();
+        switch_to(space);
+    }
+
+    void switch_to(const Space space) {
+        auto cr3 = space;
+
+        if (pcid_supported) {
+            const uint64_t cpu = smp::get_current()->index;
+
+            if (cpu_pcid_generations[cpu] != pcid_generation) {
+                flush_all();
+                cpu_pcid_generations[cpu] = pcid_generation;
+            }
+
+            auto& entry = get_ptr_from_phys<uint64_t>(space)[PCID_ENTRY];
+
+            if ((entry >> PCID_ENTRY_GENERATION_OFFSET) == pcid_generation) {
+                // Entries cached under the PCID are only still valid if the space did not run on another CPU in the meantime,
+                // changes made there were only invalidated in the TLB of that CPU
+                if (((entry >> PCID_ENTRY_CPU_OFFSET) & PCID_ENTRY_CPU_MASK) == cpu) cr3 |= CR3_NO_FLUSH;
+            } else {
+                if (next_pcid > MAX_PCID) {
+                    flush_all();
+
+                    pcid_generation++;
+                    next_pcid = 1;
+
+                    cpu_pcid_generations[cpu] = pcid_generation;
+                }
+
+                entry = (pcid_generation << PCID_ENTRY_GENERATION_OFFSET) | (next_pcid++ << 1);
+            }
+
+            entry = (entry & ~(PCID_ENTRY_CPU_MASK << PCID_ENTRY_CPU_OFFSET)) | (cpu << PCID_ENTRY_CPU_OFFSET);
+            cr3 |= (entry >> 1) & CR3_PCID_MASK;
+        }
+
+        asm volatile("mov %0, %%cr3" ::"r"(cr3) : "memory");
         switched_to_space = true;
+
+        cpu_spaces[smp::get_current()->index] = space;
+    }
+
+    void handle_shootdown() {
+        flush_current();
+        __atomic_store_n(&smp::get_current()->flush_tlb, false, __ATOMIC_RELEASE);
     }
 
     bool switched() {
@@ -555,4 +900,108 @@ namespace cosmos::memory::virt {
             range_fn(current_start, current_end);
         }
     }
+
+    // User memory
+
+    extern "C" const uint8_t copy_user_fault[], copy_user_resume[];
+    extern "C" const uint8_t load_user_fault[], load_user_resume[];
+    extern "C" const uint8_t store_user_fault[], store_user_resume[];
+
+    struct UserFixup {
+        const uint8_t* fault;
+        const uint8_t* resume;
+    };
+
+    /// Instructions accessing user memory and where to continue if they fault, RAX holds the result of the function at that point
+    static const UserFixup user_fixups[] = {
+        { copy_user_fault, copy_user_resume },
+        { load_user_fault, load_user_resume },
+        { store_user_fault, store_user_resume },
+    };
+
+    /// RCX holds the number of bytes left when rep movsb is interrupted by a fault
+    __attribute__((naked)) uint64_t copy_user(void* dst, const void* src, uint64_t size) {
+        asm volatile(R"(
+            mov %rdx, %rcx
+
+            .global copy_user_fault
+            copy_user_fault:
+            rep movsb
+
+            .global copy_user_resume
+            copy_user_resume:
+            mov %rdx, %rax
+            sub %rcx, %rax
+            ret
+        )");
+    }
+
+    static __attribute__((naked)) bool load_user_word(const uint32_t* addr, uint32_t* value) {
+        asm volatile(R"(
+            xor %eax, %eax
+
+            .global load_user_fault
+            load_user_fault:
+            mov (%rdi), %ecx
+
+            mov %ecx, (%rsi)
+            mov $1, %eax
+
+            .global load_user_resume
+            load_user_resume:
+            ret
+        )");
+    }
+
+    static __attribute__((naked)) bool store_user_word(uint32_t* addr, uint32_t value) {
+        asm volatile(R"(
+            xor %eax, %eax
+
+            .global store_user_fault
+            store_user_fault:
+            mov %esi, (%rdi)
+
+            mov $1, %eax
+
+            .global store_user_resume
+            store_user_resume:
+            ret
+        )");
+    }
+
+    bool is_user_range(const uint64_t addr, const uint64_t size) {
+        if (size == 0) return true;
+        return size <= LOWER_HALF_END && !is_invalid_user(addr) && !is_invalid_user(addr + size - 1);
+    }
+
+    bool copy_from_user(void* dst, const uint64_t src, const uint64_t size) {
+        if (!is_user_range(src, size)) return false;
+        return copy_user(dst, reinterpret_cast<const void*>(src), size) == size;
+    }
+
+    bool copy_to_user(const uint64_t dst, const void* src, const uint64_t size) {
+        if (!is_user_range(dst, size)) return false;
+        return copy_user(reinterpret_cast<void*>(dst), src, size) == size;
+    }
+
+    bool load_user(const uint64_t addr, uint32_t& value) {
+        if (addr % alignof(uint32_t) != 0 || !is_user_range(addr, sizeof(uint32_t))) return false;
+        return load_user_word(reinterpret_cast<const uint32_t*>(addr), &value);
+    }
+
+    bool store_user(const uint64_t addr, const uint32_t value) {
+        if (addr % alignof(uint32_t) != 0 || !is_user_range(addr, sizeof(uint32_t))) return false;
+        return store_user_word(reinterpret_cast<uint32_t*>(addr), value);
+    }
+
+    bool fixup_user_fault(uint64_t& rip) {
+        for (const auto& fixup : user_fixups) {
+            if (rip != reinterpret_cast<uint64_t>(fixup.fault)) continue;
+
+            rip = reinterpret_cast<uint64_t>(fixup.resume);
+            return true;
+        }
+
+        return false;
+    }
 } // namespace cosmos::memory::virt
@@ -26,6 +26,10 @@ namespace cosmos::memory::virt {
         Execute = 1 << 1,
         Uncached = 1 << 2,
         User = 1 << 3,
+        /// Stays shared between both spaces on fork instead of being copied on write
+        Shared = 1 << 4,
+        /// Stays in the TLB across address space switches, only for kernel mappings which are the same in every space
+        Global = 1 << 5,
     };
     ENUM_BIT_FIELD(Flags)
 
@@ -34,10 +38,14 @@ namespace cosmos::memory::virt {
     Space create();
     Space get_current();
 
-    /// Does a DEEP copy of the address space.
-    /// Meaning that it not only copies the paging tables but also the physical pages pointed to by the paging tables.
+    /// Copies the paging tables of the address space, the physical pages are shared between both spaces.
+    /// Writable pages are made read-only in both and only copied once one of them writes to it, see resolve_copy_on_write.
     Space fork(Space other);
 
+    /// Handles a write to a copy-on-write page by copying it, or by making it writable again if it is no longer shared.
+    /// @return false if the address is not mapped as a copy-on-write page or the copy could not be allocated
+    bool resolve_copy_on_write(Space space, uint64_t virt);
+
     /// NOTE: This function frees not only the memory used for the paging tables BUT ALSO the memory pointed to by the paging table entries,
     /// meaning it assumes full ownership of the underlying memory
     void clear(Space space);
@@ -48,11 +56,50 @@ namespace cosmos::memory::virt {
 
     bool map_pages(Space space, uint64_t virt, uint64_t phys, uint64_t count, Flags flags);
 
+    /// Unmaps and frees the present pages in the range, only 4 kB pages are supported which is how user memory is mapped
+    void unmap_pages(Space space, uint64_t virt, uint64_t count);
+
+    /// Changes the flags of the present pages in the range, copy-on-write pages stay read-only until they are written to
+    void protect_pages(Space space, uint64_t virt, uint64_t count, Flags flags);
+
+    /// @return physical address of the page if it was written to since the last call, 0 otherwise
+    uint64_t clear_dirty(Space space, uint64_t virt);
+
+    /// Enables the same paging features the bootstrap processor uses on an application processor and switches to the space
+    void init_ap(Space space);
+
+    /// Spaces are tagged with a PCID if supported so that switching between them doesn't flush the TLB
     void switch_to(Space space);
+
+    /// Flushes the TLB of the calling CPU after another one changed the mappings of the space it runs, see CpuStatus::flush_tlb
+    void handle_shootdown();
     bool switched();
 
     uint64_t get_phys(uint64_t virt);
 
+    // User memory
+
+    /// Checks that size bytes starting at addr lie in the lower half without addr + size wrapping, does not check that they are mapped
+    bool is_user_range(uint64_t addr, uint64_t size);
+
+    /// Copies between kernel and user memory. A fault on user memory which can't be resolved ends the copy early instead of killing
+    /// the process, so the kernel must only access memory of a process through these functions.
+    /// @return number of bytes copied
+    uint64_t copy_user(void* dst, const void* src, uint64_t size);
+
+    /// Same as copy_user, but the user side has to lie in the lower half
+    /// @return false unless all bytes were copied
+    bool copy_from_user(void* dst, uint64_t src, uint64_t size);
+    bool copy_to_user(uint64_t dst, const void* src, uint64_t size);
+
+    /// Single access to an aligned word which other threads might change concurrently, unlike copy_user it can't tear
+    bool load_user(uint64_t addr, uint32_t& value);
+    bool store_user(uint64_t addr, uint32_t value);
+
+    /// Called for page faults in the kernel on user memory which could not be resolved
+    /// @return false if the fault did not happen in one of the functions above, otherwise rip is moved to where they report the error
+    bool fixup_user_fault(uint64_t& rip);
+
     void dump(Space space, void (*range_fn)(uint64_t virt_start, uint64_t virt_end));
 
     inline void dump(void (*range_fn)(uint64_t virt_start, uint64_t virt_end)) {
@@ -0,0 +1,152 @@
+#include "smp.hpp"
+
+#include "gdt.hpp"
+#include "interrupts/isr.hpp"
+#include "interrupts/lapic.hpp"
+#include "limine.hpp"
+#include "log/log.hpp"
+#include "memory/virtual.hpp"
+#include "tss.hpp"
+#include "utils.hpp"
+
+namespace cosmos::smp {
+    constexpr uint32_t NO_OWNER = 0xFFFFFFFF;
+
+    static CpuStatus cpus[MAX_CPUS] = {};
+    static uint32_t cpu_count = 1;
+
+    static ApEntryFn ap_entry = nullptr;
+    static bool ap_started = false;
+
+    static uint32_t kernel_lock_owner = NO_OWNER;
+    static uint32_t kernel_lock_depths[MAX_CPUS] = {};
+
+    /// Needs to happen after loading the GDT, reloading the GS segment register clears GS_BASE
+    static void init_status(const uint32_t index) {
+        auto& cpu = cpus[index];
+        cpu.self = &cpu;
+        cpu.index = index;
+
+        utils::msr_write(utils::MSR_GS_BASE, reinterpret_cast<uint64_t>(&cpu));
+        utils::msr_write(utils::MSR_KERNEL_GS_BASE, 0);
+    }
+
+    static void ap_main(const uint64_t index) {
+        gdt::init(index);
+        tss::init(index);
+        isr::load();
+        init_status(index);
+        lapic::init_ap();
+
+        __atomic_store_n(&ap_started, true, __ATOMIC_RELEASE);
+
+        lock_kernel();
+        INFO("Started CPU %llu", index);
+
+        ap_entry();
+        utils::halt();
+    }
+
+    // Header
+
+    void init() {
+        gdt::init(0);
+        tss::init(0);
+        init_status(0);
+
+        cpus[0].lapic_id = limine::get_bsp_lapic_id();
+    }
+
+    void start_aps(const ApEntryFn entry) {
+        ap_entry = entry;
+
+        const auto bsp_lapic_id = limine::get_bsp_lapic_id();
+
+        for (auto i = 0u; i < limine::get_cpu_count(); i++) {
+            const auto lapic_id = limine::get_cpu_lapic_id(i);
+            if (lapic_id == bsp_lapic_id) continue;
+
+            if (cpu_count >= MAX_CPUS) {
+                WARN("Only %u CPUs are supported", MAX_CPUS);
+                break;
+            }
+
+            const auto index = cpu_count++;
+            cpus[index].lapic_id = lapic_id;
+
+            // One at a time so that their early setup, which runs without the kernel lock, does not interleave
+            __atomic_store_n(&ap_started, false, __ATOMIC_RELAXED);
+            limine::start_cpu(i, ap_main, index);
+
+            while (!__atomic_load_n(&ap_started, __ATOMIC_ACQUIRE)) {
+                asm volatile("pause" ::: "memory");
+            }
+        }
+
+        INFO("Running on %u CPUs", cpu_count);
+    }
+
+    uint32_t get_cpu_count() {
+        return cpu_count;
+    }
+
+    CpuStatus* get_cpu(const uint32_t index) {
+        return index < cpu_count ? &cpus[index] : nullptr;
+    }
+
+    // Kernel lock
+
+    void lock_kernel() {
+        const auto rflags = utils::disable_interrupts();
+
+        const auto cpu = get_current();
+        const auto index = cpu->index;
+
+        if (__atomic_load_n(&kernel_lock_owner, __ATOMIC_RELAXED) == index) {
+            kernel_lock_depths[index]++;
+        } else {
+            auto expected = NO_OWNER;
+
+            while (!__atomic_compare_exchange_n(&kernel_lock_owner, &expected, index, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                while (__atomic_load_n(&kernel_lock_owner, __ATOMIC_RELAXED) != NO_OWNER) {
+                    // The owner can be waiting for this CPU to flush its TLB while interrupts are disabled here
+                    if (__atomic_load_n(&cpu->flush_tlb, __ATOMIC_ACQUIRE)) memory::virt::handle_shootdown();
+
+                    asm volatile("pause" ::: "memory");
+                }
+
+                expected = NO_OWNER;
+            }
+
+            kernel_lock_depths[index] = 1;
+        }
+
+        utils::restore_interrupts(rflags);
+    }
+
+    void unlock_kernel() {
+        const auto rflags = utils::disable_interrupts();
+
+        const auto index = get_current()->index;
+
+        if (--kernel_lock_depths[index] == 0) {
+            __atomic_store_n(&kernel_lock_owner, NO_OWNER, __ATOMIC_RELEASE);
+        }
+
+        utils::restore_interrupts(rflags);
+    }
+
+    uint32_t get_kernel_lock_depth() {
+        const auto index = get_current()->index;
+        return __atomic_load_n(&kernel_lock_owner, __ATOMIC_RELAXED) == index ? kernel_lock_depths[index] : 0;
+    }
+
+    void set_kernel_lock_depth(const uint32_t depth) {
+        const auto index = get_current()->index;
+        kernel_lock_depths[index] = depth;
+
+        if (depth == 0) {
+            __atomic_store_n(&kernel_lock_owner, NO_OWNER, __ATOMIC_RELEASE);
+        }
+    }
+} // namespace cosmos::smp
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cosmos::task {
+    struct Process;
+} // namespace cosmos::task
+
+namespace cosmos::smp {
+    constexpr uint32_t MAX_CPUS = 32;
+
+    /// Per-CPU data, GS_BASE points to it while in kernel mode.
+    /// The syscall entry depends on the offsets of the first two fields.
+    struct CpuStatus {
+        uint64_t kernel_rsp;
+        uint64_t user_rsp;
+
+        CpuStatus* self;
+        uint32_t index;
+        uint32_t lapic_id;
+
+        task::Process* current_process;
+
+        /// Set by the timer once the time slice of the current process ran out
+        bool preempt;
+        /// Set while the CPU sleeps in its idle process, it needs to be sent an IPI when there is work to steal
+        bool idle;
+        /// Set by another CPU which changed the mappings of the space this one runs, cleared once the TLB was flushed
+        bool flush_tlb;
+    };
+
+    static_assert(offsetof(CpuStatus, self) == 16);
+    static_assert(offsetof(CpuStatus, current_process) == 32);
+
+    using ApEntryFn = void (*)();
+
+    /// Sets up the GDT, TSS and per-CPU data of the bootstrap CPU
+    void init();
+
+    /// Starts all application processors. Each one sets up its GDT, TSS, IDT and per-CPU data,
+    /// takes the kernel lock and then calls the entry which never returns.
+    void start_aps(ApEntryFn entry);
+
+    uint32_t get_cpu_count();
+    CpuStatus* get_cpu(uint32_t index);
+
+    inline CpuStatus* get_current() {
+        CpuStatus* cpu;
+        asm volatile("mov %%gs:16, %0" : "=r"(cpu));
+        return cpu;
+    }
+
+    // Kernel lock
+
+    /// Serializes everything running in kernel mode across CPUs, it is recursive on the same CPU.
+    /// The scheduler keeps it held across process switches so the next process continues with it.
+    void lock_kernel();
+    void unlock_kernel();
+
+    uint32_t get_kernel_lock_depth();
+    /// Only valid while the calling CPU holds the lock, a depth of 0 releases it
+    void set_kernel_lock_depth(uint32_t depth);
+} // namespace cosmos::smp
@@ -1,47 +1,199 @@
+#include "clock.hpp"
 #include "log/log.hpp"
 #include "memory/heap.hpp"
 #include "memory/offsets.hpp"
+#include "memory/physical.hpp"
+#include "smp.hpp"
+#include "stl/utils.hpp"
+#include "task/epoll.hpp"
 #include "task/event.hpp"
+#include "task/futex.hpp"
 #include "task/pipe.hpp"
+#include "task/region.hpp"
 #include "task/scheduler.hpp"
 #include "utils.hpp"
 #include "vfs/path.hpp"
 #include "vfs/vfs.hpp"
 
+#include <cstddef>
 #include <cstdint>
 
 namespace cosmos::syscalls {
+    constexpr uint64_t CLOCK_MONOTONIC = 0;
+
+    // Ring
+
+    /// Operations a ring submission can perform, the arguments are the same as for the syscall
+    enum class RingOp : uint8_t {
+        Read,
+        Write,
+        Seek,
+        Open,
+        Close,
+        Poll,
+        ReadAt,
+        WriteAt,
+    };
+
+    struct Submission {
+        RingOp op;
+        uint64_t args[4];
+        uint64_t user_data;
+    };
+
+    struct Completion {
+        uint64_t user_data;
+        int64_t result;
+    };
+
+    constexpr uint32_t MAX_RING_ENTRIES = 4096;
+
+    // Vectored I/O
+
+    struct IoVec {
+        uint64_t base;
+        uint64_t length;
+    };
+
+    constexpr uint64_t MAX_IO_VECS = 1024;
+
+    // Spawn
+
+    constexpr uint64_t MAX_SPAWN_ACTIONS = 64;
+
+    /// Lives in user memory and is followed by entry_count submissions and then entry_count completions. Indices only ever grow and
+    /// are masked with entry_count - 1, user-land owns the submission tail and the completion head, the kernel the other two.
+    struct Ring {
+        uint32_t submission_head;
+        uint32_t submission_tail;
+        uint32_t completion_head;
+        uint32_t completion_tail;
+        uint32_t entry_count;
+    };
+
+    // Strings
+
+    constexpr uint64_t MAX_STRING_SIZE = 4096;
+    constexpr uint64_t MAX_STRING_COUNT = 256;
+
     // Helpers
 
-    static stl::StringView get_string_view(const uint64_t arg) {
-        const auto ptr = reinterpret_cast<const char*>(arg);
-        size_t length = 0;
+    static void free_string(const stl::StringView str) {
+        memory::heap::free(const_cast<char*>(str.data()));
+    }
+
+    /// Measures the string in small chunks, which never cross into the next page since it might not be accessible
+    /// @return false if the string is not accessible or longer than MAX_STRING_SIZE
+    static bool get_string_length(const uint64_t arg, uint64_t& length) {
+        char chunk[64];
+        length = 0;
+
+        while (length < MAX_STRING_SIZE) {
+            const auto count = stl::min(stl::min(sizeof(chunk), 4096ul - (arg + length) % 4096ul), MAX_STRING_SIZE - length);
+            if (!memory::virt::copy_from_user(chunk, arg + length, count)) return false;
 
-        for (;;) {
-            if (memory::virt::is_invalid_user(arg + length)) return stl::StringView("", 0);
-            if (ptr[length] == '\0') break;
-            length++;
+            for (auto i = 0u; i < count; i++) {
+                if (chunk[i] == '\0') {
+                    length += i;
+                    return true;
+                }
+            }
+
+            length += count;
+        }
+
+        return false;
+    }
+
+    /// Copies the string out of user memory, other threads could change it while the kernel uses it. Free it with free_string.
+    /// @return view with no data if the string is not accessible or longer than MAX_STRING_SIZE
+    static stl::StringView get_string(const uint64_t arg) {
+        uint64_t length;
+        if (!get_string_length(arg, length)) return {};
+
+        const auto str = memory::heap::alloc_array<char>(length + 1);
+        if (str == nullptr) return {};
+
+        if (!memory::virt::copy_from_user(str, arg, length)) {
+            memory::heap::free(str);
+            return {};
+        }
+
+        // Other threads could have changed the string since it was measured
+        str[length] = '\0';
+        return stl::StringView(str, utils::strlen(str));
+    }
+
+    static void free_string_span(const stl::Span<const char*> strings) {
+        for (auto i = 0u; i < strings.size; i++) {
+            memory::heap::free(const_cast<char*>(strings[i]));
         }
 
-        return stl::StringView(ptr, length);
+        memory::heap::free(const_cast<const char**>(strings.data));
     }
 
+    /// Copies the null terminated array of strings and the strings out of user memory, 0 is the same as an empty array.
+    /// Free it with free_string_span.
+    /// @return span with no data if a string is not accessible or there are more than MAX_STRING_COUNT
     static stl::Span<const char*> get_string_span(const uint64_t arg) {
-        const auto ptr = reinterpret_cast<const char* const*>(arg);
-        size_t count = 0;
+        // Count the strings first, so the array is only as large as needed
+        uint64_t count = 0;
+
+        while (arg != 0) {
+            if (count == MAX_STRING_COUNT) return stl::Span<const char*>(nullptr, 0);
 
-        for (;;) {
-            if (memory::virt::is_invalid_user(arg + count * sizeof(const char*))) return stl::Span<const char*>(nullptr, 0);
-            if (ptr[count] == nullptr) break;
-            if (get_string_view(reinterpret_cast<uint64_t>(ptr[count])).empty()) return stl::Span<const char*>(nullptr, 0);
+            uint64_t ptr;
+            if (!memory::virt::copy_from_user(&ptr, arg + count * sizeof(uint64_t), sizeof(uint64_t))) {
+                return stl::Span<const char*>(nullptr, 0);
+            }
+
+            if (ptr == 0) break;
             count++;
         }
 
-        return stl::Span(ptr, count);
+        const auto strings = memory::heap::alloc_array<const char*>(count);
+        if (strings == nullptr) return stl::Span<const char*>(nullptr, 0);
+
+        auto span = stl::Span<const char*>(strings, 0);
+
+        while (span.size < count) {
+            // Other threads could have changed the array since it was counted
+            uint64_t ptr;
+            if (!memory::virt::copy_from_user(&ptr, arg + span.size * sizeof(uint64_t), sizeof(uint64_t)) || ptr == 0) break;
+
+            const auto str = get_string(ptr);
+            if (str.data() == nullptr) break;
+
+            strings[span.size++] = str.data();
+        }
+
+        if (span.size == count) return span;
+
+        free_string_span(span);
+        return stl::Span<const char*>(nullptr, 0);
     }
 
-    static void free_string(const stl::StringView str) {
-        memory::heap::free(const_cast<char*>(str.data()));
+    static bool get_user_range(const uint64_t addr, const uint64_t length, uint64_t& start, uint64_t& end) {
+        if (addr % 4096 != 0 || length == 0) return false;
+
+        start = addr;
+        end = stl::align_up(addr + length, 4096ul);
+
+        // The clock page is not backed by a region and stays mapped for the lifetime of the space
+        if (start <= memory::virt::CLOCK_PAGE && end > memory::virt::CLOCK_PAGE) return false;
+
+        return end > start && !memory::virt::is_invalid_user(end - 1);
+    }
+
+    static memory::virt::Flags get_region_flags(const task::Protection protection) {
+        // Readable pages can't be made inaccessible to user-land, so only Protection::None removes the User flag
+        if (protection == task::Protection::None) return memory::virt::Flags::None;
+
+        auto flags = memory::virt::Flags::User;
+        if (protection / task::Protection::Write) flags |= memory::virt::Flags::Write;
+        if (protection / task::Protection::Execute) flags |= memory::virt::Flags::Execute;
+
+        return flags;
     }
 
     // Syscall handlers
@@ -56,28 +208,36 @@ namespace cosmos::syscalls {
         return 0;
     }
 
+    uint64_t get_pid() {
+        return task::get_current_process()->id;
+    }
+
     int64_t stat(const uint64_t path_, const uint64_t stat_) {
-        if (memory::virt::is_invalid_user(stat_)) return -1;
-        if (memory::virt::is_invalid_user(stat_ + sizeof(vfs::Stat))) return -1;
+        const auto path = get_string(path_);
+        if (path.data() == nullptr) return -1;
 
-        const auto path = get_string_view(path_);
-        const auto stat = reinterpret_cast<vfs::Stat*>(stat_);
         const auto process = task::get_current_process();
 
-        const auto abs_path = vfs::resolve(process->cwd, path);
-        const auto result = vfs::stat(abs_path, *stat);
+        const auto abs_path = vfs::resolve(process->leader->cwd, path);
+        free_string(path);
+
+        vfs::Stat stat = {};
+        const auto result = vfs::stat(abs_path, stat) && memory::virt::copy_to_user(stat_, &stat, sizeof(vfs::Stat));
 
         free_string(abs_path);
         return result ? 0 : -1;
     }
 
     int64_t open(const uint64_t path_, const uint64_t mode_, const uint64_t flags_) {
-        const auto path = get_string_view(path_);
+        const auto path = get_string(path_);
+        if (path.data() == nullptr) return -1;
+
         const auto mode = static_cast<vfs::Mode>(mode_);
         const auto flags = static_cast<vfs::FileFlags>(flags_);
         const auto process = task::get_current_process();
 
-        const auto abs_path = vfs::resolve(process->cwd, path);
+        const auto abs_path = vfs::resolve(process->leader->cwd, path);
+        free_string(path);
 
         const auto file = vfs::open(abs_path, mode, flags);
         if (!file.valid()) {
@@ -153,6 +313,219 @@ namespace cosmos::syscalls {
         return file->ops->write(file, buffer, length);
     }
 
+    int64_t read_at(const uint64_t fd, const uint64_t buffer_, const uint64_t length, const uint64_t offset) {
+        if (!memory::virt::is_user_range(buffer_, length)) return -1;
+
+        const auto buffer = reinterpret_cast<void*>(buffer_);
+
+        const auto file = task::get_current_process()->get_file(fd);
+        if (!file.valid() || !vfs::is_read(file->mode)) return -1;
+
+        return vfs::read_at(file, buffer, length, offset);
+    }
+
+    int64_t write_at(const uint64_t fd, const uint64_t buffer_, const uint64_t length, const uint64_t offset) {
+        if (!memory::virt::is_user_range(buffer_, length)) return -1;
+
+        const auto buffer = reinterpret_cast<const void*>(buffer_);
+
+        const auto file = task::get_current_process()->get_file(fd);
+        if (!file.valid() || !vfs::is_write(file->mode)) return -1;
+
+        return vfs::write_at(file, buffer, length, offset);
+    }
+
+    /// Copies the vector out of user memory before validating it, other threads could change it between the check and the use
+    static bool get_io_vec(const IoVec* vecs, const uint64_t index, IoVec& vec) {
+        if (!memory::virt::copy_from_user(&vec, reinterpret_cast<uint64_t>(&vecs[index]), sizeof(IoVec))) return false;
+        return memory::virt::is_user_range(vec.base, vec.length);
+    }
+
+    /// Checks all vectors up front so that invalid ones fail the call before any transfer, they are copied again when used
+    static const IoVec* get_io_vecs(const uint64_t vecs_, const uint64_t count) {
+        if (count > MAX_IO_VECS) return nullptr;
+        if (memory::virt::is_invalid_user(vecs_)) return nullptr;
+        if (memory::virt::is_invalid_user(vecs_ + count * sizeof(IoVec) - 1)) return nullptr;
+
+        const auto vecs = reinterpret_cast<const IoVec*>(vecs_);
+
+        for (auto i = 0u; i < count; i++) {
+            IoVec vec;
+            if (!get_io_vec(vecs, i, vec)) return nullptr;
+        }
+
+        return vecs;
+    }
+
+    /// Stops at the first short transfer, like a single read or write would
+    int64_t read_vec(const uint64_t fd, const uint64_t vecs_, const uint64_t count) {
+        const auto vecs = get_io_vecs(vecs_, count);
+        if (vecs == nullptr) return -1;
+
+        const auto file = task::get_current_process()->get_file(fd);
+        if (!file.valid() || !vfs::is_read(file->mode)) return -1;
+
+        int64_t total = 0;
+
+        for (auto i = 0u; i < count; i++) {
+            IoVec vec;
+            if (!get_io_vec(vecs, i, vec)) return total > 0 ? total : -1;
+
+            if (vec.length == 0) continue;
+
+            const auto read = file->ops->read(file, reinterpret_cast<void*>(vec.base), vec.length);
+            total += static_cast<int64_t>(read);
+
+            if (read != vec.length) break;
+        }
+
+        return total;
+    }
+
+    int64_t write_vec(const uint64_t fd, const uint64_t vecs_, const uint64_t count) {
+        const auto vecs = get_io_vecs(vecs_, count);
+        if (vecs == nullptr) return -1;
+
+        const auto file = task::get_current_process()->get_file(fd);
+        if (!file.valid() || !vfs::is_write(file->mode)) return -1;
+
+        int64_t total = 0;
+
+        for (auto i = 0u; i < count; i++) {
+            IoVec vec;
+            if (!get_io_vec(vecs, i, vec)) return total > 0 ? total : -1;
+
+            if (vec.length == 0) continue;
+
+            const auto written = file->ops->write(file, reinterpret_cast<const void*>(vec.base), vec.length);
+            total += static_cast<int64_t>(written);
+
+            if (written != vec.length) break;
+        }
+
+        return total;
+    }
+
+    /// Copies an optional file offset out of user memory into value, 0 means the cursor of the file is used and offset is set to nullptr
+    static bool get_user_offset(const uint64_t offset_, uint64_t& value, uint64_t*& offset) {
+        offset = nullptr;
+        if (offset_ == 0) return true;
+
+        if (offset_ % alignof(uint64_t) != 0 || !memory::virt::copy_from_user(&value, offset_, sizeof(uint64_t))) return false;
+
+        offset = &value;
+        return true;
+    }
+
+    /// Writes the advanced offset back to user memory
+    static bool put_user_offset(const uint64_t offset_, const uint64_t* offset) {
+        return offset == nullptr || memory::virt::copy_to_user(offset_, offset, sizeof(uint64_t));
+    }
+
+    /// Moves data between two files through a kernel page when neither side lets the other use its buffer directly. What the output
+    /// does not take is given back by seeking, so the input has to be seekable.
+    /// @return -1 if the input is not seekable
+    static int64_t transfer(const stl::Rc<vfs::File>& in, uint64_t* in_offset, const stl::Rc<vfs::File>& out, uint64_t* out_offset,
+                            uint64_t length) {
+        if (!vfs::is_seekable(in)) return -1;
+
+        const auto phys = memory::phys::alloc_pages(1);
+        if (phys == 0) return 0;
+
+        const auto buffer = reinterpret_cast<uint8_t*>(memory::virt::DIRECT_MAP + phys);
+        uint64_t total = 0;
+
+        while (length > 0) {
+            const auto count = stl::min(length, 4096ul);
+
+            const auto read = in_offset != nullptr ? vfs::read_at(in, buffer, count, *in_offset) : in->ops->read(in, buffer, count);
+            if (read == 0) break;
+
+            const auto written = out_offset != nullptr ? vfs::write_at(out, buffer, read, *out_offset) : out->ops->write(out, buffer, read);
+
+            if (in_offset != nullptr) *in_offset += written;
+            if (out_offset != nullptr) *out_offset += written;
+
+            total += written;
+            length -= written;
+
+            if (written != read) {
+                // Give back what the output did not take, so a later read picks it up again
+                if (in_offset == nullptr) in->ops->seek(in, vfs::SeekType::Current, -static_cast<int64_t>(read - written));
+                break;
+            }
+        }
+
+        memory::phys::free_pages(phys / 4096ul, 1);
+        return static_cast<int64_t>(total);
+    }
+
+    /// Copies from in_fd to out_fd without going through user memory. If offset_ is not 0 it points to the offset in in_fd to read
+    /// from, which is advanced instead of the cursor.
+    int64_t sendfile(const uint64_t out_fd, const uint64_t in_fd, const uint64_t offset_, const uint64_t length) {
+        uint64_t offset_value;
+        uint64_t* offset;
+        if (!get_user_offset(offset_, offset_value, offset)) return -1;
+
+        const auto process = task::get_current_process();
+
+        const auto in = process->get_file(in_fd);
+        if (!in.valid() || !vfs::is_read(in->mode)) return -1;
+
+        const auto out = process->get_file(out_fd);
+        if (!out.valid() || !vfs::is_write(out->mode)) return -1;
+
+        const auto in_pipe = task::is_pipe(in);
+        const auto out_pipe = task::is_pipe(out);
+
+        if (in_pipe && offset != nullptr) return -1;
+
+        int64_t result;
+
+        // Pipe to pipe goes through splice_to_pipe as well, it only takes from the input what fits in the output
+        if (in_pipe && !out_pipe) result = static_cast<int64_t>(task::splice_from_pipe(in, out, nullptr, length));
+        else if (out_pipe) result = static_cast<int64_t>(task::splice_to_pipe(out, in, offset, length));
+        else result = transfer(in, offset, out, nullptr, length);
+
+        if (!put_user_offset(offset_, offset)) return -1;
+        return result;
+    }
+
+    /// Like sendfile but one of the files has to be a pipe, the offset of the other one can be given
+    int64_t splice(const uint64_t in_fd, const uint64_t in_offset_, const uint64_t out_fd, const uint64_t out_offset_, const uint64_t length) {
+        uint64_t in_offset_value;
+        uint64_t out_offset_value;
+        uint64_t* in_offset;
+        uint64_t* out_offset;
+
+        if (!get_user_offset(in_offset_, in_offset_value, in_offset) || !get_user_offset(out_offset_, out_offset_value, out_offset)) {
+            return -1;
+        }
+
+        const auto process = task::get_current_process();
+
+        const auto in = process->get_file(in_fd);
+        if (!in.valid() || !vfs::is_read(in->mode)) return -1;
+
+        const auto out = process->get_file(out_fd);
+        if (!out.valid() || !vfs::is_write(out->mode)) return -1;
+
+        const auto in_pipe = task::is_pipe(in);
+        const auto out_pipe = task::is_pipe(out);
+
+        if (!in_pipe && !out_pipe) return -1;
+        if ((in_pipe && in_offset != nullptr) || (out_pipe && out_offset != nullptr)) return -1;
+
+        // Between two pipes the data can't stay in a segment of the input, since writing to the output can block. Reading into the
+        // output instead only takes what fits, nothing has to be given back to the input.
+        if (in_pipe && out_pipe) return static_cast<int64_t>(task::splice_to_pipe(out, in, nullptr, length));
+
+        const auto result = in_pipe ? task::splice_from_pipe(in, out, out_offset, length) : task::splice_to_pipe(out, in, in_offset, length);
+
+        if (!put_user_offset(in_offset_, in_offset) || !put_user_offset(out_offset_, out_offset)) return -1;
+        return static_cast<int64_t>(result);
+    }
+
     int64_t ioctl(const uint64_t fd, const uint64_t op, const uint64_t arg) {
         const auto file = task::get_current_process()->get_file(fd);
         if (!file.valid()) return -1;
@@ -161,10 +534,13 @@ namespace cosmos::syscalls {
     }
 
     int64_t create_dir(const uint64_t path_) {
-        const auto path = get_string_view(path_);
+        const auto path = get_string(path_);
+        if (path.data() == nullptr) return -1;
+
         const auto process = task::get_current_process();
 
-        const auto abs_path = vfs::resolve(process->cwd, path);
+        const auto abs_path = vfs::resolve(process->leader->cwd, path);
+        free_string(path);
 
         const auto result = vfs::create_dir(abs_path);
 
@@ -173,10 +549,13 @@ namespace cosmos::syscalls {
     }
 
     int64_t remove(const uint64_t path_) {
-        const auto path = get_string_view(path_);
+        const auto path = get_string(path_);
+        if (path.data() == nullptr) return -1;
+
         const auto process = task::get_current_process();
 
-        const auto abs_path = vfs::resolve(process->cwd, path);
+        const auto abs_path = vfs::resolve(process->leader->cwd, path);
+        free_string(path);
 
         const auto result = vfs::remove(abs_path);
 
@@ -185,17 +564,30 @@ namespace cosmos::syscalls {
     }
 
     int64_t mount(const uint64_t target_path_, const uint64_t filesystem_name_, const uint64_t device_path_) {
-        const auto target_path = get_string_view(target_path_);
-        const auto filesystem_name = get_string_view(filesystem_name_);
-        const auto device_path = get_string_view(device_path_);
+        const auto target_path = get_string(target_path_);
+        const auto filesystem_name = get_string(filesystem_name_);
+        const auto device_path = get_string(device_path_);
+
+        if (target_path.data() == nullptr || filesystem_name.data() == nullptr || device_path.data() == nullptr) {
+            free_string(target_path);
+            free_string(filesystem_name);
+            free_string(device_path);
+            return -1;
+        }
 
         const auto process = task::get_current_process();
-        const auto cwd = process->cwd;
+        const auto cwd = process->leader->cwd;
 
         const auto abs_target_path = vfs::resolve(cwd, target_path);
         const auto abs_device_path = vfs::resolve(cwd, device_path);
 
-        return vfs::mount(abs_target_path, filesystem_name, abs_device_path) != nullptr ? 0 : -1;
+        const auto result = vfs::mount(abs_target_path, filesystem_name, abs_device_path) != nullptr;
+
+        free_string(target_path);
+        free_string(filesystem_name);
+        free_string(device_path);
+
+        return result ? 0 : -1;
     }
 
     int64_t eventfd(const uint64_t flags_) {
@@ -211,16 +603,12 @@ namespace cosmos::syscalls {
     }
 
     int64_t poll(const uint64_t fds_, const uint64_t count, const uint64_t reset_signalled_, const uint64_t mask_) {
-        if (memory::virt::is_invalid_user(fds_)) return -1;
-        if (memory::virt::is_invalid_user(fds_ + count * sizeof(uint32_t))) return -1;
-        if (memory::virt::is_invalid_user(mask_)) return -1;
-        if (memory::virt::is_invalid_user(mask_ + sizeof(uint64_t))) return -1;
-
         if (count > 64) return -1;
 
-        const auto fds = reinterpret_cast<uint32_t*>(fds_);
+        uint32_t fds[64];
+        if (!memory::virt::copy_from_user(fds, fds_, count * sizeof(uint32_t))) return -1;
+
         const auto reset_signalled = reset_signalled_ != 0;
-        const auto mask = reinterpret_cast<uint64_t*>(mask_);
         const auto process = task::get_current_process();
 
         stl::Rc<vfs::File> event_files[64];
@@ -229,16 +617,14 @@ namespace cosmos::syscalls {
             event_files[i] = process->get_file(fds[i]);
         }
 
-        *mask = task::wait_on_events(event_files, count, reset_signalled);
-        return 0;
+        uint64_t mask;
+        if (!task::wait_on_events(event_files, count, reset_signalled, mask)) return -1;
+
+        return memory::virt::copy_to_user(mask_, &mask, sizeof(uint64_t)) ? 0 : -1;
     }
 
     int64_t pipe(const uint64_t flags_, const uint64_t fds_) {
-        if (memory::virt::is_invalid_user(fds_)) return -1;
-        if (memory::virt::is_invalid_user(fds_ + 2 * sizeof(uint32_t))) return -1;
-
         const auto flags = static_cast<vfs::FileFlags>(flags_);
-        const auto fds = reinterpret_cast<uint32_t*>(fds_);
 
         // Create pipe files
         stl::Rc<vfs::File> read_file;
@@ -259,8 +645,13 @@ namespace cosmos::syscalls {
         }
 
         // Return
-        fds[0] = read_fd.value();
-        fds[1] = write_fd.value();
+        const uint32_t fds[] = { read_fd.value(), write_fd.value() };
+
+        if (!memory::virt::copy_to_user(fds_, fds, sizeof(fds))) {
+            process->remove_fd(read_fd.value());
+            process->remove_fd(write_fd.value());
+            return -1;
+        }
 
         return 0;
     }
@@ -279,14 +670,28 @@ namespace cosmos::syscalls {
     }
 
     int64_t execute(task::StackFrame& frame) {
-        const auto path = get_string_view(frame.rdi);
+        const auto path = get_string(frame.rdi);
         const auto args = get_string_span(frame.rsi);
         const auto env = get_string_span(frame.rdx);
+
+        if (path.data() == nullptr || args.data == nullptr || env.data == nullptr) {
+            free_string(path);
+            free_string_span(args);
+            free_string_span(env);
+            return -1;
+        }
+
         const auto process = task::get_current_process();
 
-        const auto abs_path = vfs::resolve(process->cwd, path);
+        const auto abs_path = vfs::resolve(process->leader->cwd, path);
 
+        // The old space is gone once the process executes, but the arguments were already copied out of it
         const auto entry_point = process->execute(abs_path, args, env);
+
+        free_string(path);
+        free_string_span(args);
+        free_string_span(env);
+
         if (entry_point.is_empty()) return -1;
 
         frame.rip = entry_point.value().rip;
@@ -295,32 +700,72 @@ namespace cosmos::syscalls {
         return 0;
     }
 
-    int64_t get_cwd(const uint64_t buffer_, const uint64_t length) {
-        if (memory::virt::is_invalid_user(buffer_)) return -1;
-        if (memory::virt::is_invalid_user(buffer_ + length - 1)) return -1;
+    int64_t spawn(const uint64_t path_, const uint64_t args_, const uint64_t env_, const uint64_t actions_, const uint64_t action_count) {
+        if (action_count > MAX_SPAWN_ACTIONS) return -1;
+
+        const auto actions = memory::heap::alloc_array<task::SpawnAction>(MAX_SPAWN_ACTIONS);
+        if (actions == nullptr) return -1;
+
+        if (!memory::virt::copy_from_user(actions, actions_, action_count * sizeof(task::SpawnAction))) {
+            memory::heap::free(actions);
+            return -1;
+        }
+
+        const auto path = get_string(path_);
+        const auto args = get_string_span(args_);
+        const auto env = get_string_span(env_);
+
+        if (path.data() == nullptr || args.data == nullptr || env.data == nullptr) {
+            free_string(path);
+            free_string_span(args);
+            free_string_span(env);
+            memory::heap::free(actions);
+            return -1;
+        }
+
+        const auto process = task::get_current_process();
+
+        const auto abs_path = vfs::resolve(process->leader->cwd, path);
+
+        const auto child_pid = process->spawn(abs_path, args, env, stl::Span(actions, action_count));
+        free_string(abs_path);
+
+        free_string(path);
+        free_string_span(args);
+        free_string_span(env);
+        memory::heap::free(actions);
+
+        if (child_pid.is_empty()) return -1;
 
-        const auto buffer = reinterpret_cast<char*>(buffer_);
+        task::enqueue(child_pid.value());
+        return child_pid.value();
+    }
+
+    int64_t get_cwd(const uint64_t buffer_, const uint64_t length) {
         const auto process = task::get_current_process();
 
-        const auto cwd = process->cwd;
+        const auto cwd = process->leader->cwd;
         if (length < cwd.size() + 1) return -1;
 
-        utils::memcpy(buffer, cwd.data(), cwd.size());
-        buffer[cwd.size()] = '\0';
+        if (!memory::virt::copy_to_user(buffer_, cwd.data(), cwd.size())) return -1;
+        if (!memory::virt::copy_to_user(buffer_ + cwd.size(), "", 1)) return -1;
 
         return cwd.size();
     }
 
     int64_t set_cwd(const uint64_t path_) {
-        const auto path = get_string_view(path_);
+        const auto path = get_string(path_);
+        if (path.data() == nullptr) return -1;
+
         const auto process = task::get_current_process();
 
-        const auto abs_path = vfs::resolve(process->cwd, path);
+        const auto abs_path = vfs::resolve(process->leader->cwd, path);
+        free_string(path);
 
         vfs::Stat stat;
         if (!vfs::stat(abs_path, stat) || stat.type != vfs::NodeType::Directory) return -1;
 
-        return process->set_cwd(abs_path) ? 0 : -1;
+        return process->leader->set_cwd(abs_path) ? 0 : -1;
     }
 
     uint64_t join(const uint64_t pid_) {
@@ -330,6 +775,284 @@ namespace cosmos::syscalls {
         return task::join(pid).value_or(0xFFFFFFFFFFFFFFFF);
     }
 
+    int64_t thread_create(const uint64_t entry, const uint64_t stack, const uint64_t arg, const uint64_t fs_base) {
+        if (memory::virt::is_invalid_user(entry) || memory::virt::is_invalid_user(stack - 1)) return -1;
+
+        const auto process = task::get_current_process();
+        OPT_VAR_CHECK(thread_id, process->create_thread(entry, stack, arg, fs_base), -1);
+
+        task::enqueue(thread_id);
+        return thread_id;
+    }
+
+    int64_t thread_exit(const uint64_t status) {
+        task::exit(status);
+        return 0;
+    }
+
+    /// Only threads of the same leader can be joined, the leader itself is joined with join once all of them exited
+    uint64_t thread_join(const uint64_t thread_id) {
+        if (thread_id > 0xFFFFFFFF) return 0xFFFFFFFFFFFFFFFF;
+
+        const auto thread = task::get_process(static_cast<task::ProcessId>(thread_id));
+        if (!thread.valid() || thread->leader == *thread) return 0xFFFFFFFFFFFFFFFF;
+        if (thread->leader != task::get_current_process()->leader) return 0xFFFFFFFFFFFFFFFF;
+
+        return task::join(thread->id).value_or(0xFFFFFFFFFFFFFFFF);
+    }
+
+    int64_t set_fs_base(const uint64_t base) {
+        // Non-canonical addresses fault when loaded into FS_BASE
+        if (memory::virt::is_invalid_user(base) && base != 0) return -1;
+
+        task::get_current_process()->fs_base = base;
+        utils::msr_write(utils::MSR_FS_BASE, base);
+
+        return 0;
+    }
+
+    /// Children and threads inherit the nice value of the process creating them
+    int64_t set_nice(const uint64_t nice) {
+        const auto value = static_cast<int64_t>(nice);
+        if (value < task::MIN_NICE || value > task::MAX_NICE) return -1;
+
+        return task::set_nice(task::get_current_process()->id, static_cast<int32_t>(value)) ? 0 : -1;
+    }
+
+    int64_t mmap(const uint64_t addr_, const uint64_t length_, const uint64_t protection_, const uint64_t flags_, const uint64_t fd,
+                 const uint64_t offset) {
+        const auto protection = static_cast<task::Protection>(protection_);
+        const auto flags = static_cast<task::MapFlags>(flags_);
+        const auto shared = flags / task::MapFlags::Shared;
+        const auto anonymous = flags / task::MapFlags::Anonymous;
+
+        if (length_ == 0 || length_ > memory::virt::LOWER_HALF_END || offset % 4096 != 0) return -1;
+        if (shared == (flags / task::MapFlags::Private)) return -1;
+
+        const auto length = stl::align_up(length_, 4096ul);
+        const auto process = task::get_current_process();
+
+        // Get file
+        stl::Rc<vfs::File> file;
+
+        if (!anonymous) {
+            file = process->get_file(fd);
+            if (!file.valid() || !vfs::is_read(file->mode)) return -1;
+
+            // Pages are filled from the page fault handler, where reading a pipe or device would consume its data or block
+            if (file->node == nullptr || file->node->type != vfs::NodeType::File || !vfs::is_seekable(file)) return -1;
+
+            if (shared && (protection / task::Protection::Write) && !vfs::is_write(file->mode)) return -1;
+        }
+
+        // Get address
+        uint64_t start;
+        uint64_t end;
+
+        if (flags / task::MapFlags::Fixed) {
+            if (addr_ == 0 || !get_user_range(addr_, length, start, end)) return -1;
+            if (!task::unmap_regions(process->space, process->leader->regions, start, end)) return -1;
+        } else {
+            start = task::find_free_range(process->leader->regions, length);
+            if (start == 0) return -1;
+
+            end = start + length;
+        }
+
+        // Add region
+        auto region_flags = get_region_flags(protection);
+        if (shared) region_flags |= memory::virt::Flags::Shared;
+
+        const auto region = task::Region{
+            .start = start,
+            .end = end,
+            .flags = region_flags,
+            .type = anonymous ? task::RegionType::Anonymous : task::RegionType::File,
+            .file = file.ref(),
+            .file_offset = offset,
+            .data_start = start,
+            .data_size = length,
+        };
+
+        if (!task::add_region(process->leader->regions, region)) {
+            file.deref();
+            return -1;
+        }
+
+        return static_cast<int64_t>(start);
+    }
+
+    int64_t munmap(const uint64_t addr, const uint64_t length) {
+        uint64_t start;
+        uint64_t end;
+        if (!get_user_range(addr, length, start, end)) return -1;
+
+        const auto process = task::get_current_process();
+        return task::unmap_regions(process->space, process->leader->regions, start, end) ? 0 : -1;
+    }
+
+    int64_t mprotect(const uint64_t addr, const uint64_t length, const uint64_t protection_) {
+        uint64_t start;
+        uint64_t end;
+        if (!get_user_range(addr, length, start, end)) return -1;
+
+        const auto protection = static_cast<task::Protection>(protection_);
+        const auto process = task::get_current_process();
+
+        return task::protect_regions(process->space, process->leader->regions, start, end, get_region_flags(protection)) ? 0 : -1;
+    }
+
+    int64_t sleep(const uint64_t ms) {
+        task::sleep(ms);
+        return 0;
+    }
+
+    int64_t clock_gettime(const uint64_t clock) {
+        if (clock != CLOCK_MONOTONIC) return -1;
+        return static_cast<int64_t>(clock::get_ns());
+    }
+
+    static int64_t dispatch(const Submission& submission) {
+        const auto [arg0, arg1, arg2, arg3] = submission.args;
+
+        switch (submission.op) {
+        case RingOp::Read:
+            return read(arg0, arg1, arg2);
+        case RingOp::Write:
+            return write(arg0, arg1, arg2);
+        case RingOp::Seek:
+            return seek(arg0, arg1, arg2);
+        case RingOp::Open:
+            return open(arg0, arg1, arg2);
+        case RingOp::Close:
+            return close(arg0);
+        case RingOp::Poll:
+            return poll(arg0, arg1, arg2, arg3);
+        case RingOp::ReadAt:
+            return read_at(arg0, arg1, arg2, arg3);
+        case RingOp::WriteAt:
+            return write_at(arg0, arg1, arg2, arg3);
+        default:
+            return -1;
+        }
+    }
+
+    /// The indices are shared with user-land and accessed with single loads and stores, which are ordered like acquires and releases
+    int64_t enter(const uint64_t ring_) {
+        if (ring_ % alignof(Submission) != 0) return -1;
+
+#define RING_FIELD(field) (ring_ + offsetof(Ring, field))
+
+        uint32_t entry_count;
+        if (!memory::virt::load_user(RING_FIELD(entry_count), entry_count)) return -1;
+        if (entry_count == 0 || entry_count > MAX_RING_ENTRIES || (entry_count & (entry_count - 1)) != 0) return -1;
+
+        const auto submissions = stl::align_up(ring_ + sizeof(Ring), alignof(Submission));
+        const auto completions = submissions + entry_count * sizeof(Submission);
+        const auto mask = entry_count - 1;
+
+        uint32_t head;
+        uint32_t completion_tail;
+        uint32_t tail;
+
+        if (!memory::virt::load_user(RING_FIELD(submission_head), head)) return -1;
+        if (!memory::virt::load_user(RING_FIELD(completion_tail), completion_tail)) return -1;
+        if (!memory::virt::load_user(RING_FIELD(submission_tail), tail)) return -1;
+
+        if (tail - head > entry_count) return -1;
+
+        int64_t count = 0;
+
+        while (head != tail) {
+            // Stop once user-land has no room left for the result
+            uint32_t completion_head;
+            if (!memory::virt::load_user(RING_FIELD(completion_head), completion_head)) return count > 0 ? count : -1;
+            if (completion_tail - completion_head >= entry_count) break;
+
+            // User-land could change the entry while it is being processed
+            Submission submission;
+            if (!memory::virt::copy_from_user(&submission, submissions + (head & mask) * sizeof(Submission), sizeof(Submission))) {
+                return count > 0 ? count : -1;
+            }
+
+            const auto completion = Completion{
+                .user_data = submission.user_data,
+                .result = dispatch(submission),
+            };
+
+            if (!memory::virt::copy_to_user(completions + (completion_tail & mask) * sizeof(Completion), &completion, sizeof(Completion))) {
+                return count > 0 ? count : -1;
+            }
+
+            head++;
+            completion_tail++;
+            count++;
+
+            if (!memory::virt::store_user(RING_FIELD(submission_head), head)) return count;
+            if (!memory::virt::store_user(RING_FIELD(completion_tail), completion_tail)) return count;
+        }
+
+#undef RING_FIELD
+
+        return count;
+    }
+
+    int64_t epoll_create(const uint64_t flags_) {
+        const auto flags = static_cast<vfs::FileFlags>(flags_);
+
+        uint32_t fd;
+        if (!task::create_epoll(flags, fd).valid()) return -1;
+
+        return fd;
+    }
+
+    int64_t epoll_control(const uint64_t epoll_fd, const uint64_t op_, const uint64_t fd, const uint64_t interest_, const uint64_t data) {
+        if (op_ > static_cast<uint64_t>(task::EpollOp::Remove)) return -1;
+
+        const auto op = static_cast<task::EpollOp>(op_);
+        const auto interest = static_cast<vfs::PollMask>(interest_);
+        const auto process = task::get_current_process();
+
+        const auto epoll = process->get_file(epoll_fd);
+        if (!epoll.valid() || !task::is_epoll(epoll)) return -1;
+
+        const auto file = op == task::EpollOp::Add ? process->get_file(fd) : stl::Rc<vfs::File>();
+        return task::epoll_control(epoll, op, fd, file, interest, data) ? 0 : -1;
+    }
+
+    int64_t epoll_wait(const uint64_t epoll_fd, const uint64_t events_, const uint64_t max_count, const uint64_t timeout) {
+        if (max_count == 0 || max_count > 0xFFFFFFFF) return -1;
+        if (memory::virt::is_invalid_user(events_)) return -1;
+        if (memory::virt::is_invalid_user(events_ + max_count * sizeof(task::EpollEvent) - 1)) return -1;
+
+        const auto events = reinterpret_cast<task::EpollEvent*>(events_);
+
+        const auto epoll = task::get_current_process()->get_file(epoll_fd);
+        if (!epoll.valid() || !task::is_epoll(epoll)) return -1;
+
+        return task::epoll_wait(epoll, events, static_cast<uint32_t>(max_count), timeout);
+    }
+
+    /// @return 0 if woken, 1 if the timeout expired, 2 if the word did not hold the expected value, -1 on failure
+    int64_t futex_wait(const uint64_t addr, const uint64_t expected, const uint64_t timeout) {
+        if (expected > 0xFFFFFFFF) return -1;
+
+        switch (task::futex_wait(addr, static_cast<uint32_t>(expected), timeout)) {
+        case task::FutexResult::Woken:
+            return 0;
+        case task::FutexResult::TimedOut:
+            return 1;
+        case task::FutexResult::Mismatch:
+            return 2;
+        default:
+            return -1;
+        }
+    }
+
+    int64_t futex_wake(const uint64_t addr, const uint64_t count) {
+        return task::futex_wake(addr, count > 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<uint32_t>(count));
+    }
+
     // Handler
 
     extern "C" void syscall_handler(const uint64_t number, task::StackFrame* frame) {
@@ -366,6 +1089,8 @@ namespace cosmos::syscalls {
         frame->rax = handler(*frame);                                                                                                      \
         break;
 
+        smp::lock_kernel();
+
         switch (number) {
             CASE_1(0, exit)
             CASE_0(1, yield)
@@ -388,6 +1113,30 @@ namespace cosmos::syscalls {
             CASE_2(18, get_cwd)
             CASE_1(19, set_cwd)
             CASE_1(20, join)
+            CASE_6(21, mmap)
+            CASE_2(22, munmap)
+            CASE_3(23, mprotect)
+            CASE_1(24, sleep)
+            CASE_1(25, clock_gettime)
+            CASE_1(26, enter)
+            CASE_4(27, read_at)
+            CASE_4(28, write_at)
+            CASE_3(29, read_vec)
+            CASE_3(30, write_vec)
+            CASE_1(31, epoll_create)
+            CASE_5(32, epoll_control)
+            CASE_4(33, epoll_wait)
+            CASE_4(34, sendfile)
+            CASE_5(35, splice)
+            CASE_5(36, spawn)
+            CASE_4(37, thread_create)
+            CASE_1(38, thread_exit)
+            CASE_1(39, thread_join)
+            CASE_1(40, set_fs_base)
+            CASE_3(41, futex_wait)
+            CASE_2(42, futex_wake)
+            CASE_1(43, set_nice)
+            CASE_0(44, get_pid)
 
         default:
             ERROR("Invalid syscalls %llu from process %lu", number, task::get_current_process()->id);
@@ -395,6 +1144,9 @@ namespace cosmos::syscalls {
             break;
         }
 
+        smp::unlock_kernel();
+        task::preempt();
+
 #undef CASE_F
 #undef CASE_6
 #undef CASE_5
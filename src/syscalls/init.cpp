@@ -45,6 +45,9 @@ namespace cosmos::syscalls {
 
             call syscall_handler
 
+            # Handlers which switched processes return with interrupts enabled, nothing may interrupt the stack and GS swap below
+            cli
+
             # Return Logic (For syscalls that return, e.g. NOT exit)
             pop %r15
             pop %r14
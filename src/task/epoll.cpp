@@ -0,0 +1,394 @@
+#include "epoll.hpp"
+
+#include "memory/cache.hpp"
+#include "memory/heap.hpp"
+#include "scheduler.hpp"
+#include "stl/utils.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+#include "vfs/vfs.hpp"
+
+namespace cosmos::task {
+    struct Epoll;
+
+    struct EpollEntry {
+        /// Follows the wait queue of the file, waking it queues the entry on the ready list.
+        /// Needs to be the first member so that the wake function can get to the entry.
+        Waiter waiter;
+        WaitQueue* queue;
+
+        Epoll* epoll;
+        EpollEntry* next;
+
+        EpollEntry* next_ready;
+        bool ready;
+
+        vfs::File* file;
+        uint32_t fd;
+
+        vfs::PollMask interest;
+        uint64_t data;
+    };
+
+    struct Epoll {
+        EpollEntry* entries;
+
+        /// Entries which were woken or reported since the last wait, checked again by the next one
+        EpollEntry* ready_head;
+        EpollEntry* ready_tail;
+
+        /// Processes waiting on the epoll itself, also followed when an epoll is registered with another one
+        WaitQueue waiters;
+    };
+
+    static memory::cache::Cache* entry_cache = nullptr;
+
+    static Epoll* get_epoll(const vfs::File* file) {
+        return *reinterpret_cast<Epoll* const*>(file + 1);
+    }
+
+    /// @return false if the entry was already queued
+    static bool push_ready(EpollEntry* entry) {
+        if (entry->ready) return false;
+
+        const auto epoll = entry->epoll;
+
+        entry->ready = true;
+        entry->next_ready = nullptr;
+
+        if (epoll->ready_tail != nullptr) epoll->ready_tail->next_ready = entry;
+        else epoll->ready_head = entry;
+
+        epoll->ready_tail = entry;
+        return true;
+    }
+
+    static EpollEntry* pop_ready(Epoll* epoll) {
+        const auto entry = epoll->ready_head;
+        if (entry == nullptr) return nullptr;
+
+        epoll->ready_head = entry->next_ready;
+        if (epoll->ready_head == nullptr) epoll->ready_tail = nullptr;
+
+        entry->ready = false;
+        return entry;
+    }
+
+    static void entry_woken(Waiter& waiter) {
+        const auto entry = reinterpret_cast<EpollEntry*>(&waiter);
+
+        // Waiters were already woken when the entry was queued, waking them again would only recurse through nested epolls
+        if (push_ready(entry)) entry->epoll->waiters.wake_all();
+    }
+
+    static vfs::PollMask get_mask(const EpollEntry* entry) {
+        WaitQueue* queue;
+        return vfs::poll(entry->file, queue) & (entry->interest | vfs::PollMask::Hangup);
+    }
+
+    static EpollEntry* find_entry(const Epoll* epoll, const uint32_t fd, EpollEntry*** prev = nullptr) {
+        for (auto it = const_cast<EpollEntry**>(&epoll->entries); *it != nullptr; it = &(*it)->next) {
+            if ((*it)->fd == fd) {
+                if (prev != nullptr) *prev = it;
+                return *it;
+            }
+        }
+
+        return nullptr;
+    }
+
+    static void remove_ready(Epoll* epoll, const EpollEntry* entry) {
+        if (!entry->ready) return;
+
+        EpollEntry* prev = nullptr;
+
+        for (auto it = epoll->ready_head; it != nullptr; prev = it, it = it->next_ready) {
+            if (it != entry) continue;
+
+            if (prev != nullptr) prev->next_ready = it->next_ready;
+            else epoll->ready_head = it->next_ready;
+
+            if (epoll->ready_tail == it) epoll->ready_tail = prev;
+            break;
+        }
+    }
+
+    static void destroy_entry(Epoll* epoll, EpollEntry* entry) {
+        if (entry->queue != nullptr) entry->queue->remove(entry->waiter);
+        remove_ready(epoll, entry);
+
+        stl::Rc(entry->file).deref();
+        memory::cache::free(entry_cache, entry);
+    }
+
+    // File operations
+
+    static uint64_t epoll_seek([[maybe_unused]] const stl::Rc<vfs::File>& file, [[maybe_unused]] vfs::SeekType type,
+                               [[maybe_unused]] int64_t offset) {
+        return 0;
+    }
+
+    static uint64_t epoll_ioctl([[maybe_unused]] const stl::Rc<vfs::File>& file, [[maybe_unused]] uint64_t op,
+                                [[maybe_unused]] uint64_t arg) {
+        return vfs::IOCTL_UNKNOWN;
+    }
+
+    static vfs::PollMask epoll_poll(const stl::Rc<vfs::File>& file, WaitQueue*& queue) {
+        const auto epoll = get_epoll(*file);
+        queue = &epoll->waiters;
+
+        return epoll->ready_head != nullptr ? vfs::PollMask::Read : vfs::PollMask::None;
+    }
+
+    static constexpr vfs::FileOps epoll_ops = {
+        .seek = epoll_seek,
+        .read = nullptr,
+        .write = nullptr,
+        .ioctl = epoll_ioctl,
+        .poll = epoll_poll,
+    };
+
+    // Nesting
+
+    /// Epolls registered with each other can't be nested deeper than this, bounds the recursion of the checks below and of wake ups
+    constexpr uint32_t MAX_NESTING = 4;
+
+    /// Longest chain of epolls the epoll is registered with, found through the entries following its wait queue
+    static uint32_t get_parent_depth(const Epoll* epoll) {
+        uint32_t depth = 0;
+
+        for (auto waiter = epoll->waiters.head; waiter != nullptr; waiter = waiter->next) {
+            if (waiter->fn != entry_woken) continue;
+
+            const auto entry = reinterpret_cast<const EpollEntry*>(waiter);
+            depth = stl::max(depth, get_parent_depth(entry->epoll) + 1);
+        }
+
+        return depth;
+    }
+
+    /// Longest chain of epolls registered with the epoll
+    static uint32_t get_child_depth(const Epoll* epoll) {
+        uint32_t depth = 0;
+
+        for (auto entry = epoll->entries; entry != nullptr; entry = entry->next) {
+            if (entry->file->ops != &epoll_ops) continue;
+
+            depth = stl::max(depth, get_child_depth(get_epoll(entry->file)) + 1);
+        }
+
+        return depth;
+    }
+
+    static bool is_registered_below(const Epoll* epoll, const Epoll* target) {
+        if (epoll == target) return true;
+
+        for (auto entry = epoll->entries; entry != nullptr; entry = entry->next) {
+            if (entry->file->ops == &epoll_ops && is_registered_below(get_epoll(entry->file), target)) return true;
+        }
+
+        return false;
+    }
+
+    /// Registering an epoll must neither create a cycle, which would make wake ups recurse forever, nor nest them too deep
+    static bool can_register(const Epoll* epoll, const vfs::File* file) {
+        if (file->ops != &epoll_ops) return true;
+
+        const auto other = get_epoll(file);
+        if (is_registered_below(other, epoll)) return false;
+
+        return get_parent_depth(epoll) + 1 + get_child_depth(other) <= MAX_NESTING;
+    }
+
+    static void epoll_close(vfs::File* file) {
+        const auto epoll = get_epoll(file);
+        const auto rflags = utils::disable_interrupts();
+
+        while (epoll->entries != nullptr) {
+            const auto entry = epoll->entries;
+            epoll->entries = entry->next;
+
+            destroy_entry(epoll, entry);
+        }
+
+        utils::restore_interrupts(rflags);
+        memory::heap::free(epoll);
+    }
+
+    // Header
+
+    void init_epoll() {
+        entry_cache = memory::cache::create<EpollEntry>("epoll_entry");
+        if (entry_cache == nullptr) utils::panic(nullptr, "[epoll] Failed to create entry cache");
+    }
+
+    stl::Rc<vfs::File> create_epoll(const vfs::FileFlags flags, uint32_t& fd) {
+        fd = 0xFFFFFFFF;
+
+        const auto epoll = memory::heap::alloc<Epoll>();
+        if (epoll == nullptr) return {};
+
+        const auto file = vfs::alloc_file(sizeof(Epoll*));
+
+        if (!file.valid()) {
+            memory::heap::free(epoll);
+            return {};
+        }
+
+        epoll->entries = nullptr;
+        epoll->ready_head = nullptr;
+        epoll->ready_tail = nullptr;
+        epoll->waiters = {};
+
+        file->ops = &epoll_ops;
+        file->on_close = epoll_close;
+        file->node = nullptr;
+        file->mode = vfs::Mode::Read;
+        file->flags = flags;
+        file->cursor = 0;
+
+        *reinterpret_cast<Epoll**>(*file + 1) = epoll;
+
+        fd = get_current_process()->add_fd(file).value_or(0xFFFFFFFF);
+        if (fd == 0xFFFFFFFF) return {};
+
+        return file;
+    }
+
+    bool is_epoll(const stl::Rc<vfs::File>& file) {
+        return file->ops == &epoll_ops;
+    }
+
+    bool epoll_control(const stl::Rc<vfs::File>& epoll_file, const EpollOp op, const uint32_t fd, const stl::Rc<vfs::File>& file,
+                       const vfs::PollMask interest, const uint64_t data) {
+        const auto epoll = get_epoll(*epoll_file);
+        const auto rflags = utils::disable_interrupts();
+
+        EpollEntry** prev;
+        auto entry = find_entry(epoll, fd, &prev);
+        auto result = false;
+
+        switch (op) {
+        case EpollOp::Add: {
+            if (entry != nullptr || !file.valid() || !can_register(epoll, *file)) break;
+
+            entry = memory::cache::alloc<EpollEntry>(entry_cache);
+            if (entry == nullptr) break;
+
+            entry->waiter = { nullptr, nullptr, entry_woken };
+            entry->epoll = epoll;
+            entry->next = epoll->entries;
+            entry->ready = false;
+            entry->file = file.ref();
+            entry->fd = fd;
+            entry->interest = interest;
+            entry->data = data;
+
+            epoll->entries = entry;
+
+            vfs::poll(file, entry->queue);
+            if (entry->queue != nullptr) entry->queue->add(entry->waiter);
+
+            // Files which are already ready would otherwise only be reported after their next wake up
+            if (push_ready(entry)) epoll->waiters.wake_all();
+
+            result = true;
+            break;
+        }
+
+        case EpollOp::Modify:
+            if (entry == nullptr) break;
+
+            entry->interest = interest;
+            entry->data = data;
+
+            if (push_ready(entry)) epoll->waiters.wake_all();
+
+            result = true;
+            break;
+
+        case EpollOp::Remove:
+            if (entry == nullptr) break;
+
+            *prev = entry->next;
+            destroy_entry(epoll, entry);
+
+            result = true;
+            break;
+        }
+
+        utils::restore_interrupts(rflags);
+        return result;
+    }
+
+    /// @return -1 if no event could be written before user memory faulted
+    static int64_t collect(Epoll* epoll, EpollEvent* events, const uint32_t max_count) {
+        uint32_t count = 0;
+
+        // Reported entries are queued again behind the others, so they are not checked twice in one pass
+        const auto last = epoll->ready_tail;
+
+        while (count < max_count) {
+            const auto entry = pop_ready(epoll);
+            if (entry == nullptr) break;
+
+            const auto mask = get_mask(entry);
+
+            if (mask != vfs::PollMask::None) {
+                const EpollEvent event = { entry->data, mask };
+                push_ready(entry);
+
+                if (memory::virt::copy_user(&events[count], &event, sizeof(EpollEvent)) != sizeof(EpollEvent)) {
+                    return count > 0 ? count : -1;
+                }
+
+                count++;
+            }
+
+            if (entry == last) break;
+        }
+
+        return count;
+    }
+
+    struct EpollTimeout {
+        Timer timer;
+        Process* process;
+        bool expired;
+    };
+
+    static void timeout_expired(Timer& timer) {
+        const auto timeout = reinterpret_cast<EpollTimeout*>(timer.data);
+
+        timeout->expired = true;
+        wake(timeout->process);
+    }
+
+    int64_t epoll_wait(const stl::Rc<vfs::File>& epoll_file, EpollEvent* events, const uint32_t max_count, const uint64_t timeout_ms) {
+        const auto epoll = get_epoll(*epoll_file);
+        const auto process = get_current_process();
+
+        const auto rflags = utils::disable_interrupts();
+
+        auto count = collect(epoll, events, max_count);
+
+        if (count == 0 && timeout_ms != 0) {
+            EpollTimeout timeout = { {}, process, false };
+            if (timeout_ms != EPOLL_INFINITE) add_timer(timeout.timer, timeout_ms, 0, timeout_expired, reinterpret_cast<uint64_t>(&timeout));
+
+            Waiter waiter = { nullptr, process, nullptr };
+            epoll->waiters.add(waiter);
+
+            do {
+                park();
+                count = collect(epoll, events, max_count);
+            } while (count == 0 && !timeout.expired);
+
+            epoll->waiters.remove(waiter);
+            cancel_timer(timeout.timer);
+        }
+
+        utils::restore_interrupts(rflags);
+        return count;
+    }
+} // namespace cosmos::task
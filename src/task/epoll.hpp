@@ -0,0 +1,40 @@
+#pragma once
+
+#include "stl/rc.hpp"
+#include "vfs/types.hpp"
+
+#include <cstdint>
+
+namespace cosmos::task {
+    enum class EpollOp : uint8_t {
+        Add,
+        Modify,
+        Remove,
+    };
+
+    struct EpollEvent {
+        uint64_t data;
+        vfs::PollMask mask;
+    };
+
+    constexpr uint64_t EPOLL_INFINITE = UINT64_MAX;
+
+    /// Creates the entry cache, has to be called before any epoll is created
+    void init_epoll();
+
+    /// Creates a file which files are registered with once, waiting on it only looks at the files which became ready since.
+    /// Registered files are referenced until they are removed or the epoll file is closed.
+    /// Returns nullptr on failure and fd is set to 0xFFFFFFFF
+    stl::Rc<vfs::File> create_epoll(vfs::FileFlags flags, uint32_t& fd);
+
+    bool is_epoll(const stl::Rc<vfs::File>& file);
+
+    /// Files are identified by the file descriptor they were added with, Modify and Remove ignore the file
+    bool epoll_control(const stl::Rc<vfs::File>& epoll, EpollOp op, uint32_t fd, const stl::Rc<vfs::File>& file, vfs::PollMask interest,
+                       uint64_t data);
+
+    /// Waits until at least one registered file is ready or the timeout in milliseconds expired, files stay ready until the condition
+    /// is cleared. A timeout of 0 never blocks and EPOLL_INFINITE never expires.
+    /// @return number of events written to the user memory events points to, -1 if it is not writable
+    int64_t epoll_wait(const stl::Rc<vfs::File>& epoll, EpollEvent* events, uint32_t max_count, uint64_t timeout);
+} // namespace cosmos::task
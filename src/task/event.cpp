@@ -1,9 +1,13 @@
 #include "event.hpp"
 
 #include "memory/heap.hpp"
+#include "memory/virtual.hpp"
 #include "scheduler.hpp"
+#include "vfs/vfs.hpp"
 
 namespace cosmos::task {
+    static_assert(sizeof(Event) <= vfs::FILE_DATA_SIZE, "Event does not fit in file data");
+
     static uint64_t event_seek([[maybe_unused]] const stl::Rc<vfs::File>& file, [[maybe_unused]] vfs::SeekType type,
                                [[maybe_unused]] int64_t offset) {
         return 0;
@@ -14,10 +18,11 @@ namespace cosmos::task {
         const auto event = reinterpret_cast<Event*>(*file + 1);
 
         if (event->number == 0) {
-            wait_on_events(&file, 1, false);
+            uint64_t mask;
+            if (!wait_on_events(&file, 1, false, mask)) return 0;
         }
 
-        *static_cast<uint64_t*>(buffer) = event->number;
+        if (memory::virt::copy_user(buffer, &event->number, sizeof(uint64_t)) != sizeof(uint64_t)) return 0;
         event->number = 0;
 
         return sizeof(uint64_t);
@@ -26,11 +31,14 @@ namespace cosmos::task {
     static uint64_t event_write(const stl::Rc<vfs::File>& file, const void* buffer, const uint64_t length) {
         if (length != sizeof(uint64_t)) return 0;
 
+        uint64_t number;
+        if (memory::virt::copy_user(&number, buffer, sizeof(uint64_t)) != sizeof(uint64_t)) return 0;
+
         asm volatile("cli" ::: "memory");
         const auto event = reinterpret_cast<Event*>(*file + 1);
 
-        event->number += *static_cast<const uint64_t*>(buffer);
-        if (event->waiting_process != nullptr) event->waiting_process->unsuspend_data = 1;
+        event->number += number;
+        event->waiters.wake_all();
 
         asm volatile("sti" ::: "memory");
         return sizeof(uint64_t);
@@ -41,11 +49,19 @@ namespace cosmos::task {
         return vfs::IOCTL_UNKNOWN;
     }
 
+    static vfs::PollMask event_poll(const stl::Rc<vfs::File>& file, WaitQueue*& queue) {
+        const auto event = reinterpret_cast<Event*>(*file + 1);
+        queue = &event->waiters;
+
+        return vfs::PollMask::Write | (event->number > 0 ? vfs::PollMask::Read : vfs::PollMask::None);
+    }
+
     static constexpr vfs::FileOps event_ops = {
         .seek = event_seek,
         .read = event_read,
         .write = event_write,
         .ioctl = event_ioctl,
+        .poll = event_poll,
     };
 
     static void event_close(vfs::File* file) {
@@ -59,7 +75,7 @@ namespace cosmos::task {
     // Header
 
     stl::Rc<vfs::File> create_event(void (*close_fn)(uint64_t data), const uint64_t close_data, const vfs::FileFlags flags, uint32_t& fd) {
-        const auto file = stl::Rc<vfs::File>::alloc(sizeof(Event));
+        const auto file = vfs::alloc_file(sizeof(Event));
 
         if (!file.valid()) {
             fd = 0xFFFFFFFF;
@@ -84,11 +100,22 @@ namespace cosmos::task {
         event->close_fn = close_fn;
         event->close_data = close_data;
         event->number = 0;
-        event->waiting_process = nullptr;
+        event->waiters = {};
 
         return file;
     }
 
+    static bool any_signalled(const stl::Rc<vfs::File>* event_files, const uint32_t count) {
+        for (auto i = 0u; i < count; i++) {
+            if (event_files[i] == nullptr) continue;
+            const auto event = reinterpret_cast<Event*>(*event_files[i] + 1);
+
+            if (event->number > 0) return true;
+        }
+
+        return false;
+    }
+
     static uint64_t get_signalled_mask(const stl::Rc<vfs::File>* event_files, const uint32_t count, const bool reset_signalled) {
         uint64_t mask = 0;
 
@@ -100,51 +127,52 @@ namespace cosmos::task {
                 mask |= 1ull << i;
                 if (reset_signalled) event->number = 0;
             }
-
-            event->waiting_process = nullptr;
         }
 
         return mask;
     }
 
-    static bool wait_on_events_unsuspend(const uint64_t signalled) {
-        return signalled != 0;
-    }
-
-    uint64_t wait_on_events(const stl::Rc<vfs::File>* event_files, uint32_t count, bool reset_signalled) {
-        if (count > 64) return 0;
+    bool wait_on_events(const stl::Rc<vfs::File>* event_files, const uint32_t count, const bool reset_signalled, uint64_t& mask) {
+        if (count > 64) return false;
         asm volatile("cli" ::: "memory");
 
-        const auto process = get_current_process();
+        if (!any_signalled(event_files, count)) {
+            // Kernel stacks are small, so the waiters live on the heap
+            const auto waiters = memory::heap::alloc_array<Waiter>(count);
 
-        for (auto i = 0u; i < count; i++) {
-            if (event_files[i] == nullptr) continue;
-            const auto event = reinterpret_cast<Event*>(*event_files[i] + 1);
+            if (waiters == nullptr) {
+                asm volatile("sti" ::: "memory");
+                return false;
+            }
 
-            if (event->number > 0) {
-                const auto mask = get_signalled_mask(event_files, count, reset_signalled);
+            // Park on all events at once, whichever is signalled first wakes the process
+            const auto process = get_current_process();
 
-                asm volatile("sti" ::: "memory");
-                return mask;
+            for (auto i = 0u; i < count; i++) {
+                if (event_files[i] == nullptr) continue;
+                const auto event = reinterpret_cast<Event*>(*event_files[i] + 1);
+
+                waiters[i] = { nullptr, process, nullptr };
+                event->waiters.add(waiters[i]);
             }
-        }
 
-        for (auto i = 0u; i < count; i++) {
-            if (event_files[i] == nullptr) continue;
-            const auto event = reinterpret_cast<Event*>(*event_files[i] + 1);
+            do {
+                park();
+            } while (!any_signalled(event_files, count));
 
-            event->waiting_process = *process;
-        }
+            for (auto i = 0u; i < count; i++) {
+                if (event_files[i] == nullptr) continue;
+                const auto event = reinterpret_cast<Event*>(*event_files[i] + 1);
 
-        process->event_files = event_files;
-        process->event_count = count;
+                event->waiters.remove(waiters[i]);
+            }
 
-        suspend(wait_on_events_unsuspend, 0);
-        asm volatile("cli" ::: "memory");
+            memory::heap::free(waiters);
+        }
 
-        const auto mask = get_signalled_mask(event_files, count, reset_signalled);
+        mask = get_signalled_mask(event_files, count, reset_signalled);
 
         asm volatile("sti" ::: "memory");
-        return mask;
+        return true;
     }
 } // namespace cosmos::task
@@ -8,11 +8,13 @@ namespace cosmos::task {
         uint64_t close_data;
 
         uint64_t number;
-        Process* waiting_process;
+        WaitQueue waiters;
     };
 
     /// Returns nullptr on failure and fd is set to 0xFFFFFFFF
     stl::Rc<vfs::File> create_event(void (*close_fn)(uint64_t data), uint64_t close_data, vfs::FileFlags flags, uint32_t& fd);
 
-    uint64_t wait_on_events(const stl::Rc<vfs::File>* event_files, uint32_t count, bool reset_signalled);
+    /// Parks until one of the events is signalled, mask gets a bit set for each signalled event
+    /// @return false if the waiters could not be allocated
+    bool wait_on_events(const stl::Rc<vfs::File>* event_files, uint32_t count, bool reset_signalled, uint64_t& mask);
 } // namespace cosmos::task
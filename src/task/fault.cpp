@@ -0,0 +1,65 @@
+#include "fault.hpp"
+
+#include "interrupts/isr.hpp"
+#include "log/log.hpp"
+#include "memory/offsets.hpp"
+#include "region.hpp"
+#include "scheduler.hpp"
+
+namespace cosmos::task {
+    constexpr uint8_t PAGE_FAULT = 14;
+    constexpr uint8_t X87_FAULT = 16;
+    constexpr uint8_t SIMD_FAULT = 19;
+
+    constexpr uint64_t PAGE_FAULT_PRESENT = 1ul << 0;
+    constexpr uint64_t PAGE_FAULT_WRITE = 1ul << 1;
+
+    static bool is_process_memory(const uint64_t addr) {
+        return !memory::virt::is_invalid_user(addr) && get_current_process()->land == Land::User;
+    }
+
+    static bool resolve_fault(const uint64_t addr, const uint64_t error) {
+        const auto present = (error & PAGE_FAULT_PRESENT) != 0;
+        const auto write = (error & PAGE_FAULT_WRITE) != 0;
+
+        // Untouched pages of regions and writes to copy-on-write pages.
+        // Either from the process itself or from the kernel accessing user memory.
+        const auto process = get_current_process();
+        return handle_region_fault(process->space, process->leader->regions, addr, present, write);
+    }
+
+    static bool page_fault_handler(isr::InterruptInfo* info) {
+        uint64_t addr;
+        asm volatile("mov %%cr2, %0" : "=r"(addr));
+
+        const auto process_memory = is_process_memory(addr);
+        if (process_memory && resolve_fault(addr, info->error)) return true;
+
+        // The kernel accesses memory of the process only through the user copy functions, which report the fault to the syscall.
+        // Any other fault in the kernel is fatal.
+        const auto from_user = (info->iret_cs & 3) == 3;
+        if (!from_user) return process_memory && memory::virt::fixup_user_fault(info->iret_rip);
+
+        ERROR("Process %d killed, page fault at 0x%llx, rip: 0x%llx", get_current_process()->id, addr, info->iret_rip);
+        exit(FAULT_EXIT_STATUS);
+
+        return true;
+    }
+
+    /// Floating point exceptions are masked by default, they only reach here if user-land unmasked them
+    static bool fpu_fault_handler(isr::InterruptInfo* info) {
+        const auto from_user = (info->iret_cs & 3) == 3;
+        if (!from_user) return false;
+
+        ERROR("Process %d killed, floating point exception %llu, rip: 0x%llx", get_current_process()->id, info->interrupt, info->iret_rip);
+        exit(FAULT_EXIT_STATUS);
+
+        return true;
+    }
+
+    void init_fault_handlers() {
+        isr::set_exception(PAGE_FAULT, page_fault_handler);
+        isr::set_exception(X87_FAULT, fpu_fault_handler);
+        isr::set_exception(SIMD_FAULT, fpu_fault_handler);
+    }
+} // namespace cosmos::task
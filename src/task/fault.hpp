@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cosmos::task {
+    /// Exit status of user-land processes which were killed because of a fault they could not recover from
+    constexpr uint64_t FAULT_EXIT_STATUS = 139;
+
+    /// Registers the page fault handler, resolves copy-on-write pages and kills user-land processes on unresolvable faults
+    void init_fault_handlers();
+} // namespace cosmos::task
@@ -0,0 +1,136 @@
+#include "futex.hpp"
+
+#include "memory/offsets.hpp"
+#include "scheduler.hpp"
+#include "timer.hpp"
+#include "utils.hpp"
+
+namespace cosmos::task {
+    constexpr uint32_t BUCKET_COUNT = 64;
+
+    /// Private words are identified by the space and their virtual address, shared ones by their physical address and a space of 0
+    struct FutexKey {
+        memory::virt::Space space;
+        uint64_t addr;
+
+        bool operator==(const FutexKey& other) const {
+            return space == other.space && addr == other.addr;
+        }
+    };
+
+    /// Lives on the kernel stack of the waiting process
+    struct FutexWaiter {
+        FutexWaiter* next;
+        Process* process;
+
+        FutexKey key;
+
+        bool woken;
+        bool expired;
+
+        Timer timer;
+    };
+
+    /// Waiters of all words hashing to the same bucket, only accessed with the kernel lock held and interrupts disabled
+    static FutexWaiter* buckets[BUCKET_COUNT] = {};
+
+    static FutexWaiter*& get_bucket(const FutexKey& key) {
+        const auto hash = (key.space ^ key.addr) * 0x9E3779B97F4A7C15ul;
+        return buckets[hash >> 58];
+    }
+
+    static void remove_waiter(FutexWaiter& waiter) {
+        for (auto it = &get_bucket(waiter.key); *it != nullptr; it = &(*it)->next) {
+            if (*it == &waiter) {
+                *it = waiter.next;
+                break;
+            }
+        }
+    }
+
+    /// Faults the page in if needed, the kernel can access user memory the same way the process can
+    static bool get_key(const uint64_t addr, FutexKey& key) {
+        if (addr % alignof(uint32_t) != 0 || memory::virt::is_invalid_user(addr + sizeof(uint32_t) - 1)) return false;
+
+        const auto process = get_current_process();
+
+        const auto region = find_region(process->leader->regions, addr);
+        if (region == nullptr || !(region->flags / memory::virt::Flags::User)) return false;
+
+        if (region->flags / memory::virt::Flags::Shared) {
+            uint32_t value;
+            if (!memory::virt::load_user(addr, value)) return false;
+
+            key = { 0, memory::virt::get_phys(addr) };
+        } else {
+            key = { process->space, addr };
+        }
+
+        return key.addr != 0;
+    }
+
+    static void timeout_expired(Timer& timer) {
+        const auto waiter = reinterpret_cast<FutexWaiter*>(timer.data);
+
+        waiter->expired = true;
+        wake(waiter->process);
+    }
+
+    FutexResult futex_wait(const uint64_t addr, const uint32_t expected, const uint64_t timeout) {
+        FutexWaiter waiter = {};
+        if (!get_key(addr, waiter.key)) return FutexResult::Invalid;
+
+        // Wakers hold the kernel lock as well, so the word can't be changed and woken between the check and adding the waiter
+        uint32_t value;
+        if (!memory::virt::load_user(addr, value)) return FutexResult::Invalid;
+        if (value != expected) return FutexResult::Mismatch;
+        if (timeout == 0) return FutexResult::TimedOut;
+
+        waiter.process = get_current_process();
+
+        const auto rflags = utils::disable_interrupts();
+
+        auto& bucket = get_bucket(waiter.key);
+        waiter.next = bucket;
+        bucket = &waiter;
+
+        if (timeout != FUTEX_INFINITE) add_timer(waiter.timer, timeout, 0, timeout_expired, reinterpret_cast<uint64_t>(&waiter));
+
+        do {
+            park();
+        } while (!waiter.woken && !waiter.expired);
+
+        // Woken waiters were already removed by futex_wake
+        if (!waiter.woken) remove_waiter(waiter);
+        cancel_timer(waiter.timer);
+
+        utils::restore_interrupts(rflags);
+        return waiter.woken ? FutexResult::Woken : FutexResult::TimedOut;
+    }
+
+    uint32_t futex_wake(const uint64_t addr, const uint32_t count) {
+        FutexKey key;
+        if (!get_key(addr, key)) return 0;
+
+        const auto rflags = utils::disable_interrupts();
+        uint32_t woken = 0;
+
+        for (auto it = &get_bucket(key); *it != nullptr && woken < count;) {
+            const auto waiter = *it;
+
+            if (waiter->key != key) {
+                it = &waiter->next;
+                continue;
+            }
+
+            *it = waiter->next;
+            waiter->woken = true;
+
+            wake(waiter->process);
+            woken++;
+        }
+
+        utils::restore_interrupts(rflags);
+        return woken;
+    }
+} // namespace cosmos::task
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cosmos::task {
+    constexpr uint64_t FUTEX_INFINITE = UINT64_MAX;
+
+    enum class FutexResult : uint8_t {
+        Woken,
+        TimedOut,
+        /// The word did not hold the expected value
+        Mismatch,
+        /// The address is not 4 byte aligned or not inside an accessible region
+        Invalid,
+    };
+
+    /// Parks the current process until futex_wake is called for the same word, as long as the word still holds the expected value.
+    /// Words in shared regions are identified by their physical address and can be used across processes, the others only by the
+    /// threads of a process. A timeout in milliseconds of FUTEX_INFINITE never expires.
+    FutexResult futex_wait(uint64_t addr, uint32_t expected, uint64_t timeout);
+
+    /// @return number of woken processes, at most count
+    uint32_t futex_wake(uint64_t addr, uint32_t count);
+} // namespace cosmos::task
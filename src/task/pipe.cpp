@@ -1,9 +1,157 @@
 #include "pipe.hpp"
 
-#include "memory/heap.hpp"
+#include "log/log.hpp"
+#include "memory/cache.hpp"
+#include "memory/offsets.hpp"
+#include "memory/physical.hpp"
 #include "scheduler.hpp"
+#include "stl/utils.hpp"
+#include "utils.hpp"
+#include "vfs/vfs.hpp"
 
 namespace cosmos::task {
+    static memory::cache::Cache* pipe_cache = nullptr;
+
+    // Buffer
+
+    static PipeSegment* alloc_segment(Pipe* pipe) {
+        auto segment = pipe->spare;
+
+        if (segment != nullptr) {
+            pipe->spare = nullptr;
+        } else {
+            const auto phys = memory::phys::alloc_pages(1);
+
+            if (phys == 0) {
+                ERROR("Failed to allocate pipe segment");
+                return nullptr;
+            }
+
+            segment = reinterpret_cast<PipeSegment*>(memory::virt::DIRECT_MAP + phys);
+        }
+
+        segment->next = nullptr;
+        segment->start = 0;
+        segment->end = 0;
+
+        return segment;
+    }
+
+    static void free_segment(Pipe* pipe, PipeSegment* segment) {
+        if (pipe->spare == nullptr) {
+            pipe->spare = segment;
+            return;
+        }
+
+        memory::phys::free_pages((reinterpret_cast<uint64_t>(segment) - memory::virt::DIRECT_MAP) / 4096ul, 1);
+    }
+
+    static void append_segment(Pipe* pipe, PipeSegment* segment) {
+        if (pipe->tail != nullptr) pipe->tail->next = segment;
+        else pipe->head = segment;
+
+        pipe->tail = segment;
+    }
+
+    /// @return tail segment with room left, a new one is added if the tail is full
+    static PipeSegment* get_writable_segment(Pipe* pipe) {
+        if (pipe->tail != nullptr && pipe->tail->end < sizeof(PipeSegment::data)) return pipe->tail;
+
+        const auto segment = alloc_segment(pipe);
+        if (segment != nullptr) append_segment(pipe, segment);
+
+        return segment;
+    }
+
+    /// Drops bytes from the start of the head segment, fully read segments are given back right away
+    static void consume(Pipe* pipe, PipeSegment* segment, const uint64_t count) {
+        segment->start += count;
+        pipe->size -= count;
+
+        if (segment->start == segment->end) {
+            pipe->head = segment->next;
+            if (pipe->head == nullptr) pipe->tail = nullptr;
+
+            free_segment(pipe, segment);
+        }
+    }
+
+    /// @return number of bytes copied into the buffer, less than length if it is full or no segment could be allocated
+    static uint64_t buffer_write(Pipe* pipe, const uint8_t* bytes, uint64_t length) {
+        length = stl::min(length, PIPE_CAPACITY - pipe->size - pipe->reserved);
+        uint64_t written = 0;
+
+        while (written < length) {
+            const auto segment = get_writable_segment(pipe);
+            if (segment == nullptr) break;
+
+            const auto count = stl::min(length - written, static_cast<uint64_t>(sizeof(PipeSegment::data) - segment->end));
+            const auto copied = memory::virt::copy_user(&segment->data[segment->end], bytes + written, count);
+
+            segment->end += copied;
+            pipe->size += copied;
+            written += copied;
+
+            if (copied != count) break;
+        }
+
+        return written;
+    }
+
+    static uint64_t buffer_read(Pipe* pipe, uint8_t* bytes, const uint64_t length) {
+        uint64_t read = 0;
+
+        while (read < length && pipe->head != nullptr) {
+            const auto segment = pipe->head;
+
+            const auto count = stl::min(length - read, static_cast<uint64_t>(segment->end - segment->start));
+            const auto copied = memory::virt::copy_user(bytes + read, &segment->data[segment->start], count);
+
+            read += copied;
+            consume(pipe, segment, copied);
+
+            if (copied != count) break;
+        }
+
+        return read;
+    }
+
+    static void buffer_free(Pipe* pipe) {
+        while (pipe->head != nullptr) {
+            const auto segment = pipe->head;
+            pipe->head = segment->next;
+
+            memory::phys::free_pages((reinterpret_cast<uint64_t>(segment) - memory::virt::DIRECT_MAP) / 4096ul, 1);
+        }
+
+        if (pipe->spare != nullptr) {
+            memory::phys::free_pages((reinterpret_cast<uint64_t>(pipe->spare) - memory::virt::DIRECT_MAP) / 4096ul, 1);
+        }
+    }
+
+    /// Blocks until data is buffered or the last writer closed
+    static void wait_readable(Pipe* pipe) {
+        wait_until(pipe->readers, [pipe] {
+            uint64_t count;
+            __atomic_load(&pipe->writer_count, &count, __ATOMIC_ACQUIRE);
+
+            return pipe->size != 0 || count == 0;
+        });
+    }
+
+    /// Blocks until the buffer has room or the last reader closed
+    /// @return false if there are no readers left
+    static bool wait_writable(Pipe* pipe) {
+        auto reader_count = 0ul;
+
+        wait_until(pipe->writers, [pipe, &reader_count] {
+            __atomic_load(&pipe->reader_count, &reader_count, __ATOMIC_ACQUIRE);
+            return pipe->size + pipe->reserved < PIPE_CAPACITY || reader_count == 0;
+        });
+
+        return reader_count != 0;
+    }
+
     // File operations
 
     static uint64_t pipe_seek([[maybe_unused]] const stl::Rc<vfs::File>& file, [[maybe_unused]] vfs::SeekType type,
@@ -15,16 +163,12 @@ namespace cosmos::task {
         if (!vfs::is_read(file->mode)) return 0;
 
         const auto pipe = *reinterpret_cast<Pipe**>(*file + 1);
+        wait_readable(pipe);
 
-        while (pipe->buffer.size() == 0) {
-            uint64_t count;
-            __atomic_load(&pipe->writer_count, &count, __ATOMIC_ACQUIRE);
-            if (count == 0) return 0;
-
-            yield();
-        }
+        const auto read = buffer_read(pipe, static_cast<uint8_t*>(buffer), length);
+        if (read > 0) pipe->writers.wake_all();
 
-        return pipe->buffer.try_get(static_cast<uint8_t*>(buffer), length);
+        return read;
     }
 
     static uint64_t pipe_write(const stl::Rc<vfs::File>& file, const void* buffer, uint64_t length) {
@@ -36,16 +180,12 @@ namespace cosmos::task {
         uint64_t written = 0;
 
         while (length > 0) {
-            while (pipe->buffer.remaining() == 0) {
-                uint64_t count;
-                __atomic_load(&pipe->reader_count, &count, __ATOMIC_ACQUIRE);
-                if (count == 0) return written;
+            if (!wait_writable(pipe)) return written;
 
-                yield();
-            }
+            const auto write = buffer_write(pipe, bytes, length);
+            if (write == 0) return written;
 
-            const auto write = stl::min(length, pipe->buffer.remaining());
-            pipe->buffer.add(bytes, write);
+            pipe->readers.wake_all();
 
             bytes += write;
             length -= write;
@@ -60,11 +200,32 @@ namespace cosmos::task {
         return vfs::IOCTL_UNKNOWN;
     }
 
+    static vfs::PollMask pipe_poll(const stl::Rc<vfs::File>& file, WaitQueue*& queue) {
+        const auto pipe = *reinterpret_cast<Pipe**>(*file + 1);
+        auto mask = vfs::PollMask::None;
+
+        if (vfs::is_read(file->mode)) {
+            queue = &pipe->readers;
+
+            // Reads return right away once the writers are gone
+            if (__atomic_load_n(&pipe->writer_count, __ATOMIC_ACQUIRE) == 0) mask |= vfs::PollMask::Read | vfs::PollMask::Hangup;
+            else if (pipe->size != 0) mask |= vfs::PollMask::Read;
+        } else {
+            queue = &pipe->writers;
+
+            if (__atomic_load_n(&pipe->reader_count, __ATOMIC_ACQUIRE) == 0) mask |= vfs::PollMask::Hangup;
+            else if (pipe->size + pipe->reserved < PIPE_CAPACITY) mask |= vfs::PollMask::Write;
+        }
+
+        return mask;
+    }
+
     static constexpr vfs::FileOps pipe_ops = {
         .seek = pipe_seek,
         .read = pipe_read,
         .write = pipe_write,
         .ioctl = pipe_ioctl,
+        .poll = pipe_poll,
     };
 
     // File callbacks
@@ -75,31 +236,45 @@ namespace cosmos::task {
         if (vfs::is_read(file->mode)) __atomic_sub_fetch(&pipe->reader_count, 1, __ATOMIC_RELEASE);
         if (vfs::is_write(file->mode)) __atomic_sub_fetch(&pipe->writer_count, 1, __ATOMIC_RELEASE);
 
+        // The other end might be waiting for this one
+        pipe->readers.wake_all();
+        pipe->writers.wake_all();
+
         if (__atomic_sub_fetch(&pipe->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
-            memory::heap::free(pipe);
+            buffer_free(pipe);
+            memory::cache::free(pipe_cache, pipe);
         }
     }
 
     // Header
 
+    void init_pipes() {
+        pipe_cache = memory::cache::create<Pipe>("pipe");
+        if (pipe_cache == nullptr) utils::panic(nullptr, "[pipe] Failed to create pipe cache");
+    }
+
     bool create_pipe(const vfs::FileFlags flags, stl::Rc<vfs::File>& read_file, stl::Rc<vfs::File>& write_file) {
         // Allocate pipe
-        const auto pipe = memory::heap::alloc<Pipe>();
+        const auto pipe = memory::cache::alloc<Pipe>(pipe_cache);
         if (pipe == nullptr) return false;
 
-        // Allocate read file
-        read_file = stl::Rc<vfs::File>::alloc(sizeof(Pipe*));
+        // Allocate files, they are only handed out once both are filled
+        const auto reader = vfs::alloc_file(sizeof(Pipe*));
+        const auto writer = vfs::alloc_file(sizeof(Pipe*));
 
-        if (!read_file.valid()) {
-            memory::heap::free(pipe);
-            return false;
-        }
+        if (!reader.valid() || !writer.valid()) {
+            // Files come back from the cache with the fields of their last use, which must not be closed again
+            if (reader.valid()) {
+                reader->node = nullptr;
+                reader->on_close = nullptr;
+            }
 
-        // Allocate write file
-        write_file = stl::Rc<vfs::File>::alloc(sizeof(Pipe*));
+            if (writer.valid()) {
+                writer->node = nullptr;
+                writer->on_close = nullptr;
+            }
 
-        if (!write_file.valid()) {
-            memory::heap::free(pipe);
+            memory::cache::free(pipe_cache, pipe);
             return false;
         }
 
@@ -107,28 +282,116 @@ namespace cosmos::task {
         pipe->ref_count = 2;
         pipe->reader_count = 1;
         pipe->writer_count = 1;
-        pipe->buffer.reset();
+        pipe->readers = {};
+        pipe->writers = {};
+        pipe->head = nullptr;
+        pipe->tail = nullptr;
+        pipe->spare = nullptr;
+        pipe->size = 0;
+        pipe->reserved = 0;
 
         // Fill read file
-        read_file->ops = &pipe_ops;
-        read_file->on_close = pipe_close;
-        read_file->node = nullptr;
-        read_file->mode = vfs::Mode::Read;
-        read_file->flags = flags;
-        read_file->cursor = 0;
+        reader->ops = &pipe_ops;
+        reader->on_close = pipe_close;
+        reader->node = nullptr;
+        reader->mode = vfs::Mode::Read;
+        reader->flags = flags;
+        reader->cursor = 0;
 
-        *reinterpret_cast<Pipe**>(*read_file + 1) = pipe;
+        *reinterpret_cast<Pipe**>(*reader + 1) = pipe;
 
         // Fill write file
-        write_file->ops = &pipe_ops;
-        write_file->on_close = pipe_close;
-        write_file->node = nullptr;
-        write_file->mode = vfs::Mode::Write;
-        write_file->flags = flags;
-        write_file->cursor = 0;
+        writer->ops = &pipe_ops;
+        writer->on_close = pipe_close;
+        writer->node = nullptr;
+        writer->mode = vfs::Mode::Write;
+        writer->flags = flags;
+        writer->cursor = 0;
+
+        *reinterpret_cast<Pipe**>(*writer + 1) = pipe;
 
-        *reinterpret_cast<Pipe**>(*write_file + 1) = pipe;
+        read_file = reader;
+        write_file = writer;
 
         return true;
     }
+
+    bool is_pipe(const stl::Rc<vfs::File>& file) {
+        return file->ops == &pipe_ops;
+    }
+
+    uint64_t splice_to_pipe(const stl::Rc<vfs::File>& pipe_file, const stl::Rc<vfs::File>& file, uint64_t* offset, uint64_t length) {
+        if (!vfs::is_write(pipe_file->mode) || !vfs::is_read(file->mode) || file->ops->read == nullptr) return 0;
+
+        const auto pipe = *reinterpret_cast<Pipe**>(*pipe_file + 1);
+        uint64_t written = 0;
+
+        while (length > 0) {
+            if (!wait_writable(pipe)) break;
+
+            // The file is read straight into a segment which is only linked once filled, the read can block and readers
+            // could otherwise free the tail segment underneath it
+            const auto segment = alloc_segment(pipe);
+            if (segment == nullptr) break;
+
+            // The room is reserved for the read, so writers can't fill the pipe while it blocks and everything read fits
+            const auto room = PIPE_CAPACITY - pipe->size - pipe->reserved;
+            const auto count = stl::min(length, stl::min(room, static_cast<uint64_t>(sizeof(PipeSegment::data))));
+
+            pipe->reserved += count;
+            const auto read = offset != nullptr ? vfs::read_at(file, segment->data, count, *offset) : file->ops->read(file, segment->data, count);
+            pipe->reserved -= count;
+
+            // Writers might wait for the part of the reservation which was not used
+            if (read < count) pipe->writers.wake_all();
+
+            if (read == 0) {
+                free_segment(pipe, segment);
+                break;
+            }
+
+            if (offset != nullptr) *offset += read;
+
+            segment->end = read;
+            append_segment(pipe, segment);
+
+            pipe->size += read;
+            pipe->readers.wake_all();
+
+            length -= read;
+            written += read;
+        }
+
+        return written;
+    }
+
+    uint64_t splice_from_pipe(const stl::Rc<vfs::File>& pipe_file, const stl::Rc<vfs::File>& file, uint64_t* offset, uint64_t length) {
+        if (!vfs::is_read(pipe_file->mode) || !vfs::is_write(file->mode) || file->ops->write == nullptr) return 0;
+
+        const auto pipe = *reinterpret_cast<Pipe**>(*pipe_file + 1);
+        wait_readable(pipe);
+
+        uint64_t read = 0;
+
+        // Only moves what is buffered right now, like a read would
+        while (length > 0 && pipe->head != nullptr) {
+            const auto segment = pipe->head;
+
+            const auto src = &segment->data[segment->start];
+            const auto count = stl::min(length, static_cast<uint64_t>(segment->end - segment->start));
+
+            const auto written = offset != nullptr ? vfs::write_at(file, src, count, *offset) : file->ops->write(file, src, count);
+            if (written == 0) break;
+
+            if (offset != nullptr) *offset += written;
+
+            consume(pipe, segment, written);
+
+            length -= written;
+            read += written;
+        }
+
+        if (read > 0) pipe->writers.wake_all();
+        return read;
+    }
 } // namespace cosmos::task
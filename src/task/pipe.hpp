@@ -1,21 +1,61 @@
 #pragma once
 
 #include "stl/rc.hpp"
-#include "stl/ring_buffer.hpp"
 #include "vfs/types.hpp"
+#include "wait_queue.hpp"
 
 namespace cosmos::task {
+    /// Most bytes a pipe buffers before writers block
     constexpr uint64_t PIPE_CAPACITY = 64 * 1024;
 
+    /// Page sized piece of a pipe buffer
+    struct PipeSegment {
+        PipeSegment* next;
+
+        /// Bytes in [start, end) are buffered
+        uint32_t start;
+        uint32_t end;
+
+        uint8_t data[4096 - 16];
+    };
+
+    static_assert(sizeof(PipeSegment) == 4096, "PipeSegment is not page sized");
+
     struct Pipe {
         uint64_t ref_count;
         uint64_t reader_count;
         uint64_t writer_count;
 
-        stl::RingBuffer<uint8_t, PIPE_CAPACITY> buffer;
+        /// Woken when data is written or the last writer closes
+        WaitQueue readers;
+        /// Woken when data is read or the last reader closes
+        WaitQueue writers;
+
+        /// Segments are added at the tail while writing and freed from the head once they are read, so an idle pipe holds no memory
+        /// apart from one spare segment which avoids reallocating for every write of a steady stream
+        PipeSegment* head;
+        PipeSegment* tail;
+        PipeSegment* spare;
+
+        uint64_t size;
+        /// Room taken by splices which are still reading into a segment, counted against the capacity like buffered bytes
+        uint64_t reserved;
     };
 
     /// Creates a unidirectional pipe with two "ends".
     /// Each "end" will block if there is either no data to be read or if the pipe is full.
+    /// Creates the pipe cache, has to be called before any pipe is created
+    void init_pipes();
+
     bool create_pipe(vfs::FileFlags flags, stl::Rc<vfs::File>& read_file, stl::Rc<vfs::File>& write_file);
+
+    bool is_pipe(const stl::Rc<vfs::File>& file);
+
+    /// Reads from the file straight into the buffer of the write end, at the offset if not nullptr which is then advanced.
+    /// Blocks while the pipe is full and stops at the end of the file. Only reads what fits, so the file does not have to be seekable.
+    uint64_t splice_to_pipe(const stl::Rc<vfs::File>& pipe_file, const stl::Rc<vfs::File>& file, uint64_t* offset, uint64_t length);
+
+    /// Writes the buffer of the read end straight to the file, at the offset if not nullptr which is then advanced.
+    /// Blocks until something is buffered, like a read. Writes to the file must not block, use a bounce buffer for pipes.
+    uint64_t splice_from_pipe(const stl::Rc<vfs::File>& pipe_file, const stl::Rc<vfs::File>& file, uint64_t* offset, uint64_t length);
 } // namespace cosmos::task
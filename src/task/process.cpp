@@ -1,55 +1,76 @@
 #include "process.hpp"
 
+#include "clock.hpp"
 #include "elf/loader.hpp"
 #include "elf/parser.hpp"
+#include "fpu.hpp"
 #include "log/log.hpp"
+#include "memory/cache.hpp"
 #include "memory/heap.hpp"
 #include "memory/offsets.hpp"
 #include "memory/physical.hpp"
+#include "scheduler.hpp"
+#include "smp.hpp"
 #include "utils.hpp"
 #include "vfs/vfs.hpp"
 
 namespace cosmos::task {
-    constexpr uint64_t USER_STACK_BOTTOM = (memory::virt::LOWER_HALF_END - USER_STACK_SIZE);
-    constexpr uint64_t USER_STACK_BOTTOM_PAGE = USER_STACK_BOTTOM / 4096ul;
-
     static stl::FixedList<Process*, 256, nullptr> processes = {};
 
+    static memory::cache::Cache* process_cache = nullptr;
+
+    /// New processes start with the kernel lock held by the CPU which switched to them, user-land runs without it
+    extern "C" void user_entry_unlock() {
+        smp::unlock_kernel();
+    }
+
     __attribute__((naked)) void user_entry_stub() {
-        asm volatile("swapgs; iretq");
+        asm volatile(R"(
+            # Keep the stack aligned for the call
+            sub $8, %rsp
+            call user_entry_unlock
+            add $8, %rsp
+
+            swapgs
+            iretq
+        )");
     }
 
-    static stl::Optional<uint64_t> alloc_user_stack() {
-        const auto phys = memory::phys::alloc_pages(USER_STACK_SIZE / 4096ul);
+    struct UserStack {
+        uint64_t phys;
+        uint64_t page_count;
+        uint64_t rsp;
+    };
 
-        if (phys == 0) {
-            ERROR("Failed to allocate memory for user stack");
-            return {};
+    static uint64_t get_strings_size(const stl::Span<const char*> strings) {
+        uint64_t size = 0;
+
+        for (auto i = 0u; i < strings.size; i++) {
+            size += stl::align_up(static_cast<uint64_t>(utils::strlen(strings[i]) + 1), sizeof(uint64_t));
         }
 
-        return phys;
+        return size;
     }
 
-    static void free_user_stack(const uint64_t phys) {
-        memory::phys::free_pages(phys / 4096ul, USER_STACK_SIZE / 4096ul);
-    }
+    /// Only allocates the pages needed for the arguments and environment variables, the rest of the stack is populated on demand
+    static stl::Optional<UserStack> setup_user_stack(const stl::Span<const char*> args, const stl::Span<const char*> env) {
+#define GET_USER_STACK_PTR(ptr) (memory::virt::LOWER_HALF_END - ((phys + stack_size) - (ptr - memory::virt::DIRECT_MAP)))
 
-    static bool map_user_stack(const memory::virt::Space space, const uint64_t phys) {
-        constexpr auto flags = memory::virt::Flags::Write | memory::virt::Flags::User;
-        const auto status = memory::virt::map_pages(space, USER_STACK_BOTTOM_PAGE, phys / 4096ul, USER_STACK_SIZE / 4096ul, flags);
+        // Allocate pages, the pointers need at most 2 additional slots for alignment
+        const auto pointers_size = (env.size + 1 + args.size + 1 + 1 + 2) * sizeof(uint64_t);
+        const auto page_count = stl::ceil_div(get_strings_size(args) + get_strings_size(env) + pointers_size, 4096ul);
+        const auto stack_size = page_count * 4096ul;
 
-        if (!status) {
-            ERROR("Failed to map memory for user stack");
-            memory::phys::free_pages(phys / 4096ul, USER_STACK_SIZE / 4096ul);
-        }
+        const auto phys = memory::phys::alloc_pages(page_count);
 
-        return status;
-    }
+        if (phys == 0) {
+            ERROR("Failed to allocate memory for user stack");
+            return {};
+        }
 
-    static uint64_t setup_user_stack(const uint64_t phys, const stl::Span<const char*> args, const stl::Span<const char*> env) {
-#define GET_USER_STACK_PTR(ptr) (memory::virt::LOWER_HALF_END - ((phys + USER_STACK_SIZE) - (ptr - memory::virt::DIRECT_MAP)))
+        utils::memset(reinterpret_cast<void*>(memory::virt::DIRECT_MAP + phys), 0, stack_size);
 
-        auto stack = reinterpret_cast<uint64_t*>(memory::virt::DIRECT_MAP + phys + USER_STACK_SIZE);
+        auto stack = reinterpret_cast<uint64_t*>(memory::virt::DIRECT_MAP + phys + stack_size);
 
         // Copy arguments to stack
         const auto args_ptrs = memory::heap::alloc_array<uint64_t>(args.size);
@@ -107,11 +128,41 @@ namespace cosmos::task {
         memory::heap::free(args_ptrs);
 
         // Return RSP (top of stack)
-        return GET_USER_STACK_PTR(reinterpret_cast<uint64_t>(stack));
+        return UserStack{ phys, page_count, GET_USER_STACK_PTR(reinterpret_cast<uint64_t>(stack)) };
 
 #undef GET_USER_STACK_PTR
     }
 
+    static bool map_user_stack(const memory::virt::Space space, RegionTree& regions, const UserStack& stack) {
+        constexpr auto flags = memory::virt::Flags::Write | memory::virt::Flags::User;
+        const auto start = memory::virt::LOWER_HALF_END - stack.page_count * 4096ul;
+
+        if (!memory::virt::map_pages(space, start / 4096ul, stack.phys / 4096ul, stack.page_count, flags)) {
+            ERROR("Failed to map memory for user stack");
+            memory::phys::free_pages(stack.phys / 4096ul, stack.page_count);
+            return false;
+        }
+
+        // The stack grows downwards from the already mapped pages
+        const auto region = Region{
+            .start = start,
+            .end = memory::virt::LOWER_HALF_END,
+            .flags = flags,
+            .type = RegionType::Stack,
+            .file = nullptr,
+            .file_offset = 0,
+            .data_start = 0,
+            .data_size = 0,
+        };
+
+        return add_region(regions, region);
+    }
+
+    void init_processes() {
+        process_cache = memory::cache::create<Process>("process");
+        if (process_cache == nullptr) utils::panic(nullptr, "[process] Failed to create process cache");
+    }
+
     void setup_dummy_frame(StackFrame& frame, const ProcessFn fn) {
         for (auto i = 0ul; i < 15; i++) {
             frame[i] = i;
@@ -122,41 +173,47 @@ namespace cosmos::task {
         frame.user_rsp = memory::virt::LOWER_HALF_END;
     }
 
-    void suspend(UnsuspendFn unsuspend_fn, uint64_t unsuspend_data);
-    void yield();
-
-    static bool reaper_process_unsuspend(const uint64_t has_zombie) {
-        return has_zombie != 0;
-    }
+    static WaitQueue reaper_waiters = {};
+    static bool has_zombies = false;
 
     void reaper_process() {
         for (;;) {
-            auto exited_has_refs = false;
+            wait_until(reaper_waiters, [] { return has_zombies; });
+            has_zombies = false;
 
-            for (auto it = processes.begin(); it != processes.end(); ++it) {
-                const auto process = *it;
-                if (process->state != State::Exited) continue;
+            // Destroying a thread drops its reference to the leader, which might be the last one keeping it around
+            auto destroyed = true;
+
+            while (destroyed) {
+                destroyed = false;
+
+                for (auto it = processes.begin(); it != processes.end(); ++it) {
+                    const auto process = *it;
+                    if (process->state != State::Exited || process->ref_count != 1) continue;
 
-                if (process->ref_count == 1) {
                     DEBUG("Destroying process %lu", process->id);
                     processes.remove(it);
                     process->destroy();
-                } else {
-                    exited_has_refs = true;
-                }
-            }
 
-            if (exited_has_refs) {
-                yield();
-                continue;
+                    destroyed = true;
+                }
             }
 
-            suspend(reaper_process_unsuspend, 0);
+            // Processes which are still referenced are checked again once notify_reaper is called
         }
     }
 
-    stl::Optional<ProcessId> create_process(const memory::virt::Space space, const Land land, const bool alloc_user_stack,
-                                            const StackFrame& frame, const stl::StringView cwd) {
+    void notify_reaper() {
+        const auto rflags = utils::disable_interrupts();
+
+        has_zombies = true;
+        reaper_waiters.wake_all();
+
+        utils::restore_interrupts(rflags);
+    }
+
+    stl::Optional<ProcessId> create_process(const memory::virt::Space space, const Land land, const StackFrame& frame,
+                                            const stl::StringView cwd) {
         // Allocate id
         Process** process_ptr;
         size_t index;
@@ -167,7 +224,15 @@ namespace cosmos::task {
         }
 
         // Allocate process
-        const auto process = memory::heap::alloc<Process>();
+        const auto process = memory::cache::alloc<Process>(process_cache);
+
+        if (process == nullptr) {
+            ERROR("Failed to allocate memory for process");
+
+            processes.remove_at(index);
+            return {};
+        }
+
         *process_ptr = process;
 
         process->id = index;
@@ -182,13 +247,24 @@ namespace cosmos::task {
 
         process->space = space;
 
-        process->unsuspend_fn = nullptr;
-        process->unsuspend_data = 0;
+        process->leader = process;
+        process->thread_count = 0;
+        process->fs_base = 0;
+
+        process->time_slice = DEFAULT_TIME_SLICE;
+        process->slice_remaining = 0;
+        process->cpu_time = 0;
+
+        process->nice = 0;
+        process->weight = NICE_0_WEIGHT;
+        process->vruntime = 0;
 
-        process->event_files = nullptr;
-        process->event_count = 0;
+        process->enqueued = false;
+        process->queue_cpu = 0;
+        process->exit_waiters = {};
 
         process->fd_table = {};
+        process->regions = {};
 
         // Allocate kernel stack
         process->kernel_stack = memory::heap::alloc(KERNEL_STACK_SIZE, 16);
@@ -197,41 +273,30 @@ namespace cosmos::task {
             ERROR("Failed to allocate memory for kernel stack");
 
             processes.remove(process);
-            memory::heap::free(process);
+            memory::cache::free(process_cache, process);
 
             return {};
         }
 
         process->kernel_stack_rsp = 0;
 
-        // Allocate user stack
-        if (land == Land::User) {
-            if (alloc_user_stack) {
-                const auto phys = task::alloc_user_stack();
-
-                if (phys.is_empty()) {
-                    memory::heap::free(process->kernel_stack);
-                    processes.remove(process);
-                    memory::heap::free(process);
+        // Allocate FPU state, the kernel never touches those registers
+        process->fpu_area = nullptr;
 
-                    return {};
-                }
+        if (land == Land::User) {
+            process->fpu_area = memory::heap::alloc(fpu::get_area_size(), fpu::AREA_ALIGNMENT);
 
-                if (!map_user_stack(process->space, phys.value())) {
-                    free_user_stack(phys.value());
-                    memory::heap::free(process->kernel_stack);
-                    processes.remove(process);
-                    memory::heap::free(process);
+            if (process->fpu_area == nullptr) {
+                ERROR("Failed to allocate memory for FPU state");
 
-                    return {};
-                }
+                memory::heap::free(process->kernel_stack);
+                processes.remove(process);
+                memory::cache::free(process_cache, process);
 
-                process->user_stack_phys = phys.value();
-            } else {
-                process->user_stack_phys = memory::virt::get_phys(USER_STACK_BOTTOM);
+                return {};
             }
-        } else {
-            process->user_stack_phys = 0;
+
+            fpu::reset(process->fpu_area);
         }
 
         // Setup kernel stack
@@ -274,7 +339,7 @@ namespace cosmos::task {
         setup_dummy_frame(frame, fn);
 
         // Create process
-        const auto pid = create_process(space, land, true, frame, cwd);
+        const auto pid = create_process(space, land, frame, cwd);
         if (pid.is_empty()) memory::virt::destroy(space);
 
         return pid;
@@ -297,10 +362,19 @@ namespace cosmos::task {
             return {};
         }
 
+        // Setup user stack
+        const auto stack = setup_user_stack(args, env);
+
+        if (stack.is_empty()) {
+            memory::heap::free(binary);
+            return {};
+        }
+
         // Create address space
         const auto space = memory::virt::create();
 
         if (space == 0) {
+            memory::phys::free_pages(stack.value().phys / 4096ul, stack.value().page_count);
             memory::heap::free(binary);
             return {};
         }
@@ -308,10 +382,12 @@ namespace cosmos::task {
         // Setup stack frame
         StackFrame frame;
         setup_dummy_frame(frame, reinterpret_cast<ProcessFn>(binary->virt_entry));
+        frame.user_rsp = stack.value().rsp;
 
         // Create process
-        const auto pid = create_process(space, Land::User, true, frame, cwd);
+        const auto pid = create_process(space, Land::User, frame, cwd);
         if (pid.is_empty()) {
+            memory::phys::free_pages(stack.value().phys / 4096ul, stack.value().page_count);
             memory::virt::destroy(space);
             memory::heap::free(binary);
             return {};
@@ -320,11 +396,16 @@ namespace cosmos::task {
         DEBUG("Creating process %lu for file %s", pid.value(), path.data());
         const auto process = get_process(pid.value());
 
-        // Setup user stack
-        frame.user_rsp = setup_user_stack(process->user_stack_phys, args, env);
+        // Map user stack and clock page, a process which never ran is handed to the reaper on failure
+        if (!map_user_stack(process->space, process->regions, stack.value()) || !clock::map_page(process->space)) {
+            process->exit(0xFFFFFFFF);
+            memory::heap::free(binary);
+            return {};
+        }
 
         // Load ELF binary
-        if (!elf::load(process->space, file, binary)) {
+        if (!elf::load(process->regions, file, binary)) {
+            process->exit(0xFFFFFFFF);
             memory::heap::free(binary);
             return {};
         }
@@ -360,7 +441,7 @@ namespace cosmos::task {
     }
 
     stl::Optional<uint32_t> Process::add_fd(const stl::Rc<vfs::File>& file) {
-        const auto index = fd_table.add(file.ref());
+        const auto index = leader->fd_table.add(file.ref());
 
         if (index == -1) {
             file.deref();
@@ -370,20 +451,20 @@ namespace cosmos::task {
     }
 
     bool Process::set_fd(const stl::Rc<vfs::File>& file, const uint32_t fd) {
-        if (fd >= fd_table.capacity()) return false;
+        if (fd >= leader->fd_table.capacity()) return false;
 
         remove_fd(fd);
-        fd_table.set(fd, file.ref());
+        leader->fd_table.set(fd, file.ref());
 
         return true;
     }
 
     stl::Rc<vfs::File> Process::get_file(const uint32_t fd) const {
-        return fd_table.get(fd);
+        return leader->fd_table.get(fd);
     }
 
     stl::Rc<vfs::File> Process::remove_fd(const uint32_t fd) {
-        const auto file = stl::Rc(fd_table.remove_at(fd));
+        const auto file = stl::Rc(leader->fd_table.remove_at(fd));
 
         if (file.valid()) {
             file.deref();
@@ -398,22 +479,43 @@ namespace cosmos::task {
             return {};
         }
 
+        // Fork regions
+        RegionTree new_regions = {};
+
+        if (!copy_regions(leader->regions, new_regions)) {
+            clear_regions(new_regions);
+            return {};
+        }
+
         // Fork address space
         const auto new_space = memory::virt::fork(space);
-        if (new_space == 0) return {};
+
+        if (new_space == 0) {
+            clear_regions(new_regions);
+            return {};
+        }
 
         // Create process
-        const auto pid = create_process(new_space, land, false, frame, cwd);
+        const auto pid = create_process(new_space, land, frame, leader->cwd);
 
         if (pid.is_empty()) {
+            clear_regions(new_regions);
             memory::virt::destroy(new_space);
             return {};
         }
 
         const auto process = get_process(pid.value());
+        process->regions = new_regions;
+        process->fs_base = fs_base;
+
+        process->nice = nice;
+        process->weight = weight;
+
+        // The registers still hold the current state of this process
+        fpu::save(process->fpu_area);
 
         // Duplicate file descriptors
-        for (auto it = fd_table.begin(); it != fd_table.end(); ++it) {
+        for (auto it = leader->fd_table.begin(); it != leader->fd_table.end(); ++it) {
             const auto file = stl::Rc(*it);
             process->fd_table.set(it.index, file.ref());
         }
@@ -428,6 +530,11 @@ namespace cosmos::task {
             return {};
         }
 
+        if (leader != this || thread_count != 0) {
+            ERROR("Can only execute binaries in processes without threads");
+            return {};
+        }
+
         // Open file
         const auto binary_file = vfs::open(path, vfs::Mode::Read, vfs::FileFlags::CloseOnExecute);
 
@@ -443,34 +550,28 @@ namespace cosmos::task {
             return {};
         }
 
-        // Allocate user stack
-        const auto stack_phys = alloc_user_stack();
+        // Setup user stack, arguments still point into the current address space
+        const auto stack = setup_user_stack(args, env);
 
-        if (stack_phys.is_empty()) {
-            ERROR("Failed to allocate memory for user stack");
+        if (stack.is_empty()) {
             memory::heap::free(binary);
             return {};
         }
 
-        user_stack_phys = stack_phys.value();
-
-        // Setup user stack
-        const auto rsp = setup_user_stack(user_stack_phys, args, env);
-
         // Clear address space
+        unmap_regions(space, regions, 0, memory::virt::LOWER_HALF_END);
+
         memory::virt::clear(space);
         memory::virt::switch_to(space);
 
-        // Map user stack
-        if (!map_user_stack(space, user_stack_phys)) {
-            free_user_stack(user_stack_phys);
+        // Map user stack and clock page
+        if (!map_user_stack(space, regions, stack.value()) || !clock::map_page(space)) {
             memory::heap::free(binary);
             return {};
         }
 
         // Load ELF binary
-        if (!elf::load(space, binary_file, binary)) {
-            free_user_stack(user_stack_phys);
+        if (!elf::load(regions, binary_file, binary)) {
             memory::heap::free(binary);
             return {};
         }
@@ -490,7 +591,101 @@ namespace cosmos::task {
             }
         }
 
-        return EntryPoint{ rip, rsp };
+        // Thread local storage of the old binary is gone
+        fs_base = 0;
+        utils::msr_write(utils::MSR_FS_BASE, 0);
+
+        // Neither may the SIMD state of the old binary
+        fpu::reset(fpu_area);
+        fpu::restore(fpu_area);
+
+        return EntryPoint{ rip, stack.value().rsp };
+    }
+
+    stl::Optional<ProcessId> Process::spawn(const stl::StringView path, const stl::Span<const char*> args, const stl::Span<const char*> env,
+                                            const stl::Span<SpawnAction> actions) const {
+        if (land != Land::User) {
+            ERROR("Can only spawn from user-land processes");
+            return {};
+        }
+
+        // Create process
+        const auto pid = create_process(path, args, env, leader->cwd);
+        if (pid.is_empty()) return {};
+
+        const auto process = get_process(pid.value());
+
+        process->nice = nice;
+        process->weight = weight;
+
+        // Duplicate file descriptors
+        for (auto it = leader->fd_table.begin(); it != leader->fd_table.end(); ++it) {
+            const auto file = stl::Rc(*it);
+            process->fd_table.set(it.index, file.ref());
+        }
+
+        // Apply actions
+        for (const auto& action : actions) {
+            auto result = false;
+
+            switch (action.op) {
+            case SpawnOp::Duplicate: {
+                const auto file = process->get_file(action.fd);
+                result = file.valid() && (action.fd == action.new_fd || process->set_fd(file, action.new_fd));
+                break;
+            }
+            case SpawnOp::Close:
+                result = process->remove_fd(action.fd).valid();
+                break;
+            }
+
+            if (!result) {
+                process->exit(0xFFFFFFFF);
+                return {};
+            }
+        }
+
+        // Close files with CloseOnExecute
+        for (auto it = process->fd_table.begin(); it != process->fd_table.end(); ++it) {
+            const auto file = *it;
+
+            if (file->flags / vfs::FileFlags::CloseOnExecute) {
+                stl::Rc(process->fd_table.remove(it)).deref();
+            }
+        }
+
+        return process->id;
+    }
+
+    // ReSharper disable once CppParameterNamesMismatch
+    stl::Optional<ProcessId> Process::create_thread(const uint64_t entry, const uint64_t stack, const uint64_t arg,
+                                                    const uint64_t fs_base_) const {
+        if (land != Land::User) {
+            ERROR("Can only create threads in user-land processes");
+            return {};
+        }
+
+        // Setup stack frame
+        StackFrame frame;
+        setup_dummy_frame(frame, reinterpret_cast<ProcessFn>(entry));
+        frame.user_rsp = stack;
+        frame.rdi = arg;
+
+        // Create process sharing the space
+        const auto pid = create_process(space, Land::User, frame, leader->cwd);
+        if (pid.is_empty()) return {};
+
+        const auto thread = get_process(pid.value());
+
+        thread->leader = stl::Rc(leader).ref();
+        thread->fs_base = fs_base_;
+
+        thread->nice = nice;
+        thread->weight = weight;
+
+        leader->thread_count++;
+
+        return thread->id;
     }
 
     // ReSharper disable once CppParameterNamesMismatch
@@ -498,17 +693,39 @@ namespace cosmos::task {
         state = State::Exited;
         status = status_;
 
-        for (const auto file : fd_table) {
-            stl::Rc(file).deref();
+        exit_waiters.wake_all();
+
+        // Joining the leader waits for its threads as well
+        if (leader != this) {
+            leader->thread_count--;
+            leader->exit_waiters.wake_all();
         }
+
+        if (leader->finished()) {
+            for (const auto file : leader->fd_table) {
+                stl::Rc(file).deref();
+            }
+
+            leader->fd_table = {};
+        }
+
+        notify_reaper();
     }
 
     void Process::destroy() {
+        // Threads only drop their reference, the space and regions belong to the leader
+        if (leader == this) {
+            unmap_regions(space, regions, 0, memory::virt::LOWER_HALF_END);
+            memory::virt::destroy(space);
+        } else {
+            stl::Rc(leader).deref();
+        }
+
         memory::heap::free(const_cast<char*>(cwd.data()));
-        memory::virt::destroy(space);
         memory::heap::free(kernel_stack);
+        if (fpu_area != nullptr) memory::heap::free(fpu_area);
 
         processes.remove_at(id);
-        memory::heap::free(this);
+        memory::cache::free(process_cache, this);
     }
 } // namespace cosmos::task
@@ -1,15 +1,26 @@
 #pragma once
 
 #include "memory/virtual.hpp"
+#include "region.hpp"
 #include "stl/fixed_list.hpp"
 #include "stl/optional.hpp"
+#include "stl/rb_tree.hpp"
 #include "stl/rc.hpp"
 #include "stl/span.hpp"
 #include "vfs/types.hpp"
+#include "wait_queue.hpp"
 
 namespace cosmos::task {
     constexpr uint64_t KERNEL_STACK_SIZE = 4ul * 1024ul;
+    /// Maximum size the user stack can grow to, it is populated on demand
     constexpr uint64_t USER_STACK_SIZE = 64ul * 1024ul;
+    /// Milliseconds a process runs before the timer preempts it in favour of the next runnable one
+    constexpr uint32_t DEFAULT_TIME_SLICE = 10;
+
+    /// Nice values range from MIN_NICE to MAX_NICE, lower values get a larger share of the CPU
+    constexpr int32_t MIN_NICE = -20;
+    constexpr int32_t MAX_NICE = 19;
+    constexpr uint32_t NICE_0_WEIGHT = 1024;
 
     using ProcessFn = void (*)();
     using ProcessId = uint32_t;
@@ -17,6 +28,7 @@ namespace cosmos::task {
     enum class State : uint8_t {
         Waiting,
         Running,
+        /// Parked on wait queues, off the run queues until woken
         Suspended,
         Exited,
     };
@@ -42,9 +54,22 @@ namespace cosmos::task {
         uint64_t rip, rsp;
     };
 
-    using UnsuspendFn = bool (*)(uint64_t);
+    enum class SpawnOp : uint32_t {
+        /// Makes new_fd refer to the file of fd
+        Duplicate,
+        /// Closes fd
+        Close,
+    };
 
-    struct Process {
+    /// Change to the file descriptors a spawned process inherits, applied in order before files with CloseOnExecute are closed
+    struct SpawnAction {
+        SpawnOp op;
+        uint32_t fd;
+        uint32_t new_fd;
+    };
+
+    /// Links into the run queue of a CPU while waiting to run, ordered by virtual runtime
+    struct Process : stl::RbNode {
         ProcessId id;
         size_t ref_count;
 
@@ -55,16 +80,43 @@ namespace cosmos::task {
 
         memory::virt::Space space;
 
+        /// Owns the regions, file descriptors and cwd, points to the process itself unless it is a thread created with create_thread.
+        /// Threads share the space of their leader and keep a reference to it.
+        Process* leader;
+        /// Threads of the leader which did not exit yet, always 0 for threads
+        uint32_t thread_count;
+
+        /// Loaded into FS_BASE when switching to the process, user-land uses it for thread local storage
+        uint64_t fs_base;
+
         void* kernel_stack;
         uint64_t kernel_stack_rsp;
 
-        uint64_t user_stack_phys;
+        /// x87, SSE and AVX registers saved while the process is not running, nullptr for kernel-land processes
+        void* fpu_area;
+
+        RegionTree regions;
+
+        /// Time slice in milliseconds and how much of it is left, refilled whenever the process is switched to
+        uint32_t time_slice;
+        uint32_t slice_remaining;
+
+        /// Milliseconds spent running
+        uint64_t cpu_time;
 
-        UnsuspendFn unsuspend_fn;
-        uint64_t unsuspend_data;
+        int32_t nice;
+        /// Share of the CPU derived from the nice value, a weight of NICE_0_WEIGHT is charged in real time
+        uint32_t weight;
+        /// Microseconds spent running scaled by the weight, the process with the lowest one runs next
+        uint64_t vruntime;
 
-        const stl::Rc<vfs::File>* event_files;
-        uint32_t event_count;
+        /// Set from the first enqueue until the scheduler saw the process exit, the run queues hold a reference meanwhile
+        bool enqueued;
+        /// CPU whose queue the virtual runtime is relative to, the process is only linked into it while waiting to run
+        uint32_t queue_cpu;
+
+        /// Woken when the process exits
+        WaitQueue exit_waiters;
 
         stl::StringView cwd;
 
@@ -83,18 +135,36 @@ namespace cosmos::task {
 
         stl::Optional<EntryPoint> execute(stl::StringView path, stl::Span<const char*> args, stl::Span<const char*> env);
 
+        /// Same as a fork followed by an execute in the child, but the child starts with a fresh address space instead of a copy
+        stl::Optional<ProcessId> spawn(stl::StringView path, stl::Span<const char*> args, stl::Span<const char*> env,
+                                       stl::Span<SpawnAction> actions) const;
+
+        /// Creates a thread of the leader which starts at entry with arg in RDI and stack as its stack pointer
+        stl::Optional<ProcessId> create_thread(uint64_t entry, uint64_t stack, uint64_t arg, uint64_t fs_base) const;
+
+        /// Shared resources of the leader are only released once it and all of its threads exited
+        bool finished() const {
+            return state == State::Exited && thread_count == 0;
+        }
+
         void exit(uint64_t status);
 
         void destroy();
     };
 
+    /// Creates the process cache, has to be called before any process is created
+    void init_processes();
+
     void setup_dummy_frame(StackFrame& frame, ProcessFn fn);
 
     [[noreturn]]
     void reaper_process();
 
-    stl::Optional<ProcessId> create_process(memory::virt::Space space, Land land, bool alloc_user_stack, const StackFrame& frame,
-                                            stl::StringView cwd);
+    /// Exited processes are only destroyed once nothing but the process list references them.
+    /// Called after dropping a reference which might have been the last one, so that the reaper checks again.
+    void notify_reaper();
+
+    stl::Optional<ProcessId> create_process(memory::virt::Space space, Land land, const StackFrame& frame, stl::StringView cwd);
 
     stl::Optional<ProcessId> create_process(ProcessFn fn, Land land, stl::StringView cwd);
 
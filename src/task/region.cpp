@@ -0,0 +1,277 @@
+#include "region.hpp"
+
+#include "log/log.hpp"
+#include "memory/cache.hpp"
+#include "memory/offsets.hpp"
+#include "memory/physical.hpp"
+#include "process.hpp"
+#include "stl/utils.hpp"
+#include "utils.hpp"
+#include "vfs/vfs.hpp"
+
+namespace cosmos::task {
+    static memory::cache::Cache* region_cache = nullptr;
+
+    static Region* alloc_region(const Region& region) {
+        const auto item = memory::cache::alloc<Region>(region_cache);
+
+        if (item == nullptr) {
+            ERROR("Failed to allocate memory for region");
+            return nullptr;
+        }
+
+        *item = region;
+        return item;
+    }
+
+    static void free_region(RegionTree& regions, Region* region) {
+        if (region->file != nullptr) stl::Rc(region->file).deref();
+
+        regions.remove(region);
+        memory::cache::free(region_cache, region);
+    }
+
+    /// Regions never overlap so they are ordered by their end as well
+    static Region* find_first_ending_after(const RegionTree& regions, const uint64_t addr) {
+        return regions.find_first([addr](const Region& region) { return region.end > addr; });
+    }
+
+    static bool overlaps(const RegionTree& regions, const uint64_t start, const uint64_t end) {
+        const auto region = find_first_ending_after(regions, start);
+        return region != nullptr && region->start < end;
+    }
+
+    /// The region keeps the part below the address
+    /// @return region containing the part above the address
+    static Region* split_region(RegionTree& regions, Region* region, const uint64_t addr) {
+        const auto upper = alloc_region(*region);
+        if (upper == nullptr) return nullptr;
+
+        // Only the lowest part of a stack can grow
+        if (upper->type == RegionType::Stack) upper->type = RegionType::Anonymous;
+        if (upper->file != nullptr) stl::Rc(upper->file).ref();
+
+        upper->start = addr;
+        region->end = addr;
+
+        regions.insert(upper);
+        return upper;
+    }
+
+    static bool is_shared_file(const Region* region) {
+        return region->type == RegionType::File && region->flags / memory::virt::Flags::Shared;
+    }
+
+    static bool fill_from_file(const Region* region, const uint64_t page_addr, uint8_t* page) {
+        const auto start = stl::max(page_addr, region->data_start);
+        const auto end = stl::min(page_addr + 4096ul, region->data_start + region->data_size);
+        if (start >= end) return true;
+
+        // The file can also be used through a file descriptor so its cursor is left alone
+        const auto file = stl::Rc(region->file);
+        const auto read = vfs::read_at(file, page + (start - page_addr), end - start, region->file_offset + (start - region->data_start));
+
+        // Bytes past the end of the file stay zero
+        return read <= end - start;
+    }
+
+    static void write_back(const memory::virt::Space space, const Region* region) {
+        const auto file = stl::Rc(region->file);
+        const auto cursor = file->ops->seek(file, vfs::SeekType::Current, 0);
+
+        // Shared mappings never grow the file
+        const auto file_size = file->ops->seek(file, vfs::SeekType::End, 0);
+        file->ops->seek(file, vfs::SeekType::Start, static_cast<int64_t>(cursor));
+        const auto file_data_size = file_size > region->file_offset ? file_size - region->file_offset : 0;
+        const auto data_end = region->data_start + stl::min(region->data_size, file_data_size);
+
+        for (auto page_addr = region->start; page_addr < region->end; page_addr += 4096ul) {
+            const auto phys = memory::virt::clear_dirty(space, page_addr);
+            if (phys == 0) continue;
+
+            const auto start = stl::max(page_addr, region->data_start);
+            const auto end = stl::min(page_addr + 4096ul, data_end);
+            if (start >= end) continue;
+
+            const auto page = reinterpret_cast<const uint8_t*>(memory::virt::DIRECT_MAP + phys);
+
+            const auto offset = region->file_offset + (start - region->data_start);
+
+            if (vfs::write_at(file, page + (start - page_addr), end - start, offset) != end - start) {
+                ERROR("Failed to write back shared mapping page at 0x%llx", page_addr);
+            }
+        }
+    }
+
+    static bool populate_page(const memory::virt::Space space, const Region* region, const uint64_t page_addr) {
+        const auto phys = memory::phys::alloc_pages(1);
+
+        if (phys == 0) {
+            ERROR("Failed to allocate memory for page at 0x%llx", page_addr);
+            return false;
+        }
+
+        const auto page = reinterpret_cast<uint8_t*>(memory::virt::DIRECT_MAP + phys);
+        utils::memset(page, 0, 4096);
+
+        if (region->type == RegionType::File && !fill_from_file(region, page_addr, page)) {
+            ERROR("Failed to read file data for page at 0x%llx", page_addr);
+            memory::phys::free_pages(phys / 4096ul, 1);
+            return false;
+        }
+
+        if (!memory::virt::map_pages(space, page_addr / 4096ul, phys / 4096ul, 1, region->flags)) {
+            memory::phys::free_pages(phys / 4096ul, 1);
+            return false;
+        }
+
+        return true;
+    }
+
+    // Header
+
+    void init_regions() {
+        region_cache = memory::cache::create<Region>("region");
+        if (region_cache == nullptr) utils::panic(nullptr, "[region] Failed to create region cache");
+    }
+
+    bool add_region(RegionTree& regions, const Region& region) {
+        if (region.start >= region.end || memory::virt::is_invalid_user(region.end - 1)) {
+            ERROR("Invalid region 0x%llx - 0x%llx", region.start, region.end);
+            return false;
+        }
+
+        if (overlaps(regions, region.start, region.end)) {
+            ERROR("Region 0x%llx - 0x%llx overlaps an existing one", region.start, region.end);
+            return false;
+        }
+
+        const auto item = alloc_region(region);
+        if (item == nullptr) return false;
+
+        regions.insert(item);
+        return true;
+    }
+
+    Region* find_region(const RegionTree& regions, const uint64_t addr) {
+        const auto region = find_first_ending_after(regions, addr);
+        return region != nullptr && region->start <= addr ? region : nullptr;
+    }
+
+    uint64_t find_free_range(const RegionTree& regions, const uint64_t size) {
+        auto start = MAP_BASE;
+
+        for (auto region = find_first_ending_after(regions, start); region != nullptr; region = RegionTree::next(region)) {
+            if (region->start >= start + size) break;
+            start = region->end;
+        }
+
+        // Leave room for the stack to grow
+        if (start + size > memory::virt::LOWER_HALF_END - USER_STACK_SIZE) return 0;
+
+        return start;
+    }
+
+    bool copy_regions(const RegionTree& src, RegionTree& dst) {
+        for (auto it = src.begin(); it != RegionTree::end(); ++it) {
+            const auto item = alloc_region(**it);
+            if (item == nullptr) return false;
+
+            if (item->file != nullptr) stl::Rc(item->file).ref();
+            dst.insert(item);
+        }
+
+        return true;
+    }
+
+    void clear_regions(RegionTree& regions) {
+        while (!regions.empty()) {
+            free_region(regions, regions.first());
+        }
+    }
+
+    bool unmap_regions(const memory::virt::Space space, RegionTree& regions, const uint64_t start, const uint64_t end) {
+        auto region = find_first_ending_after(regions, start);
+
+        while (region != nullptr && region->start < end) {
+            // Split off the parts outside of the range
+            if (region->start < start) {
+                region = split_region(regions, region, start);
+                if (region == nullptr) return false;
+            }
+
+            if (region->end > end && split_region(regions, region, end) == nullptr) return false;
+
+            // Unmap
+            if (is_shared_file(region)) write_back(space, region);
+            memory::virt::unmap_pages(space, region->start / 4096ul, (region->end - region->start) / 4096ul);
+
+            const auto next = RegionTree::next(region);
+            free_region(regions, region);
+            region = next;
+        }
+
+        return true;
+    }
+
+    bool protect_regions(const memory::virt::Space space, RegionTree& regions, const uint64_t start, const uint64_t end,
+                         const memory::virt::Flags flags) {
+        // Check the whole range is covered first so that nothing is changed on failure
+        auto covered = start;
+
+        for (auto region = find_first_ending_after(regions, start); covered < end; region = RegionTree::next(region)) {
+            if (region == nullptr || region->start > covered) return false;
+
+            if ((flags / memory::virt::Flags::Write) && is_shared_file(region) && !vfs::is_write(region->file->mode)) {
+                ERROR("Shared mapping of a file not opened for writing can't be made writable");
+                return false;
+            }
+
+            covered = region->end;
+        }
+
+        // Protect
+        auto region = find_first_ending_after(regions, start);
+
+        while (region != nullptr && region->start < end) {
+            if (region->start < start) {
+                region = split_region(regions, region, start);
+                if (region == nullptr) return false;
+            }
+
+            if (region->end > end && split_region(regions, region, end) == nullptr) return false;
+
+            region->flags = flags | (region->flags & memory::virt::Flags::Shared);
+            memory::virt::protect_pages(space, region->start / 4096ul, (region->end - region->start) / 4096ul, region->flags);
+
+            region = RegionTree::next(region);
+        }
+
+        return true;
+    }
+
+    bool handle_region_fault(const memory::virt::Space space, RegionTree& regions, const uint64_t addr, const bool present,
+                             const bool write) {
+        const auto page_addr = stl::align_down(addr, 4096ul);
+
+        const auto region = find_first_ending_after(regions, addr);
+        if (region == nullptr) return false;
+
+        // Grow the stack downwards
+        if (addr < region->start) {
+            if (region->type != RegionType::Stack || region->end - page_addr > USER_STACK_SIZE) return false;
+
+            const auto prev = RegionTree::prev(region);
+            if (prev != nullptr && prev->end > page_addr) return false;
+
+            region->start = page_addr;
+        }
+
+        // Regions without the User flag were protected with Protection::None
+        if (!(region->flags / memory::virt::Flags::User)) return false;
+        if (write && !(region->flags / memory::virt::Flags::Write)) return false;
+
+        if (present) return write && memory::virt::resolve_copy_on_write(space, addr);
+        return populate_page(space, region, page_addr);
+    }
+} // namespace cosmos::task
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "memory/virtual.hpp"
+#include "stl/bit_field.hpp"
+#include "stl/rb_tree.hpp"
+#include "vfs/types.hpp"
+
+namespace cosmos::task {
+    /// Mappings without a fixed address are placed from here upwards
+    constexpr uint64_t MAP_BASE = 0x0000100000000000;
+
+    enum class Protection : uint8_t {
+        None = 0,
+        Read = 1 << 0,
+        Write = 1 << 1,
+        Execute = 1 << 2,
+    };
+    ENUM_BIT_FIELD(Protection)
+
+    enum class MapFlags : uint8_t {
+        None = 0,
+        Shared = 1 << 0,
+        Private = 1 << 1,
+        Fixed = 1 << 4,
+        Anonymous = 1 << 5,
+    };
+    ENUM_BIT_FIELD(MapFlags)
+
+    enum class RegionType : uint8_t {
+        /// Zero filled on first access
+        Anonymous,
+        /// Zero filled on first access and grows downwards on faults below it, up to USER_STACK_SIZE
+        Stack,
+        /// Filled from a file on first access, bytes past the file data are zero filled
+        File,
+    };
+
+    /// Range of user virtual memory which is populated page by page on demand
+    struct Region : stl::RbNode {
+        /// Page aligned
+        uint64_t start;
+        uint64_t end;
+
+        /// Regions without the User flag are not accessible, shared File regions are written back to the file when unmapped
+        memory::virt::Flags flags;
+        RegionType type;
+
+        /// Holds a reference for File regions
+        vfs::File* file;
+        uint64_t file_offset;
+
+        /// Virtual address range the file data is placed at
+        uint64_t data_start;
+        uint64_t data_size;
+    };
+
+    struct RegionLess {
+        bool operator()(const Region& a, const Region& b) const {
+            return a.start < b.start;
+        }
+    };
+
+    using RegionTree = stl::RbTree<Region, RegionLess>;
+
+    /// Creates the region cache, has to be called before any region is added
+    void init_regions();
+
+    /// Takes over the file reference of the region
+    bool add_region(RegionTree& regions, const Region& region);
+
+    Region* find_region(const RegionTree& regions, uint64_t addr);
+
+    /// @return start of a free range at or above MAP_BASE or 0
+    uint64_t find_free_range(const RegionTree& regions, uint64_t size);
+
+    /// Copies all regions, also referencing their files
+    bool copy_regions(const RegionTree& src, RegionTree& dst);
+
+    /// Frees all regions without touching the memory they cover
+    void clear_regions(RegionTree& regions);
+
+    /// Writes back shared file data and unmaps the range, regions partially inside of it are split
+    bool unmap_regions(memory::virt::Space space, RegionTree& regions, uint64_t start, uint64_t end);
+
+    /// Changes the flags of the range which needs to be fully covered by regions, regions partially inside of it are split
+    bool protect_regions(memory::virt::Space space, RegionTree& regions, uint64_t start, uint64_t end, memory::virt::Flags flags);
+
+    /// Populates the page containing the address if it belongs to a region, growing stack regions if needed.
+    /// Writes to present pages resolve copy-on-write if the region is writable.
+    bool handle_region_fault(memory::virt::Space space, RegionTree& regions, uint64_t addr, bool present, bool write);
+} // namespace cosmos::task
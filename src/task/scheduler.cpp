@@ -1,24 +1,51 @@
 #include "scheduler.hpp"
 
+#include "devices/pit.hpp"
 #include "elf/loader.hpp"
+#include "fpu.hpp"
+#include "interrupts/lapic.hpp"
 #include "log/log.hpp"
-#include "stl/linked_list.hpp"
+#include "smp.hpp"
+#include "stl/utils.hpp"
+#include "timer.hpp"
 #include "tss.hpp"
 #include "utils.hpp"
 
 namespace cosmos::task {
-    struct CpuStatus {
-        uint64_t kernel_rsp;
-        uint64_t user_rsp;
-        uint64_t current_process;
+    /// Running processes never change their virtual runtime while linked into a queue
+    struct RunQueueLess {
+        bool operator()(const Process& lhs, const Process& rhs) const {
+            return lhs.vruntime < rhs.vruntime;
+        }
+    };
+
+    /// Each CPU runs the waiting process with the lowest virtual runtime from its own queue and steals from the others once it runs out.
+    /// Running processes are not part of any queue, they are inserted again with their new virtual runtime when they yield.
+    /// The queues are only accessed with the kernel lock held.
+    struct RunQueue {
+        stl::RbTree<Process, RunQueueLess> tree;
+
+        /// Never decreases, enqueued and woken processes are placed relative to it
+        uint64_t min_vruntime;
     };
 
-    static ProcessId reaper_pid;
+    /// Weights of the nice values from MIN_NICE to MAX_NICE, each level changes the share of the CPU by about 10%
+    static constexpr uint32_t NICE_WEIGHTS[MAX_NICE - MIN_NICE + 1] = {
+        88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916, //
+        9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,  //
+        1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,   //
+        110,   87,    70,    56,    45,    36,    29,    23,    18,    15,    //
+    };
+
+    /// Woken processes may be placed this many microseconds before the minimum of the queue.
+    /// Processes which mostly wait, like the shell waiting on the keyboard, run before the ones using up their time slices.
+    constexpr uint64_t SLEEPER_CREDIT = DEFAULT_TIME_SLICE * 1000ul / 2;
 
-    static stl::LinkedList<ProcessId> process_queue = {};
-    static stl::LinkedList<ProcessId>::Iterator it = {};
+    /// A woken process preempts the running one once its virtual runtime is lower by at least this many microseconds
+    constexpr uint64_t WAKEUP_GRANULARITY = 1000;
 
-    static CpuStatus cpu_status = {};
+    static RunQueue run_queues[smp::MAX_CPUS] = {};
+    static Process* idle_processes[smp::MAX_CPUS] = {};
 
     __attribute__((naked)) void switch_to(uint64_t* old_sp, uint64_t new_sp) {
         asm volatile(R"(
@@ -69,46 +96,161 @@ namespace cosmos::task {
         )");
     }
 
-    static stl::Rc<Process> move_next() {
-        ++it;
-
-        if (it == stl::LinkedList<ProcessId>::end()) {
-            it = process_queue.begin();
-        }
+    static void switch_to_process(uint64_t* old_rsp, Process* process) {
+        const auto cpu = smp::get_current();
 
-        return get_current_process();
-    }
+        // Eagerly switch the FPU state, user-land may have touched it anywhere since the last switch
+        const auto old_process = cpu->current_process;
+        if (old_process != nullptr && old_process->fpu_area != nullptr) fpu::save(old_process->fpu_area);
+        if (process->fpu_area != nullptr) fpu::restore(process->fpu_area);
 
-    static void switch_to_process(uint64_t* old_rsp, Process* process) {
         process->state = State::Running;
+        process->slice_remaining = process->time_slice;
 
-        cpu_status.kernel_rsp = reinterpret_cast<uint64_t>(process->kernel_stack) + KERNEL_STACK_SIZE;
-        cpu_status.current_process = reinterpret_cast<uint64_t>(process);
+        cpu->kernel_rsp = reinterpret_cast<uint64_t>(process->kernel_stack) + KERNEL_STACK_SIZE;
+        cpu->current_process = process;
 
-        tss::set_rsp(0, cpu_status.kernel_rsp);
+        tss::set_rsp(cpu->index, 0, cpu->kernel_rsp);
+        utils::msr_write(utils::MSR_FS_BASE, process->fs_base);
 
         memory::virt::switch_to(process->space);
         switch_to(old_rsp, process->kernel_stack_rsp);
     }
 
-    static bool join_unsuspend(const uint64_t pid) {
-        const auto process = get_process(pid);
-        return process->state == State::Exited;
+    static void insert(const uint32_t cpu, Process* process) {
+        process->queue_cpu = cpu;
+        run_queues[cpu].tree.insert(process);
+    }
+
+    /// Virtual runtimes only compare within a queue, keeps how far the process was behind or ahead of the minimum of the old one
+    static void migrate(Process* process, const uint32_t from, const uint32_t to) {
+        if (from == to) return;
+
+        const auto lag = static_cast<int64_t>(process->vruntime - run_queues[from].min_vruntime);
+        const auto vruntime = static_cast<int64_t>(run_queues[to].min_vruntime) + lag;
+
+        process->vruntime = vruntime > 0 ? static_cast<uint64_t>(vruntime) : 0;
+    }
+
+    /// Drops the reference the run queues held on an exited process
+    static void release(Process* process) {
+        DEBUG("Process %llu exited with status %llu after %llu ms of CPU time", process->id, process->status, process->cpu_time);
+
+        process->enqueued = false;
+        stl::Rc(process).deref();
+
+        notify_reaper();
+    }
+
+    /// Takes the process with the lowest virtual runtime off the queue, exited processes are removed along the way
+    static Process* pick_next(RunQueue& queue) {
+        while (!queue.tree.empty()) {
+            const auto process = queue.tree.first();
+            queue.tree.remove(process);
+
+            if (process->state == State::Exited) {
+                release(process);
+                continue;
+            }
+
+            queue.min_vruntime = stl::max(queue.min_vruntime, process->vruntime);
+            return process;
+        }
+
+        return nullptr;
+    }
+
+    /// Takes the process with the lowest virtual runtime from the queue of another CPU.
+    /// Processes currently running on a CPU are not part of any queue so they can't be picked by another one.
+    static Process* steal(const uint32_t cpu) {
+        const auto count = smp::get_cpu_count();
+
+        for (auto i = 1u; i < count; i++) {
+            const auto other = (cpu + i) % count;
+            const auto process = pick_next(run_queues[other]);
+
+            if (process != nullptr) {
+                migrate(process, other, cpu);
+                process->queue_cpu = cpu;
+
+                return process;
+            }
+        }
+
+        return nullptr;
+    }
+
+    static bool has_runnable(const RunQueue& queue) {
+        return !queue.tree.empty();
+    }
+
+    /// Wakes an idle CPU so that it steals work from the calling one, unless the calling one is idle itself
+    static void kick_idle_cpu() {
+        const auto current = smp::get_current();
+        if (current->current_process == idle_processes[current->index]) return;
+
+        for (auto i = 0u; i < smp::get_cpu_count(); i++) {
+            const auto cpu = smp::get_cpu(i);
+
+            if (cpu != current && __atomic_load_n(&cpu->idle, __ATOMIC_RELAXED)) {
+                lapic::send_ipi(cpu->lapic_id, lapic::RESCHEDULE_IRQ);
+                break;
+            }
+        }
+    }
+
+    /// Runs whenever nothing else is runnable on the CPU.
+    /// The periodic tick only runs while the CPU has processes to run, idle CPUs sleep until an interrupt or another CPU wakes them.
+    [[noreturn]]
+    static void idle_loop() {
+        const auto cpu = smp::get_current();
+
+        for (;;) {
+            devices::pit::start_tick();
+            yield();
+
+            // Interrupts are enabled again at the end of yield, one of them might have woken a process in the meantime
+            asm volatile("cli" ::: "memory");
+            if (has_runnable(run_queues[cpu->index])) continue;
+
+            devices::pit::stop_tick();
+
+            // Other CPUs only check the flag with the kernel lock held, so they either see it or enqueued work before the yield
+            __atomic_store_n(&cpu->idle, true, __ATOMIC_RELAXED);
+            smp::unlock_kernel();
+
+            asm volatile("sti; hlt; cli" ::: "memory");
+
+            smp::lock_kernel();
+            __atomic_store_n(&cpu->idle, false, __ATOMIC_RELAXED);
+        }
     }
 
     void spawn_reaper(const memory::virt::Space space) {
         StackFrame frame;
         setup_dummy_frame(frame, reaper_process);
 
-        reaper_pid = create_process(space, Land::Kernel, false, frame, "/").value();
-        enqueue(reaper_pid);
+        const auto pid = create_process(space, Land::Kernel, frame, "/").value();
+        enqueue(pid);
     }
 
     bool enqueue(const ProcessId pid) {
         const auto process = get_process(pid);
         if (!process.valid()) return false;
 
-        *process_queue.push_back_alloc() = process.ref()->id;
+        process.ref()->enqueued = true;
+
+        // Starting at the minimum neither lets the new process starve the others nor the other way around, idle CPUs steal it if
+        // this one is busy
+        const auto rflags = utils::disable_interrupts();
+        const auto cpu = smp::get_current()->index;
+
+        process->vruntime = stl::max(process->vruntime, run_queues[cpu].min_vruntime);
+        insert(cpu, *process);
+
+        kick_idle_cpu();
+        utils::restore_interrupts(rflags);
+
         return true;
     }
 
@@ -116,138 +258,201 @@ namespace cosmos::task {
         const auto process = get_process(pid);
         if (!process.valid()) return false;
 
-        if (process_queue.remove(pid)) {
-            process.deref();
-            return true;
+        // Only waiting processes are linked into a queue
+        const auto rflags = utils::disable_interrupts();
+
+        if (process->state != State::Waiting || !process->enqueued) {
+            utils::restore_interrupts(rflags);
+            return false;
         }
 
-        return false;
+        run_queues[process->queue_cpu].tree.remove(*process);
+        process->enqueued = false;
+
+        utils::restore_interrupts(rflags);
+
+        process.deref();
+        return true;
     }
 
-    stl::Rc<Process> get_current_process() {
-        return get_process(**it);
+    bool set_nice(const ProcessId pid, const int32_t nice) {
+        if (nice < MIN_NICE || nice > MAX_NICE) return false;
+
+        const auto process = get_process(pid);
+        if (!process.valid()) return false;
+
+        // Only affects how fast the virtual runtime grows, the position in a queue is updated the next time it is inserted
+        process->nice = nice;
+        process->weight = NICE_WEIGHTS[nice - MIN_NICE];
+
+        return true;
     }
 
     stl::Optional<uint64_t> join(const ProcessId pid) {
-        const auto process = get_process(pid);
-        if (!process.valid()) return {};
+        uint64_t status;
+
+        {
+            const auto process = get_process(pid);
+            if (!process.valid()) return {};
+
+            if (*process == get_current_process()) return {};
 
-        const auto current = get_current_process();
-        if (process == current) return {};
+            wait_until(process->exit_waiters, [&process] { return process->finished(); });
 
-        suspend(join_unsuspend, pid);
+            status = process->status;
+        }
 
-        const auto status = process->status;
+        // The reference held while waiting kept the reaper from destroying the process
+        notify_reaper();
 
         return status;
     }
 
     void yield() {
-        Process* new_process_ptr = nullptr;
-        Process* old_process_ptr = nullptr;
+        asm volatile("cli" ::: "memory");
 
-        {
-            auto current = get_current_process();
+        const auto cpu = smp::get_current();
+        const auto old_process = cpu->current_process;
 
-            if (current->state == State::Running) {
-                current->state = State::Waiting;
-            }
+        cpu->preempt = false;
 
-            const auto old_process = current;
+        // The idle process is never enqueued
+        if (old_process->state == State::Running) {
+            old_process->state = State::Waiting;
+            if (old_process->enqueued) insert(cpu->index, old_process);
+        } else if (old_process->state == State::Exited && old_process->enqueued) {
+            release(old_process);
+        }
 
-            asm volatile("cli" ::: "memory");
+        auto new_process = pick_next(run_queues[cpu->index]);
+        if (new_process == nullptr) new_process = steal(cpu->index);
+        if (new_process == nullptr) new_process = idle_processes[cpu->index];
+
+        if (new_process == old_process) {
+            old_process->state = State::Running;
+            old_process->slice_remaining = old_process->time_slice;
 
-            current = move_next();
+            asm volatile("sti" ::: "memory");
+            return;
+        }
 
-            for (;;) {
-                if (current->state == State::Exited) {
-                    DEBUG("Process %llu exited with status %llu", current->id, current->status);
+        // The next process continues with the kernel lock held by this CPU, possibly resuming on a different CPU than it left from
+        const auto lock_depth = smp::get_kernel_lock_depth();
+        smp::set_kernel_lock_depth(1);
 
-                    if (process_queue.single_item()) {
-                        utils::panic(nullptr, "[scheduler] All processes exited, stopping");
-                    }
+        switch_to_process(&old_process->kernel_stack_rsp, new_process);
 
-                    const auto next = it.node->next;
-                    dequeue(current->id);
-                    it.node = next;
+        smp::set_kernel_lock_depth(lock_depth);
+        asm volatile("sti" ::: "memory");
+    }
 
-                    if (it == process_queue.end()) {
-                        it = process_queue.begin();
-                    }
+    void exit(const uint64_t status) {
+        get_current_process()->exit(status);
+        yield();
+    }
 
-                    current = get_current_process();
+    struct Sleeper {
+        Timer timer;
+        WaitQueue waiters;
+        bool expired;
+    };
 
-                    continue;
-                }
+    static void sleep_expired(Timer& timer) {
+        const auto sleeper = reinterpret_cast<Sleeper*>(timer.data);
 
-                if (current->state == State::Waiting) {
-                    break;
-                }
+        sleeper->expired = true;
+        sleeper->waiters.wake_all();
+    }
 
-                if (current->state == State::Suspended && current->unsuspend_fn(current->unsuspend_data)) {
-                    break;
-                }
+    void sleep(const uint64_t ms) {
+        Sleeper sleeper = {};
+        add_timer(sleeper.timer, ms, 0, sleep_expired, reinterpret_cast<uint64_t>(&sleeper));
 
-                if (current == old_process) {
-                    asm volatile("sti; hlt; cli" ::: "memory");
-                }
+        wait_until(sleeper.waiters, [&sleeper] { return sleeper.expired; });
+    }
 
-                current = move_next();
-            }
+    void tick() {
+        const auto cpu = smp::get_current();
+        const auto process = cpu->current_process;
 
-            if (old_process == current) {
-                asm volatile("sti" ::: "memory");
-                return;
-            }
+        if (process == nullptr) return;
+        process->cpu_time++;
 
-            if (current->state == State::Suspended) {
-                current->unsuspend_fn = nullptr;
-                current->unsuspend_data = 0;
-            }
+        // The idle process gets replaced as soon as something else becomes runnable
+        if (process == idle_processes[cpu->index]) return;
 
-            new_process_ptr = *current;
-            old_process_ptr = *old_process;
-        }
+        process->vruntime += 1000ul * NICE_0_WEIGHT / process->weight;
 
-        switch_to_process(&old_process_ptr->kernel_stack_rsp, new_process_ptr);
-        asm volatile("sti" ::: "memory");
+        if (process->slice_remaining > 0) process->slice_remaining--;
+        if (process->slice_remaining == 0) cpu->preempt = true;
     }
 
-    void exit(const uint64_t status) {
-        {
-            const auto current = get_current_process();
-            current->exit(status);
+    void preempt() {
+        if (!__atomic_load_n(&smp::get_current()->preempt, __ATOMIC_RELAXED)) return;
 
-            const auto reaper = get_process(reaper_pid);
-            reaper->unsuspend_data = 1;
-        }
+        smp::lock_kernel();
 
         yield();
-    }
+        asm volatile("cli" ::: "memory");
 
-    void suspend(const UnsuspendFn unsuspend_fn, const uint64_t unsuspend_data) {
-        const auto current = get_current_process();
+        smp::unlock_kernel();
+    }
 
-        current->state = State::Suspended;
-        current->unsuspend_fn = unsuspend_fn;
-        current->unsuspend_data = unsuspend_data;
+    void park() {
+        // Running processes are not part of a queue, yield does not insert suspended ones again
+        const auto process = smp::get_current()->current_process;
+        if (process->enqueued) process->state = State::Suspended;
 
         yield();
+        asm volatile("cli" ::: "memory");
     }
 
-    void run() {
+    void wake(Process* process) {
+        const auto rflags = utils::disable_interrupts();
+
+        if (process->state == State::Suspended) {
+            const auto cpu = smp::get_current();
+            const auto& queue = run_queues[cpu->index];
+
+            process->state = State::Waiting;
+
+            // Time spent sleeping only earns a bounded credit, enough to run before the processes using up their time slices
+            migrate(process, process->queue_cpu, cpu->index);
+
+            const auto min_vruntime = queue.min_vruntime > SLEEPER_CREDIT ? queue.min_vruntime - SLEEPER_CREDIT : 0;
+            process->vruntime = stl::max(process->vruntime, min_vruntime);
+
+            insert(cpu->index, process);
+
+            // Keeps the latency of interactive processes low while the CPU is busy
+            const auto current = cpu->current_process;
+
+            if (current != nullptr && current != idle_processes[cpu->index] && process->vruntime + WAKEUP_GRANULARITY < current->vruntime) {
+                cpu->preempt = true;
+            }
+
+            kick_idle_cpu();
+        }
+
+        utils::restore_interrupts(rflags);
+    }
+
+    void run(const memory::virt::Space space) {
         asm volatile("cli" ::: "memory");
-        Process* process_ptr;
+        Process* idle_process;
 
         {
-            utils::msr_write(utils::MSR_GS_BASE, reinterpret_cast<uint64_t>(&cpu_status));
-            utils::msr_write(utils::MSR_KERNEL_GS_BASE, 0);
+            StackFrame frame;
+            setup_dummy_frame(frame, idle_loop);
+
+            const auto pid = create_process(space, Land::Kernel, frame, "/");
+            if (pid.is_empty()) utils::panic(nullptr, "[scheduler] Failed to create idle process");
 
-            it = process_queue.begin();
-            process_ptr = *get_current_process();
+            idle_process = *get_process(pid.value());
+            idle_processes[smp::get_current()->index] = idle_process;
         }
 
         uint64_t old;
-        switch_to_process(&old, process_ptr);
+        switch_to_process(&old, idle_process);
     }
 } // namespace cosmos::task
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "process.hpp"
+#include "utils.hpp"
 
 namespace cosmos::task {
     void spawn_reaper(memory::virt::Space space);
@@ -8,15 +9,60 @@ namespace cosmos::task {
     bool enqueue(ProcessId pid);
     bool dequeue(ProcessId pid);
 
-    stl::Rc<Process> get_current_process();
+    /// Sets the nice value of a process, which determines its share of the CPU relative to the other runnable processes
+    bool set_nice(ProcessId pid, int32_t nice);
 
-    /// Suspends the calling process until the process passed to this function exists, returning its status code
+    /// Read straight from the per-CPU data without taking a reference, the process stays alive at least until it switched away after
+    /// exiting. Callers which keep it beyond that need to take a reference themselves.
+    inline Process* get_current_process() {
+        Process* process;
+        asm volatile("mov %%gs:32, %0" : "=r"(process));
+        return process;
+    }
+
+    /// Suspends the calling process until the process passed to this function exists, returning its status code.
+    /// For a leader this includes all of its threads.
     stl::Optional<uint64_t> join(ProcessId pid);
 
     void yield();
     void exit(uint64_t status);
 
-    void suspend(UnsuspendFn unsuspend_fn, uint64_t unsuspend_data);
+    /// Parks the current process for at least the number of milliseconds
+    void sleep(uint64_t ms);
+
+    /// Called by the timer of each CPU every millisecond, charges the running process and flags the CPU once its time slice is used up
+    void tick();
+
+    /// Yields if the timer flagged the current CPU, called on the way back to user-land with interrupts disabled
+    void preempt();
+
+    /// Takes the current process off its run queue and switches away until wake is called for it.
+    /// Interrupts need to be disabled so that nothing can wake the process before it is parked, they are disabled again on return.
+    void park();
+
+    /// Puts a parked process back on a run queue, does nothing if the process is not parked.
+    /// Never allocates so it can be called from interrupt handlers.
+    void wake(Process* process);
+
+    /// Parks the current process on the wait queue until the condition returns true, it is checked again after every wake up
+    template <typename Condition>
+    void wait_until(WaitQueue& queue, Condition condition) {
+        const auto rflags = utils::disable_interrupts();
+
+        if (!condition()) {
+            Waiter waiter = { nullptr, get_current_process(), nullptr };
+            queue.add(waiter);
+
+            do {
+                park();
+            } while (!condition());
+
+            queue.remove(waiter);
+        }
+
+        utils::restore_interrupts(rflags);
+    }
 
-    void run();
+    /// Creates the idle process of the calling CPU and starts running processes, the kernel lock needs to be held
+    void run(memory::virt::Space space);
 } // namespace cosmos::task
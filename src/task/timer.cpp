@@ -0,0 +1,198 @@
+#include "timer.hpp"
+
+#include "clock.hpp"
+#include "interrupts/lapic.hpp"
+#include "smp.hpp"
+#include "utils.hpp"
+
+namespace cosmos::task {
+    /// Each level has 64 slots, a slot of level n covers 64^n ticks.
+    /// Timers further away than the last level are kept in its last slot and moved down again once it is reached.
+    constexpr uint32_t LEVEL_BITS = 6;
+    constexpr uint32_t LEVEL_SLOTS = 1u << LEVEL_BITS;
+    constexpr uint32_t LEVEL_COUNT = 4;
+
+    static Timer* wheel[LEVEL_COUNT][LEVEL_SLOTS] = {};
+
+    /// Next tick to be processed, slots before it at level 0 are empty
+    static uint64_t wheel_ticks = 0;
+    static uint64_t timer_count = 0;
+
+    static uint32_t get_slot(const uint64_t ticks, const uint32_t level) {
+        return (ticks >> (level * LEVEL_BITS)) & (LEVEL_SLOTS - 1);
+    }
+
+    static void link(Timer*& head, Timer& timer) {
+        timer.next = head;
+        timer.prev = &head;
+
+        if (head != nullptr) head->prev = &timer.next;
+        head = &timer;
+    }
+
+    static void unlink(Timer& timer) {
+        *timer.prev = timer.next;
+        if (timer.next != nullptr) timer.next->prev = timer.prev;
+
+        timer.next = nullptr;
+        timer.prev = nullptr;
+    }
+
+    static void insert(Timer& timer) {
+        // Expired timers run on the next processed tick
+        const auto expires = timer.expires > wheel_ticks ? timer.expires : wheel_ticks;
+        const auto delta = expires - wheel_ticks;
+
+        auto level = 0u;
+        while (level < LEVEL_COUNT - 1 && (delta >> ((level + 1) * LEVEL_BITS)) != 0) {
+            level++;
+        }
+
+        // Too far away for the last level
+        auto slot = get_slot(expires, level);
+        if ((delta >> (LEVEL_COUNT * LEVEL_BITS)) != 0) slot = (get_slot(wheel_ticks, level) - 1) & (LEVEL_SLOTS - 1);
+
+        link(wheel[level][slot], timer);
+    }
+
+    /// Moves the timers of the slot down to lower levels, they all expire within the next slot of the level below
+    static void cascade(const uint32_t level, const uint32_t slot) {
+        auto timer = wheel[level][slot];
+        wheel[level][slot] = nullptr;
+
+        while (timer != nullptr) {
+            const auto next = timer->next;
+            insert(*timer);
+
+            timer = next;
+        }
+    }
+
+    static void process_tick() {
+        const auto ticks = wheel_ticks;
+
+        // A level is cascaded each time all the levels below it wrapped around
+        for (auto level = 1u; level < LEVEL_COUNT; level++) {
+            if (get_slot(ticks, level - 1) != 0) break;
+            cascade(level, get_slot(ticks, level));
+        }
+
+        // Detach the slot so that timers can be added and cancelled from the functions
+        auto pending = wheel[0][get_slot(ticks, 0)];
+        wheel[0][get_slot(ticks, 0)] = nullptr;
+        if (pending != nullptr) pending->prev = &pending;
+
+        wheel_ticks++;
+
+        while (pending != nullptr) {
+            auto& timer = *pending;
+
+            unlink(timer);
+            timer_count--;
+
+            if (timer.period != 0) {
+                timer.expires += timer.period;
+
+                insert(timer);
+                timer_count++;
+            }
+
+            timer.fn(timer);
+        }
+    }
+
+    /// @return first tick at or after wheel_ticks which runs or cascades timers, all the ticks before it would do nothing
+    static uint64_t find_next_tick() {
+        auto next = 0xFFFFFFFFFFFFFFFFul;
+
+        // Slots of level 0 hold the exact tick
+        for (auto i = 0u; i < LEVEL_SLOTS; i++) {
+            if (wheel[0][get_slot(wheel_ticks + i, 0)] != nullptr) {
+                next = wheel_ticks + i;
+                break;
+            }
+        }
+
+        // Higher levels need to run when their next non-empty slot is cascaded, which is still pending if wheel_ticks is on its boundary
+        for (auto level = 1u; level < LEVEL_COUNT; level++) {
+            const auto shift = level * LEVEL_BITS;
+            const auto first = (wheel_ticks + (1ul << shift) - 1) >> shift;
+
+            for (auto i = 0u; i < LEVEL_SLOTS; i++) {
+                const auto position = first + i;
+
+                if (wheel[level][get_slot(position << shift, level)] != nullptr) {
+                    if ((position << shift) < next) next = position << shift;
+                    break;
+                }
+            }
+        }
+
+        return next;
+    }
+
+    // Header
+
+    void add_timer(Timer& timer, const uint64_t delay, const uint64_t period, const TimerFn fn, const uint64_t data) {
+        const auto rflags = utils::disable_interrupts();
+
+        timer.expires = clock::get_ms() + delay;
+        timer.period = period;
+        timer.fn = fn;
+        timer.data = data;
+
+        insert(timer);
+        timer_count++;
+
+        // The bootstrap processor might be idle with its timer armed for a later expiry or not at all
+        const auto bsp = smp::get_cpu(0);
+
+        if (smp::get_current() != bsp && __atomic_load_n(&bsp->idle, __ATOMIC_RELAXED)) {
+            lapic::send_ipi(bsp->lapic_id, lapic::RESCHEDULE_IRQ);
+        }
+
+        utils::restore_interrupts(rflags);
+    }
+
+    void cancel_timer(Timer& timer) {
+        const auto rflags = utils::disable_interrupts();
+
+        if (timer.active()) {
+            unlink(timer);
+            timer_count--;
+        }
+
+        utils::restore_interrupts(rflags);
+    }
+
+    void run_timers(const uint64_t ticks) {
+        // Nothing to run, skip the ticks spent idle
+        if (timer_count == 0) {
+            if (ticks >= wheel_ticks) wheel_ticks = ticks + 1;
+            return;
+        }
+
+        while (wheel_ticks <= ticks) {
+            // After an idle period jump straight to the next tick with work, instead of walking every millisecond spent idle
+            if (wheel_ticks < ticks) {
+                const auto next = find_next_tick();
+
+                if (next > ticks) {
+                    wheel_ticks = ticks + 1;
+                    return;
+                }
+
+                wheel_ticks = next;
+            }
+
+            process_tick();
+        }
+    }
+
+    uint64_t get_next_timer(const uint64_t ticks) {
+        if (timer_count == 0) return 0;
+
+        const auto next = find_next_tick();
+        return next > ticks ? next - ticks : 1;
+    }
+} // namespace cosmos::task
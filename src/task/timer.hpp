@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cosmos::task {
+    struct Timer;
+
+    /// Runs on the bootstrap processor in interrupt context with the kernel lock held
+    using TimerFn = void (*)(Timer& timer);
+
+    /// Timer owned by the caller, it needs to stay alive until it expired or was cancelled
+    struct Timer {
+        Timer* next;
+        Timer** prev;
+
+        /// Tick at which the timer expires
+        uint64_t expires;
+        /// Periodic timers are added again with this many milliseconds, one-shot timers have a period of 0
+        uint64_t period;
+
+        TimerFn fn;
+        uint64_t data;
+
+        bool active() const {
+            return prev != nullptr;
+        }
+    };
+
+    /// Runs the function after delay milliseconds and then every period milliseconds if period is not 0
+    void add_timer(Timer& timer, uint64_t delay, uint64_t period, TimerFn fn, uint64_t data);
+
+    /// Does nothing if the timer is not active
+    void cancel_timer(Timer& timer);
+
+    /// Runs all timers which expired up to the tick, called by the timer interrupt of the bootstrap processor
+    void run_timers(uint64_t ticks);
+
+    /// @return milliseconds until the timer interrupt needs to run again, can be earlier than the next expiry. 0 if there are no timers.
+    uint64_t get_next_timer(uint64_t ticks);
+} // namespace cosmos::task
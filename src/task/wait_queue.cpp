@@ -0,0 +1,39 @@
+#include "wait_queue.hpp"
+
+#include "scheduler.hpp"
+#include "utils.hpp"
+
+namespace cosmos::task {
+    void WaitQueue::add(Waiter& waiter) {
+        const auto rflags = utils::disable_interrupts();
+
+        waiter.next = head;
+        head = &waiter;
+
+        utils::restore_interrupts(rflags);
+    }
+
+    void WaitQueue::remove(const Waiter& waiter) {
+        const auto rflags = utils::disable_interrupts();
+
+        for (auto it = &head; *it != nullptr; it = &(*it)->next) {
+            if (*it == &waiter) {
+                *it = waiter.next;
+                break;
+            }
+        }
+
+        utils::restore_interrupts(rflags);
+    }
+
+    void WaitQueue::wake_all() const {
+        const auto rflags = utils::disable_interrupts();
+
+        for (auto waiter = head; waiter != nullptr; waiter = waiter->next) {
+            if (waiter->fn != nullptr) waiter->fn(*waiter);
+            else wake(waiter->process);
+        }
+
+        utils::restore_interrupts(rflags);
+    }
+} // namespace cosmos::task
@@ -0,0 +1,31 @@
+#pragma once
+
+namespace cosmos::task {
+    struct Process;
+
+    struct Waiter;
+
+    /// Runs with interrupts disabled, possibly in interrupt context
+    using WakeFn = void (*)(Waiter& waiter);
+
+    /// Entry of a process in a wait queue, usually lives on the kernel stack of the process while it waits
+    struct Waiter {
+        Waiter* next;
+        Process* process;
+
+        /// Called instead of waking the process if set, lets other objects follow a wait queue without a process parked on it
+        WakeFn fn;
+    };
+
+    /// Processes waiting for something to happen, parked off the run queues until it is woken.
+    /// Waiters are added and removed by the waiting processes themselves, see wait_until.
+    struct WaitQueue {
+        Waiter* head;
+
+        void add(Waiter& waiter);
+        void remove(const Waiter& waiter);
+
+        /// Puts all waiting processes back on run queues or calls their wake functions, can be called from interrupt handlers
+        void wake_all() const;
+    };
+} // namespace cosmos::task
@@ -1,5 +1,7 @@
 #include "tss.hpp"
 
+#include "smp.hpp"
+
 #include <cstdint>
 
 namespace cosmos::tss {
@@ -13,22 +15,22 @@ namespace cosmos::tss {
         uint16_t iomap_base;
     };
 
-    static volatile Tss tss = {};
+    static volatile Tss tsses[smp::MAX_CPUS] = {};
 
-    void init() {
-        tss.iomap_base = sizeof(Tss);
+    void init(const uint32_t cpu) {
+        tsses[cpu].iomap_base = sizeof(Tss);
 
         asm volatile("ltr %0" : : "r"(static_cast<uint16_t>(0x28)) : "memory");
     }
 
-    void set_rsp(const uint8_t level, const uint64_t rsp) {
+    void set_rsp(const uint32_t cpu, const uint8_t level, const uint64_t rsp) {
         if (level < 3) {
-            tss.rsp[level] = rsp;
+            tsses[cpu].rsp[level] = rsp;
         }
     }
 
-    uint64_t get_address() {
-        return reinterpret_cast<uint64_t>(&tss);
+    uint64_t get_address(const uint32_t cpu) {
+        return reinterpret_cast<uint64_t>(&tsses[cpu]);
     }
 
     uint64_t get_size() {
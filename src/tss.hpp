@@ -3,10 +3,11 @@
 #include <cstdint>
 
 namespace cosmos::tss {
-    void init();
+    /// Loads the TSS of the CPU, the GDT of the CPU needs to be loaded first
+    void init(uint32_t cpu);
 
-    void set_rsp(uint8_t level, uint64_t rsp);
+    void set_rsp(uint32_t cpu, uint8_t level, uint64_t rsp);
 
-    uint64_t get_address();
+    uint64_t get_address(uint32_t cpu);
     uint64_t get_size();
 } // namespace cosmos::tss
@@ -118,6 +118,10 @@ namespace cosmos::utils {
         asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(arg));
     }
 
+    void cpuid(uint32_t arg, uint32_t sub_arg, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) { // NOLINT(*-non-const-parameter)
+        asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(arg), "c"(sub_arg));
+    }
+
     void memset(void* dst, const uint8_t value, const std::size_t size) {
         for (uint64_t i = 0; i < size; i++) {
             static_cast<uint8_t*>(dst)[i] = value;
@@ -12,6 +12,7 @@ namespace cosmos::utils {
     void halt();
 
     void cpuid(uint32_t arg, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx);
+    void cpuid(uint32_t arg, uint32_t sub_arg, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx);
 
     void memset(void* dst, uint8_t value, std::size_t size);
     void memcpy(void* dst, const void* src, std::size_t size);
@@ -33,6 +34,7 @@ namespace cosmos::utils {
     constexpr uint32_t MSR_STAR = 0xC0000081;
     constexpr uint32_t MSR_LSTAR = 0xC0000082;
     constexpr uint32_t MSR_SFMASK = 0xC0000084;
+    constexpr uint32_t MSR_FS_BASE = 0xC0000100;
     constexpr uint32_t MSR_KERNEL_GS_BASE = 0xC0000102;
     constexpr uint32_t MSR_GS_BASE = 0xC0000101;
 
@@ -85,8 +87,28 @@ namespace cosmos::utils {
         asm volatile("out %%eax, %%dx" : : "a"(data), "d"(port));
     }
 
+    // Interrupts
+
+    /// @return previous RFLAGS which restore_interrupts takes
+    inline uint64_t disable_interrupts() {
+        uint64_t rflags;
+        asm volatile("pushfq; pop %0; cli" : "=r"(rflags)::"memory");
+        return rflags;
+    }
+
+    inline void restore_interrupts(const uint64_t rflags) {
+        if ((rflags & 0x200) != 0) asm volatile("sti" ::: "memory");
+    }
+
     // Other
 
+    inline uint64_t rdtsc() {
+        uint32_t lo;
+        uint32_t hi;
+        asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return (static_cast<uint64_t>(hi) << 32) | lo;
+    }
+
     inline void wait() {
         byte_out(0x80, 0);
     }
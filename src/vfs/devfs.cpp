@@ -1,5 +1,6 @@
 #include "devfs.hpp"
 
+#include "memory/virtual.hpp"
 #include "nanoprintf.h"
 #include "stl/utils.hpp"
 #include "utils.hpp"
@@ -123,13 +124,21 @@ namespace cosmos::vfs::devfs {
             seq->ops->next(seq);
         }
 
-        // Read data from buffer
-        auto read = stl::min(seq->buffer.size(), length);
-        if (read == 0) return 0;
+        // Read data from buffer, user memory is only written through copy_user
+        char chunk[64];
+        uint64_t read = 0;
 
-        read = seq->buffer.try_get(static_cast<char*>(buffer), read);
-        file->cursor += read;
+        while (read < length) {
+            const auto count = seq->buffer.try_get(chunk, stl::min(length - read, sizeof(chunk)));
+            if (count == 0) break;
+
+            const auto copied = memory::virt::copy_user(static_cast<char*>(buffer) + read, chunk, count);
+            read += copied;
 
+            if (copied != count) break;
+        }
+
+        file->cursor += read;
         return read;
     }
 
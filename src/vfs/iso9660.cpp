@@ -1,6 +1,7 @@
 #include "iso9660.hpp"
 
 #include "log/log.hpp"
+#include "memory/cache.hpp"
 #include "memory/heap.hpp"
 #include "stl/bit_field.hpp"
 #include "stl/utils.hpp"
@@ -162,6 +163,9 @@ namespace cosmos::vfs::iso9660 {
         uint64_t data_size;
     };
 
+    /// Child nodes are allocated from a cache together with their NodeInfo, their names are allocated separately
+    static memory::cache::Cache* node_cache = nullptr;
+
     // FileOps
 
     uint64_t file_seek(const stl::Rc<File>& file, const SeekType type, const int64_t offset) {
@@ -170,15 +174,19 @@ namespace cosmos::vfs::iso9660 {
         return file->cursor;
     }
 
-    // ReSharper disable once CppParameterMayBeConstPtrOrRef
-    uint64_t file_read(const stl::Rc<File>& file, void* buffer, const uint64_t length) {
+    uint64_t file_read_at(const stl::Rc<File>& file, void* buffer, const uint64_t length, const uint64_t offset) {
         const auto fs_info = static_cast<FsInfo*>(file->node->fs_handle);
         const auto node_info = reinterpret_cast<NodeInfo*>(file->node + 1);
 
-        fs_info->device->ops->seek(fs_info->device, SeekType::Start, static_cast<int64_t>(node_info->data_offset + file->cursor));
+        if (offset >= node_info->data_size) return 0;
+
+        const auto to_read = stl::min(length, node_info->data_size - offset);
+        return read_at(fs_info->device, buffer, to_read, node_info->data_offset + offset);
+    }
 
-        const auto to_read = stl::min(length, node_info->data_size - file->cursor);
-        const auto read = fs_info->device->ops->read(fs_info->device, buffer, to_read);
+    // ReSharper disable once CppParameterMayBeConstPtrOrRef
+    uint64_t file_read(const stl::Rc<File>& file, void* buffer, const uint64_t length) {
+        const auto read = file_read_at(file, buffer, length, file->cursor);
 
         file->cursor += read;
         return read;
@@ -192,6 +200,8 @@ namespace cosmos::vfs::iso9660 {
         .seek = file_seek,
         .read = file_read,
         .write = nullptr,
+        .read_at = file_read_at,
+        .write_at = nullptr,
         .ioctl = file_ioctl,
     };
 
@@ -201,6 +211,11 @@ namespace cosmos::vfs::iso9660 {
         return nullptr;
     }
 
+    static stl::LinkedList<Node>::Node* alloc_node() {
+        using ListNode = stl::LinkedList<Node>::Node;
+        return memory::cache::alloc<ListNode>(node_cache);
+    }
+
     bool fs_destroy([[maybe_unused]] Node* node) {
         return false;
     }
@@ -212,9 +227,7 @@ namespace cosmos::vfs::iso9660 {
         // Read ISO directory entries
         const auto entries = static_cast<uint8_t*>(memory::heap::alloc(node_info->data_size));
 
-        fs_info->device->ops->seek(fs_info->device, SeekType::Start, static_cast<int64_t>(node_info->data_offset));
-
-        if (fs_info->device->ops->read(fs_info->device, entries, node_info->data_size) != node_info->data_size) {
+        if (read_at(fs_info->device, entries, node_info->data_size, node_info->data_offset) != node_info->data_size) {
             ERROR("Failed to read directory entries of '%s'", node->name.data());
             memory::heap::free(entries);
             return;
@@ -270,12 +283,23 @@ namespace cosmos::vfs::iso9660 {
                 }
 
                 // Create child
-                const auto child = node->children.push_back_alloc(sizeof(NodeInfo) + name.size() + 1);
+                const auto list_node = alloc_node();
+                const auto child_name = memory::heap::alloc_array<char>(name.size() + 1);
+
+                if (list_node == nullptr || child_name == nullptr) {
+                    memory::cache::free(node_cache, list_node);
+                    memory::heap::free(child_name);
+
+                    ERROR("Failed to allocate memory for iso9660 node");
+                    break;
+                }
+
+                const auto child = node->children.push_back(list_node);
 
                 child->parent = node;
                 child->mount_root = false;
                 child->type = (entry->flags / FileFlags::Directory) ? NodeType::Directory : NodeType::File;
-                child->name = stl::StringView(reinterpret_cast<char*>(child + 1) + sizeof(NodeInfo), name.size());
+                child->name = stl::StringView(child_name, name.size());
                 child->fs_ops = node->fs_ops;
                 child->fs_handle = node->fs_handle;
                 child->open_read = 0;
@@ -366,6 +390,11 @@ namespace cosmos::vfs::iso9660 {
     }
 
     void register_filesystem() {
+        using ListNode = stl::LinkedList<Node>::Node;
+
+        node_cache = memory::cache::create("iso9660_node", sizeof(ListNode) + sizeof(NodeInfo), alignof(ListNode));
+        if (node_cache == nullptr) utils::panic(nullptr, "[iso9660] Failed to create node cache");
+
         vfs::register_filesystem("iso9660", sizeof(NodeInfo), init);
     }
 } // namespace cosmos::vfs::iso9660
@@ -1,6 +1,7 @@
 #include "ramfs.hpp"
 
 #include "memory/heap.hpp"
+#include "memory/virtual.hpp"
 #include "stl/linked_list.hpp"
 #include "stl/string_view.hpp"
 #include "stl/utils.hpp"
@@ -9,6 +10,9 @@
 #include "vfs.hpp"
 
 namespace cosmos::vfs::ramfs {
+    /// Data of a file is a single heap allocation, writes which would grow it past this size are cut short
+    constexpr uint64_t MAX_FILE_SIZE = 16ul * 1024ul * 1024ul;
+
     struct FileInfo {
         uint8_t* data;
         uint64_t data_capacity;
@@ -24,30 +28,41 @@ namespace cosmos::vfs::ramfs {
         return file->cursor;
     }
 
-    uint64_t file_read(const stl::Rc<File>& file, void* buffer, const uint64_t length) {
+    uint64_t file_read_at(const stl::Rc<File>& file, void* buffer, const uint64_t length, const uint64_t offset) {
         const auto info = reinterpret_cast<FileInfo*>(file->node + 1);
 
         if (file->mode == Mode::Write) return 0;
         if (info->data == nullptr) return 0;
-        if (file->cursor >= info->data_size) return 0;
+        if (offset >= info->data_size) return 0;
 
-        auto size = info->data_size - file->cursor;
+        auto size = info->data_size - offset;
         if (size > length) size = length;
 
         if (size > 0) {
-            utils::memcpy(buffer, &info->data[file->cursor], size);
-            file->cursor += size;
+            size = memory::virt::copy_user(buffer, &info->data[offset], size);
         }
 
         return size;
     }
 
-    uint64_t file_write(const stl::Rc<File>& file, const void* buffer, const uint64_t length) {
+    uint64_t file_read(const stl::Rc<File>& file, void* buffer, const uint64_t length) {
+        const auto size = file_read_at(file, buffer, length, file->cursor);
+        file->cursor += size;
+
+        return size;
+    }
+
+    uint64_t file_write_at(const stl::Rc<File>& file, const void* buffer, const uint64_t length, const uint64_t offset) {
         const auto info = reinterpret_cast<FileInfo*>(file->node + 1);
         if (file->mode == Mode::Read) return 0;
 
-        if (file->cursor + length >= info->data_capacity) {
-            const auto new_capacity = stl::max(info->data_capacity * 2, file->cursor + length);
+        // The offset comes from user-land, checking it first keeps offset + length from wrapping
+        if (length == 0 || offset >= MAX_FILE_SIZE) return 0;
+
+        const auto size = stl::min(length, MAX_FILE_SIZE - offset);
+
+        if (offset + size > info->data_capacity) {
+            const auto new_capacity = stl::min(stl::max(info->data_capacity * 2, offset + size), MAX_FILE_SIZE);
 
             const auto new_data = memory::heap::alloc_array<uint8_t>(new_capacity);
             if (new_data == nullptr) return 0;
@@ -61,14 +76,25 @@ namespace cosmos::vfs::ramfs {
             info->data_capacity = new_capacity;
         }
 
-        utils::memcpy(&info->data[file->cursor], buffer, length);
-        file->cursor += length;
+        // Bytes between the old end and the offset are zero
+        if (offset > info->data_size) {
+            utils::memset(&info->data[info->data_size], 0, offset - info->data_size);
+        }
+
+        const auto written = memory::virt::copy_user(&info->data[offset], buffer, size);
 
-        if (file->cursor > info->data_size) {
-            info->data_size = file->cursor;
+        if (offset + written > info->data_size) {
+            info->data_size = offset + written;
         }
 
-        return length;
+        return written;
+    }
+
+    uint64_t file_write(const stl::Rc<File>& file, const void* buffer, const uint64_t length) {
+        const auto written = file_write_at(file, buffer, length, file->cursor);
+        file->cursor += written;
+
+        return written;
     }
 
     uint64_t file_ioctl([[maybe_unused]] const stl::Rc<File>& file, [[maybe_unused]] uint64_t op, [[maybe_unused]] uint64_t arg) {
@@ -79,6 +105,8 @@ namespace cosmos::vfs::ramfs {
         .seek = file_seek,
         .read = file_read,
         .write = file_write,
+        .read_at = file_read_at,
+        .write_at = file_write_at,
         .ioctl = file_ioctl,
     };
 
@@ -7,6 +7,10 @@
 
 #include <cstdint>
 
+namespace cosmos::task {
+    struct WaitQueue;
+} // namespace cosmos::task
+
 namespace cosmos::vfs {
     enum class NodeType : uint8_t;
     struct Node;
@@ -63,6 +67,17 @@ namespace cosmos::vfs {
         End,
     };
 
+    enum class PollMask : uint8_t {
+        None = 0,
+        /// A read would not block
+        Read = 1 << 0,
+        /// A write would not block
+        Write = 1 << 1,
+        /// The other end is gone, always reported even if not asked for
+        Hangup = 1 << 2,
+    };
+    ENUM_BIT_FIELD(PollMask)
+
     constexpr uint64_t IOCTL_OK = 0;
     constexpr uint64_t IOCTL_UNKNOWN = UINT64_MAX;
 
@@ -123,7 +138,13 @@ namespace cosmos::vfs {
         uint64_t (*seek)(const stl::Rc<File>& file, SeekType type, int64_t offset);
         uint64_t (*read)(const stl::Rc<File>& file, void* buffer, uint64_t length);
         uint64_t (*write)(const stl::Rc<File>& file, const void* buffer, uint64_t length);
+        /// Optional, same as read and write but at the offset instead of the cursor which is left untouched
+        uint64_t (*read_at)(const stl::Rc<File>& file, void* buffer, uint64_t length, uint64_t offset);
+        uint64_t (*write_at)(const stl::Rc<File>& file, const void* buffer, uint64_t length, uint64_t offset);
         uint64_t (*ioctl)(const stl::Rc<File>& file, uint64_t op, uint64_t arg);
+        /// Optional, current readiness of the file. The queue is set to the wait queue which is woken whenever it might change,
+        /// or nullptr if it never changes.
+        PollMask (*poll)(const stl::Rc<File>& file, task::WaitQueue*& queue);
     };
 
     // DirEntry
@@ -1,7 +1,9 @@
 #include "vfs.hpp"
 
 #include "log/log.hpp"
+#include "memory/cache.hpp"
 #include "memory/heap.hpp"
+#include "memory/virtual.hpp"
 #include "path.hpp"
 #include "stl/utils.hpp"
 #include "utils.hpp"
@@ -17,6 +19,8 @@ namespace cosmos::vfs {
 
     static Node* root = nullptr;
 
+    static memory::cache::Cache* file_cache = nullptr;
+
     static Node* find_node(const stl::StringView& path, Node*& parent, stl::SplitIterator& it) {
         parent = nullptr;
         auto node = root;
@@ -183,10 +187,12 @@ namespace cosmos::vfs {
         const auto ops = node->fs_ops->open(node, mode);
         if (ops == nullptr) return nullptr;
 
+        const auto file = alloc_file();
+        if (!file.valid()) return nullptr;
+
         if (is_read(mode)) node->open_read++;
         if (is_write(mode)) node->open_write++;
 
-        const auto file = stl::Rc<File>::alloc();
         file->ops = ops;
         file->on_close = nullptr;
         file->node = node;
@@ -209,11 +215,13 @@ namespace cosmos::vfs {
 
         if (*it != stl::LinkedList<Node>::end()) {
             const auto node = *it;
-            const auto entry = static_cast<DirEntry*>(buffer);
 
-            entry->type = node->type;
-            utils::memcpy(entry->name, node->name.data(), stl::min(node->name.size(), 256ul));
-            entry->name_size = node->name.size();
+            DirEntry entry = {};
+            entry.type = node->type;
+            utils::memcpy(entry.name, node->name.data(), stl::min(node->name.size(), 256ul));
+            entry.name_size = node->name.size();
+
+            if (memory::virt::copy_user(buffer, &entry, sizeof(DirEntry)) != sizeof(DirEntry)) return 0;
 
             ++*it;
             return sizeof(DirEntry);
@@ -243,9 +251,11 @@ namespace cosmos::vfs {
 
         if (!node->populated) node->fs_ops->populate(node);
 
+        const auto file = alloc_file(sizeof(stl::LinkedList<Node>::Iterator));
+        if (!file.valid()) return nullptr;
+
         node->open_read++;
 
-        const auto file = stl::Rc<File>::alloc(sizeof(stl::LinkedList<Node>::Iterator));
         file->ops = &dir_ops;
         file->on_close = nullptr;
         file->node = node;
@@ -324,6 +334,44 @@ namespace cosmos::vfs {
 
     // File
 
+    uint64_t read_at(const stl::Rc<File>& file, void* buffer, const uint64_t length, const uint64_t offset) {
+        if (file->ops->read_at != nullptr) return file->ops->read_at(file, buffer, length, offset);
+        if (file->ops->read == nullptr) return 0;
+
+        const auto cursor = file->ops->seek(file, SeekType::Current, 0);
+
+        file->ops->seek(file, SeekType::Start, static_cast<int64_t>(offset));
+        const auto read = file->ops->read(file, buffer, length);
+
+        file->ops->seek(file, SeekType::Start, static_cast<int64_t>(cursor));
+        return read;
+    }
+
+    uint64_t write_at(const stl::Rc<File>& file, const void* buffer, const uint64_t length, const uint64_t offset) {
+        if (file->ops->write_at != nullptr) return file->ops->write_at(file, buffer, length, offset);
+        if (file->ops->write == nullptr) return 0;
+
+        const auto cursor = file->ops->seek(file, SeekType::Current, 0);
+
+        file->ops->seek(file, SeekType::Start, static_cast<int64_t>(offset));
+        const auto written = file->ops->write(file, buffer, length);
+
+        file->ops->seek(file, SeekType::Start, static_cast<int64_t>(cursor));
+        return written;
+    }
+
+    PollMask poll(const stl::Rc<File>& file, task::WaitQueue*& queue) {
+        if (file->ops->poll != nullptr) return file->ops->poll(file, queue);
+
+        queue = nullptr;
+
+        auto mask = PollMask::None;
+        if (is_read(file->mode)) mask |= PollMask::Read;
+        if (is_write(file->mode)) mask |= PollMask::Write;
+
+        return mask;
+    }
+
     void File::destroy() {
         if (node != nullptr) {
             if (is_read(mode)) node->open_read--;
@@ -336,6 +384,24 @@ namespace cosmos::vfs {
             on_close(this);
         }
 
-        memory::heap::free(this);
+        memory::cache::free(file_cache, this);
+    }
+
+    static void file_ctor(void* object) {
+        static_cast<File*>(object)->ref_count = 0;
+    }
+
+    void init() {
+        file_cache = memory::cache::create("file", sizeof(File) + FILE_DATA_SIZE, alignof(File), file_ctor);
+        if (file_cache == nullptr) utils::panic(nullptr, "[vfs] Failed to create file cache");
+    }
+
+    stl::Rc<File> alloc_file(const uint64_t data_size) {
+        if (data_size > FILE_DATA_SIZE) {
+            ERROR("File data size %d is larger than %d bytes", data_size, FILE_DATA_SIZE);
+            return nullptr;
+        }
+
+        return memory::cache::alloc<File>(file_cache);
     }
 } // namespace cosmos::vfs
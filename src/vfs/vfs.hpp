@@ -3,8 +3,14 @@
 #include "types.hpp"
 
 namespace cosmos::vfs {
+    /// Maximum number of bytes which can be stored directly after a file allocated with alloc_file
+    constexpr uint64_t FILE_DATA_SIZE = 32;
+
     using FsInitFn = bool (*)(Node* node, stl::StringView device_path);
 
+    /// Creates the file cache, has to be called before any file is allocated
+    void init();
+
     void register_filesystem(stl::StringView name, std::size_t additional_root_node_size, FsInitFn init_fn);
 
     Node* mount(stl::StringView target_path, stl::StringView filesystem_name, stl::StringView device_path);
@@ -17,4 +23,22 @@ namespace cosmos::vfs {
     bool create_dir(stl::StringView path);
 
     bool remove(stl::StringView path);
+
+    /// Only files with FileOps::read_at keep their data once it is read, reading anything else like pipes or devices consumes it and
+    /// seeking back does nothing
+    inline bool is_seekable(const stl::Rc<File>& file) {
+        return file->ops->read_at != nullptr;
+    }
+
+    /// Uses FileOps::read_at if the file supports it, otherwise seeks there and restores the cursor afterwards
+    uint64_t read_at(const stl::Rc<File>& file, void* buffer, uint64_t length, uint64_t offset);
+
+    /// Uses FileOps::write_at if the file supports it, otherwise seeks there and restores the cursor afterwards
+    uint64_t write_at(const stl::Rc<File>& file, const void* buffer, uint64_t length, uint64_t offset);
+
+    /// Files without FileOps::poll are always ready for what their mode allows
+    PollMask poll(const stl::Rc<File>& file, task::WaitQueue*& queue);
+
+    /// Allocates a file from the file cache, data_size bytes of filesystem or device specific data follow directly after it
+    stl::Rc<File> alloc_file(uint64_t data_size = 0);
 } // namespace cosmos::vfs
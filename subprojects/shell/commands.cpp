@@ -1,8 +1,11 @@
 #include "commands.hpp"
 
 #include "color.hpp"
+#include "nanoprintf.h"
 #include "syscalls.hpp"
 
+#include <cstdarg>
+
 struct Command {
     stl::StringView name;
     stl::StringView description;
@@ -23,6 +26,17 @@ static void print(const Color color, const stl::StringView str) {
     sys::write(1, reset_esc_seq, sizeof(reset_esc_seq));
 }
 
+static void printf(const char* fmt, ...) {
+    char buffer[256];
+
+    va_list args;
+    va_start(args, fmt);
+    const auto size = npf_vsnprintf(buffer, 256, fmt, args);
+    va_end(args);
+
+    print(stl::StringView(buffer, size));
+}
+
 // Commands
 
 static void ls(const stl::StringView args) {
@@ -112,6 +126,46 @@ static void touch(const stl::StringView args) {
     sys::close(fd);
 }
 
+static void cp(const stl::StringView args) {
+    // Parse args
+    const auto space_index = args.index_of(' ');
+
+    if (space_index == -1) {
+        print(RED, "Missing destination path\n");
+        return;
+    }
+
+    const auto src = args.substr(0, space_index);
+    const auto dst = args.substr(space_index + 1);
+
+    CSTR(src)
+    CSTR(dst)
+
+    // Open files
+    uint32_t src_fd;
+
+    if (!sys::open(src_cstr, sys::Mode::Read, sys::FileFlags::CloseOnExecute, src_fd)) {
+        print(RED, "Failed to open source file\n");
+        return;
+    }
+
+    uint32_t dst_fd;
+
+    if (!sys::open(dst_cstr, sys::Mode::Write, sys::FileFlags::CloseOnExecute, dst_fd)) {
+        print(RED, "Failed to open destination file\n");
+        sys::close(src_fd);
+        return;
+    }
+
+    // Copy without going through a buffer in the shell
+    uint64_t written;
+
+    while (sys::sendfile(dst_fd, src_fd, nullptr, 64ul * 1024ul, written) && written > 0) {}
+
+    sys::close(dst_fd);
+    sys::close(src_fd);
+}
+
 static void mkdir(const stl::StringView args) {
     CSTR(args)
 
@@ -185,6 +239,270 @@ static void cd(const stl::StringView args) {
     }
 }
 
+// Benchmarks
+
+static uint64_t read_tsc() {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+/// Bounces a byte between two processes through two pipes, every round trip needs at least two context switches
+static void bench_switch() {
+    constexpr uint64_t ROUND_TRIPS = 10000;
+
+    uint32_t ping_read_fd, ping_write_fd;
+    uint32_t pong_read_fd, pong_write_fd;
+
+    if (!sys::pipe(sys::FileFlags::None, ping_read_fd, ping_write_fd) || !sys::pipe(sys::FileFlags::None, pong_read_fd, pong_write_fd)) {
+        print(RED, "Failed to create pipes\n");
+        return;
+    }
+
+    uint32_t child_pid;
+
+    if (!sys::fork(child_pid)) {
+        print(RED, "Failed to fork process\n");
+        return;
+    }
+
+    char byte = 0;
+
+    if (child_pid == 0) {
+        for (auto i = 0u; i < ROUND_TRIPS; i++) {
+            sys::read(ping_read_fd, &byte, 1);
+            sys::write(pong_write_fd, &byte, 1);
+        }
+
+        sys::exit(0);
+    }
+
+    const auto start = read_tsc();
+
+    for (auto i = 0u; i < ROUND_TRIPS; i++) {
+        sys::write(ping_write_fd, &byte, 1);
+        sys::read(pong_read_fd, &byte, 1);
+    }
+
+    const auto cycles = read_tsc() - start;
+
+    sys::join(child_pid);
+
+    sys::close(ping_read_fd);
+    sys::close(ping_write_fd);
+    sys::close(pong_read_fd);
+    sys::close(pong_write_fd);
+
+    printf("%llu round trips, %llu cycles per round trip\n", ROUND_TRIPS, cycles / ROUND_TRIPS);
+}
+
+/// Streams data from a child process through a pipe, measures how fast the kernel moves bytes between two processes
+static void bench_pipe() {
+    constexpr uint64_t TOTAL_SIZE = 64ul * 1024ul * 1024ul;
+    constexpr uint64_t CHUNK_SIZE = 16ul * 1024ul;
+
+    static uint8_t chunk[CHUNK_SIZE];
+
+    uint32_t read_fd, write_fd;
+
+    if (!sys::pipe(sys::FileFlags::None, read_fd, write_fd)) {
+        print(RED, "Failed to create pipe\n");
+        return;
+    }
+
+    uint32_t child_pid;
+
+    if (!sys::fork(child_pid)) {
+        print(RED, "Failed to fork process\n");
+        return;
+    }
+
+    if (child_pid == 0) {
+        sys::close(read_fd);
+
+        for (auto sent = 0ul; sent < TOTAL_SIZE; sent += CHUNK_SIZE) {
+            sys::write(write_fd, chunk, CHUNK_SIZE);
+        }
+
+        sys::exit(0);
+    }
+
+    // The read returns 0 once the child exited and closed the last write end
+    sys::close(write_fd);
+
+    const auto start = sys::get_ns();
+
+    uint64_t received = 0;
+    uint64_t read;
+
+    while (sys::read(read_fd, chunk, CHUNK_SIZE, read) && read > 0) {
+        received += read;
+    }
+
+    auto ns = sys::get_ns() - start;
+    if (ns == 0) ns = 1;
+
+    sys::join(child_pid);
+    sys::close(read_fd);
+
+    printf("%llu MiB in %llu ms, %llu MiB/s\n", received / (1024 * 1024), ns / 1'000'000, received * 1'000'000'000 / ns / (1024 * 1024));
+}
+
+/// Two processes taking turns through a futex in a shared page, every round trip blocks and wakes each of them once. Unlike yielding
+/// this switches even when they run on different CPUs, and unlike bench switch no pipe buffer is involved.
+static void bench_futex() {
+    constexpr uint64_t ROUND_TRIPS = 10000;
+
+    // 1 while it is the turn of the child, 0 while it is the turn of the parent
+    const auto turn = static_cast<uint32_t*>(sys::mmap(nullptr, 4096, sys::Protection::Read | sys::Protection::Write,
+                                                       sys::MapFlags::Shared | sys::MapFlags::Anonymous, 0, 0));
+
+    if (turn == nullptr) {
+        print(RED, "Failed to map shared page\n");
+        return;
+    }
+
+    *turn = 0;
+
+    uint32_t child_pid;
+
+    if (!sys::fork(child_pid)) {
+        print(RED, "Failed to fork process\n");
+        sys::munmap(turn, 4096);
+        return;
+    }
+
+    if (child_pid == 0) {
+        for (auto i = 0u; i < ROUND_TRIPS; i++) {
+            while (__atomic_load_n(turn, __ATOMIC_ACQUIRE) == 0) sys::futex_wait(turn, 0);
+
+            __atomic_store_n(turn, 0, __ATOMIC_RELEASE);
+            sys::futex_wake(turn, 1);
+        }
+
+        sys::exit(0);
+    }
+
+    const auto start = read_tsc();
+
+    for (auto i = 0u; i < ROUND_TRIPS; i++) {
+        __atomic_store_n(turn, 1, __ATOMIC_RELEASE);
+        sys::futex_wake(turn, 1);
+
+        while (__atomic_load_n(turn, __ATOMIC_ACQUIRE) == 1) sys::futex_wait(turn, 1);
+    }
+
+    const auto cycles = read_tsc() - start;
+
+    sys::join(child_pid);
+    sys::munmap(turn, 4096);
+
+    printf("%llu round trips, %llu cycles per round trip\n", ROUND_TRIPS, cycles / ROUND_TRIPS);
+}
+
+/// Enters and leaves the kernel without doing any work, measures the fixed cost of a syscall
+static void bench_syscall() {
+    constexpr uint64_t SYSCALLS = 1000000;
+
+    const auto start = read_tsc();
+
+    for (auto i = 0u; i < SYSCALLS; i++) {
+        sys::get_pid();
+    }
+
+    const auto cycles = read_tsc() - start;
+
+    printf("%llu syscalls, %llu cycles per syscall\n", SYSCALLS, cycles / SYSCALLS);
+}
+
+static void bench(const stl::StringView args) {
+    if (args == "switch") {
+        bench_switch();
+        return;
+    }
+
+    if (args == "pipe") {
+        bench_pipe();
+        return;
+    }
+
+    if (args == "futex") {
+        bench_futex();
+        return;
+    }
+
+    if (args == "syscall") {
+        bench_syscall();
+        return;
+    }
+
+    print(RED, "Unknown benchmark, available: switch, pipe, futex, syscall\n");
+}
+
+// Tests
+
+/// Forks while a private page is read-only, the child then makes it writable and writes to it.
+/// The page is still shared with the parent at that point, so the write has to copy it first.
+static bool test_fork_mprotect() {
+    constexpr uint8_t ORIGINAL = 0xAB;
+    constexpr uint8_t CHANGED = 0xCD;
+
+    const auto page = static_cast<uint8_t*>(sys::mmap(nullptr, 4096, sys::Protection::Read | sys::Protection::Write,
+                                                      sys::MapFlags::Private | sys::MapFlags::Anonymous, 0, 0));
+    if (page == nullptr) return false;
+
+    for (auto i = 0u; i < 4096; i++) {
+        page[i] = ORIGINAL;
+    }
+    sys::mprotect(page, 4096, sys::Protection::Read);
+
+    uint32_t child_pid;
+
+    if (!sys::fork(child_pid)) {
+        sys::munmap(page, 4096);
+        return false;
+    }
+
+    if (child_pid == 0) {
+        sys::mprotect(page, 4096, sys::Protection::Read | sys::Protection::Write);
+        for (auto i = 0u; i < 4096; i++) {
+            page[i] = CHANGED;
+        }
+
+        sys::exit(page[0] == CHANGED && page[4095] == CHANGED ? 0 : 1);
+    }
+
+    const auto child_ok = sys::join(child_pid) == 0;
+    auto parent_ok = true;
+
+    for (auto i = 0u; i < 4096; i++) {
+        if (page[i] != ORIGINAL) parent_ok = false;
+    }
+
+    sys::munmap(page, 4096);
+    return child_ok && parent_ok;
+}
+
+static void test(const stl::StringView args) {
+    struct Test {
+        const char* name;
+        bool (*fn)();
+    };
+
+    static constexpr Test TESTS[] = {
+        { "fork_mprotect", test_fork_mprotect },
+    };
+
+    for (const auto& test : TESTS) {
+        if (!args.empty() && args != test.name) continue;
+
+        print(test.name);
+        if (test.fn()) print(GREEN, " ok\n");
+        else print(RED, " failed\n");
+    }
+}
+
 // Other
 
 static void help(stl::StringView args);
@@ -193,11 +511,14 @@ static constexpr Command COMMANDS[] = {
     { "ls", "Lists children of a directory", ls }, //
     { "cat", "Reads a file", cat },
     { "touch", "Creates and writes a file", touch },
+    { "cp", "Copies a file", cp },
     { "mkdir", "Create directory", mkdir },
     { "rm", "Remove file or empty directory", rm },
     { "mount", "Mounts a filesystem to a directory", mount },
     { "pwd", "Print working directory", pwd },
     { "cd", "Change directory", cd },
+    { "bench", "Runs a benchmark", bench },
+    { "test", "Runs kernel tests, all of them without a name", test },
     { "help", "Display all available commands", help },
 };
 
@@ -70,32 +70,7 @@ enum class EscapeState {
     ColorB,
 };
 
-static void run_command(const CommandFn fn, const stl::StringView args) {
-    // Create out pipe
-    uint32_t out_read_fd, out_write_fd;
-    sys::pipe(sys::FileFlags::None, out_read_fd, out_write_fd);
-
-    // Fork process
-    uint32_t child_pid;
-    sys::fork(child_pid);
-
-    if (child_pid == 0) {
-        // Setup out pipe
-        sys::duplicate(out_write_fd, 1);
-        sys::close(out_read_fd);
-        sys::close(out_write_fd);
-
-        // Run command
-        fn(args);
-
-        // Exit child process
-        sys::exit(0);
-    } else {
-        // Close unneeded pipe ends
-        sys::close(out_write_fd);
-    }
-
-    // Read out pipe and print to terminal
+static void print_output(const uint32_t out_read_fd) {
     char buffer[512];
     uint64_t read;
 
@@ -148,6 +123,35 @@ static void run_command(const CommandFn fn, const stl::StringView args) {
     }
 
     terminal::set_fg_color(WHITE);
+}
+
+static void run_command(const CommandFn fn, const stl::StringView args) {
+    // Create out pipe
+    uint32_t out_read_fd, out_write_fd;
+    sys::pipe(sys::FileFlags::None, out_read_fd, out_write_fd);
+
+    // Fork process
+    uint32_t child_pid;
+    sys::fork(child_pid);
+
+    if (child_pid == 0) {
+        // Setup out pipe
+        sys::duplicate(out_write_fd, 1);
+        sys::close(out_read_fd);
+        sys::close(out_write_fd);
+
+        // Run command
+        fn(args);
+
+        // Exit child process
+        sys::exit(0);
+    } else {
+        // Close unneeded pipe ends
+        sys::close(out_write_fd);
+    }
+
+    // Read out pipe and print to terminal
+    print_output(out_read_fd);
 
     // Close rest of pipe ends
     sys::close(out_read_fd);
@@ -166,14 +170,35 @@ static void run_file(const stl::StringView name) {
     const char* env[1];
     env[0] = nullptr;
 
-    sys::execute(name_cstr, args, env);
+    // Create out pipe
+    uint32_t out_read_fd, out_write_fd;
+    sys::pipe(sys::FileFlags::None, out_read_fd, out_write_fd);
+
+    // Spawn process with the out pipe as stdout
+    const sys::SpawnAction actions[] = {
+        { sys::SpawnOp::Duplicate, out_write_fd, 1 },
+        { sys::SpawnOp::Close, out_read_fd, 0 },
+        { sys::SpawnOp::Close, out_write_fd, 0 },
+    };
+
+    uint32_t child_pid;
+    const auto spawned = sys::spawn(name_cstr, args, env, actions, sizeof(actions) / sizeof(sys::SpawnAction), child_pid);
+
+    // Close unneeded pipe ends
+    sys::close(out_write_fd);
+
+    if (spawned) {
+        // Read out pipe and print to terminal
+        print_output(out_read_fd);
+    } else {
+        terminal::print(RED, "Failed to execute file\n");
+    }
 
-    // Print error message
-    constexpr char fg_esc_seq[] = { 27, 'f', static_cast<char>(150), static_cast<char>(0), static_cast<char>(0) };
-    constexpr stl::StringView msg = "Failed to execute file\n";
+    // Close rest of pipe ends
+    sys::close(out_read_fd);
 
-    sys::write(1, fg_esc_seq, sizeof(fg_esc_seq));
-    sys::write(1, msg.data(), msg.size());
+    // Join child process
+    if (spawned) sys::join(child_pid);
 }
 
 extern "C" [[noreturn]]
@@ -212,7 +237,7 @@ void _start() {
         }
 
         // Run file
-        run_command(run_file, name);
+        run_file(name);
     }
 
     sys::exit(0);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "stl/bit_field.hpp"
+
 #include <cstdint>
 #include <cstring>
 
@@ -25,6 +27,30 @@ enum class Sys : int64_t {
     GetCwd = 18,
     SetCwd = 19,
     Join = 20,
+    Mmap = 21,
+    Munmap = 22,
+    Mprotect = 23,
+    Sleep = 24,
+    ClockGettime = 25,
+    Enter = 26,
+    ReadAt = 27,
+    WriteAt = 28,
+    ReadVec = 29,
+    WriteVec = 30,
+    EpollCreate = 31,
+    EpollControl = 32,
+    EpollWait = 33,
+    Sendfile = 34,
+    Splice = 35,
+    Spawn = 36,
+    ThreadCreate = 37,
+    ThreadExit = 38,
+    ThreadJoin = 39,
+    SetFsBase = 40,
+    FutexWait = 41,
+    FutexWake = 42,
+    SetNice = 43,
+    GetPid = 44,
 };
 
 template <const Sys S>
@@ -128,6 +154,146 @@ namespace sys {
         End,
     };
 
+    enum class Protection : uint8_t {
+        None = 0,
+        Read = 1 << 0,
+        Write = 1 << 1,
+        Execute = 1 << 2,
+    };
+    ENUM_BIT_FIELD(Protection)
+
+    enum class MapFlags : uint8_t {
+        None = 0,
+        Shared = 1 << 0,
+        Private = 1 << 1,
+        Fixed = 1 << 4,
+        Anonymous = 1 << 5,
+    };
+    ENUM_BIT_FIELD(MapFlags)
+
+    enum class Clock : uint8_t {
+        /// Nanoseconds since boot
+        Monotonic = 0,
+    };
+
+    /// Layout of the read-only page the kernel maps into every process, see cosmos::clock::Page
+    struct ClockPage {
+        uint32_t sequence;
+        uint32_t shift;
+        uint64_t tsc_base;
+        uint64_t mult;
+    };
+
+    constexpr uint64_t CLOCK_PAGE = 0x00000FFFFFFFF000;
+
+    enum class RingOp : uint8_t {
+        Read,
+        Write,
+        Seek,
+        Open,
+        Close,
+        Poll,
+        ReadAt,
+        WriteAt,
+    };
+
+    /// Arguments are the same as for the syscall of the operation
+    struct Submission {
+        RingOp op;
+        uint64_t args[4];
+        uint64_t user_data;
+    };
+
+    struct Completion {
+        uint64_t user_data;
+        int64_t result;
+    };
+
+    struct RingHeader {
+        uint32_t submission_head;
+        uint32_t submission_tail;
+        uint32_t completion_head;
+        uint32_t completion_tail;
+        uint32_t entry_count;
+    };
+
+    /// Submission and completion queues shared with the kernel, submissions are only processed by enter
+    template <const uint32_t N>
+    struct Ring {
+        static_assert(N != 0 && (N & (N - 1)) == 0, "Ring size needs to be a power of two");
+
+        RingHeader header = { 0, 0, 0, 0, N };
+        Submission submissions[N];
+        Completion completions[N];
+
+        /// @return false if the submission queue is full
+        bool submit(const RingOp op, const uint64_t arg0, const uint64_t arg1 = 0, const uint64_t arg2 = 0, const uint64_t arg3 = 0,
+                    const uint64_t user_data = 0) {
+            const auto tail = header.submission_tail;
+            if (tail - __atomic_load_n(&header.submission_head, __ATOMIC_ACQUIRE) >= N) return false;
+
+            submissions[tail % N] = Submission{ op, { arg0, arg1, arg2, arg3 }, user_data };
+            __atomic_store_n(&header.submission_tail, tail + 1, __ATOMIC_RELEASE);
+
+            return true;
+        }
+
+        /// @return false if the completion queue is empty
+        bool complete(Completion& completion) {
+            const auto head = header.completion_head;
+            if (head == __atomic_load_n(&header.completion_tail, __ATOMIC_ACQUIRE)) return false;
+
+            completion = completions[head % N];
+            __atomic_store_n(&header.completion_head, head + 1, __ATOMIC_RELEASE);
+
+            return true;
+        }
+
+        /// Drops all completions without looking at them
+        void discard() {
+            __atomic_store_n(&header.completion_head, __atomic_load_n(&header.completion_tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        }
+    };
+
+    struct IoVec {
+        const void* base;
+        uint64_t length;
+    };
+
+    enum class SpawnOp : uint32_t {
+        Duplicate,
+        Close,
+    };
+
+    /// Applied in order to the file descriptors the child inherits
+    struct SpawnAction {
+        SpawnOp op;
+        uint32_t fd;
+        uint32_t new_fd;
+    };
+
+    enum class PollMask : uint8_t {
+        None = 0,
+        Read = 1 << 0,
+        Write = 1 << 1,
+        /// The other end is gone, always reported
+        Hangup = 1 << 2,
+    };
+    ENUM_BIT_FIELD(PollMask)
+
+    enum class EpollOp : uint8_t {
+        Add,
+        Modify,
+        Remove,
+    };
+
+    struct EpollEvent {
+        uint64_t data;
+        PollMask mask;
+    };
+
+    constexpr uint64_t EPOLL_INFINITE = UINT64_MAX;
+
     struct DirEntry {
         FileType type;
         char name[256];
@@ -146,6 +312,10 @@ namespace sys {
         syscall<Sys::Yield>();
     }
 
+    inline uint32_t get_pid() {
+        return static_cast<uint32_t>(syscall<Sys::GetPid>());
+    }
+
     inline bool stat(const char* path, Stat& stat) {
         return syscall<Sys::Stat>(reinterpret_cast<uint64_t>(path), reinterpret_cast<uint64_t>(&stat)) >= 0;
     }
@@ -196,6 +366,61 @@ namespace sys {
         return write(fd, buffer, length, written_);
     }
 
+    /// Reads at the offset without moving the cursor
+    inline bool read_at(const uint32_t fd, void* buffer, const uint64_t length, const uint64_t offset, uint64_t& read) {
+        const auto result = syscall<Sys::ReadAt>(fd, reinterpret_cast<uint64_t>(buffer), length, offset);
+        read = static_cast<uint64_t>(result);
+        return result >= 0;
+    }
+
+    inline bool read_at(const uint32_t fd, void* buffer, const uint64_t length, const uint64_t offset) {
+        uint64_t read_;
+        return read_at(fd, buffer, length, offset, read_);
+    }
+
+    /// Writes at the offset without moving the cursor
+    inline bool write_at(const uint32_t fd, const void* buffer, const uint64_t length, const uint64_t offset, uint64_t& written) {
+        const auto result = syscall<Sys::WriteAt>(fd, reinterpret_cast<uint64_t>(buffer), length, offset);
+        written = static_cast<uint64_t>(result);
+        return result >= 0;
+    }
+
+    inline bool write_at(const uint32_t fd, const void* buffer, const uint64_t length, const uint64_t offset) {
+        uint64_t written_;
+        return write_at(fd, buffer, length, offset, written_);
+    }
+
+    /// Fills the buffers in order, stops at the first one which could not be filled completely
+    inline bool read_vec(const uint32_t fd, const IoVec* vecs, const uint64_t count, uint64_t& read) {
+        const auto result = syscall<Sys::ReadVec>(fd, reinterpret_cast<uint64_t>(vecs), count);
+        read = static_cast<uint64_t>(result);
+        return result >= 0;
+    }
+
+    /// Writes the buffers in order, stops at the first one which could not be written completely
+    inline bool write_vec(const uint32_t fd, const IoVec* vecs, const uint64_t count, uint64_t& written) {
+        const auto result = syscall<Sys::WriteVec>(fd, reinterpret_cast<uint64_t>(vecs), count);
+        written = static_cast<uint64_t>(result);
+        return result >= 0;
+    }
+
+    /// Copies from in_fd to out_fd inside the kernel, reading at *offset and advancing it instead of the cursor if it is not nullptr.
+    /// Transfers straight from or into the buffer if one of the files is a pipe, otherwise in_fd has to be a seekable file.
+    inline bool sendfile(const uint32_t out_fd, const uint32_t in_fd, uint64_t* offset, const uint64_t length, uint64_t& written) {
+        const auto result = syscall<Sys::Sendfile>(out_fd, in_fd, reinterpret_cast<uint64_t>(offset), length);
+        written = static_cast<uint64_t>(result);
+        return result >= 0;
+    }
+
+    /// Like sendfile but one of the files has to be a pipe, only the offset of the other one can be given
+    inline bool splice(const uint32_t in_fd, uint64_t* in_offset, const uint32_t out_fd, uint64_t* out_offset, const uint64_t length,
+                       uint64_t& written) {
+        const auto result = syscall<Sys::Splice>(in_fd, reinterpret_cast<uint64_t>(in_offset), out_fd, reinterpret_cast<uint64_t>(out_offset),
+                                                 length);
+        written = static_cast<uint64_t>(result);
+        return result >= 0;
+    }
+
     inline uint64_t ioctl(const uint32_t fd, const uint64_t op, const uint64_t arg) {
         return syscall<Sys::Ioctl>(fd, op, arg);
     }
@@ -226,6 +451,24 @@ namespace sys {
         return syscall<Sys::Poll>(reinterpret_cast<uint64_t>(fds), count, reset_signalled ? 1 : 0, reinterpret_cast<uint64_t>(&mask)) >= 0;
     }
 
+    inline bool epoll_create(const FileFlags flags, uint32_t& fd) {
+        const auto result = syscall<Sys::EpollCreate>(static_cast<uint64_t>(flags));
+        fd = static_cast<uint32_t>(result);
+        return result >= 0;
+    }
+
+    /// Added files stay open until they are removed again or the epoll is closed, closing their file descriptor is not enough
+    inline bool epoll_control(const uint32_t epoll_fd, const EpollOp op, const uint32_t fd, const PollMask interest = PollMask::None,
+                              const uint64_t data = 0) {
+        return syscall<Sys::EpollControl>(epoll_fd, static_cast<uint64_t>(op), fd, static_cast<uint64_t>(interest), data) >= 0;
+    }
+
+    /// Files are reported for as long as they are ready
+    /// @return number of events, 0 if the timeout in milliseconds expired or -1 on failure
+    inline int64_t epoll_wait(const uint32_t epoll_fd, EpollEvent* events, const uint64_t max_count, const uint64_t timeout) {
+        return syscall<Sys::EpollWait>(epoll_fd, reinterpret_cast<uint64_t>(events), max_count, timeout);
+    }
+
     inline bool pipe(const FileFlags flags, uint32_t& read_fd, uint32_t& write_fd) {
         uint32_t fds[2];
         if (syscall<Sys::Pipe>(static_cast<uint64_t>(flags), reinterpret_cast<uint64_t>(fds)) < 0) return false;
@@ -246,6 +489,15 @@ namespace sys {
         syscall<Sys::Execute>(reinterpret_cast<uint64_t>(path), reinterpret_cast<uint64_t>(args), reinterpret_cast<uint64_t>(env));
     }
 
+    /// Starts the binary in a new process, like a fork followed by an execute in the child but without copying the address space
+    inline bool spawn(const char* path, const char* const args[], const char* const env[], const SpawnAction* actions,
+                      const uint64_t action_count, uint32_t& pid) {
+        const auto result = syscall<Sys::Spawn>(reinterpret_cast<uint64_t>(path), reinterpret_cast<uint64_t>(args),
+                                                reinterpret_cast<uint64_t>(env), reinterpret_cast<uint64_t>(actions), action_count);
+        pid = static_cast<uint32_t>(result);
+        return result >= 0;
+    }
+
     inline uint64_t get_cwd(char* buffer, const uint64_t length) {
         const auto result = syscall<Sys::GetCwd>(reinterpret_cast<uint64_t>(buffer), length);
         return result == -1 ? 0 : result;
@@ -258,6 +510,125 @@ namespace sys {
     inline uint64_t join(const uint32_t pid) {
         return syscall<Sys::Join>(pid);
     }
+
+    using ThreadFn = void (*)(void* arg);
+
+    /// Starts a thread sharing the memory and file descriptors of the process. The function must not return, it ends the thread
+    /// with thread_exit. stack points to the end of the memory used as the stack of the thread.
+    inline bool thread_create(const ThreadFn fn, void* stack, void* arg, const uint64_t fs_base, uint32_t& thread_id) {
+        const auto result = syscall<Sys::ThreadCreate>(reinterpret_cast<uint64_t>(fn), reinterpret_cast<uint64_t>(stack),
+                                                       reinterpret_cast<uint64_t>(arg), fs_base);
+        thread_id = static_cast<uint32_t>(result);
+        return result >= 0;
+    }
+
+    [[noreturn]]
+    inline void thread_exit(const uint64_t status) {
+        syscall<Sys::ThreadExit>(status);
+        __builtin_unreachable();
+    }
+
+    /// Only threads of the same process can be joined
+    inline uint64_t thread_join(const uint32_t thread_id) {
+        return syscall<Sys::ThreadJoin>(thread_id);
+    }
+
+    /// Sets the base of the FS segment of the calling thread, used for thread local storage
+    inline bool set_fs_base(const uint64_t base) {
+        return syscall<Sys::SetFsBase>(base) >= 0;
+    }
+
+    constexpr uint64_t FUTEX_INFINITE = UINT64_MAX;
+
+    enum class FutexResult : int8_t {
+        Failed = -1,
+        Woken = 0,
+        TimedOut = 1,
+        /// The word did not hold the expected value
+        Mismatch = 2,
+    };
+
+    /// Sleeps as long as the word holds the expected value until futex_wake is called for it or the timeout in milliseconds expired.
+    /// Words in shared mappings work across processes.
+    inline FutexResult futex_wait(const uint32_t* word, const uint32_t expected, const uint64_t timeout = FUTEX_INFINITE) {
+        return static_cast<FutexResult>(syscall<Sys::FutexWait>(reinterpret_cast<uint64_t>(word), expected, timeout));
+    }
+
+    /// @return number of woken waiters, at most count
+    inline uint32_t futex_wake(const uint32_t* word, const uint32_t count) {
+        return static_cast<uint32_t>(syscall<Sys::FutexWake>(reinterpret_cast<uint64_t>(word), count));
+    }
+
+    /// Sets the nice value of the calling process from -20 to 19, lower values get a larger share of the CPU.
+    /// Processes and threads created afterwards inherit it.
+    inline bool set_nice(const int32_t nice) {
+        return syscall<Sys::SetNice>(static_cast<uint64_t>(static_cast<int64_t>(nice))) >= 0;
+    }
+
+    /// @return nullptr on failure
+    inline void* mmap(void* addr, const uint64_t length, const Protection protection, const MapFlags flags, const uint32_t fd,
+                      const uint64_t offset) {
+        const auto result = syscall<Sys::Mmap>(reinterpret_cast<uint64_t>(addr), length, static_cast<uint64_t>(protection),
+                                               static_cast<uint64_t>(flags), fd, offset);
+        return result == -1 ? nullptr : reinterpret_cast<void*>(result);
+    }
+
+    inline bool munmap(void* addr, const uint64_t length) {
+        return syscall<Sys::Munmap>(reinterpret_cast<uint64_t>(addr), length) >= 0;
+    }
+
+    inline bool mprotect(void* addr, const uint64_t length, const Protection protection) {
+        return syscall<Sys::Mprotect>(reinterpret_cast<uint64_t>(addr), length, static_cast<uint64_t>(protection)) >= 0;
+    }
+
+    inline void sleep(const uint64_t ms) {
+        syscall<Sys::Sleep>(ms);
+    }
+
+    /// @return nanoseconds
+    inline uint64_t clock_gettime(const Clock clock) {
+        return syscall<Sys::ClockGettime>(static_cast<uint64_t>(clock));
+    }
+
+    /// Processes the pending submissions of the ring in order, stops early if the completion queue fills up
+    /// @return number of processed submissions or -1 if the ring is invalid
+    template <const uint32_t N>
+    int64_t enter(Ring<N>& ring) {
+        return syscall<Sys::Enter>(reinterpret_cast<uint64_t>(&ring));
+    }
+
+    /// Same as clock_gettime(Clock::Monotonic) but reads the clock page instead of entering the kernel
+    /// @return nanoseconds
+    inline uint64_t get_ns() {
+        const auto page = reinterpret_cast<const volatile ClockPage*>(CLOCK_PAGE);
+
+        for (;;) {
+            const auto sequence = page->sequence;
+            if ((sequence & 1) != 0) continue;
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            const auto shift = page->shift;
+            const auto tsc_base = page->tsc_base;
+            const auto mult = page->mult;
+
+            uint32_t lo, hi;
+            asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (page->sequence != sequence) continue;
+
+            const auto delta = ((static_cast<uint64_t>(hi) << 32) | lo) - tsc_base;
+            const auto mask = (1ul << shift) - 1;
+
+            return (delta >> shift) * mult + (((delta & mask) * mult) >> shift);
+        }
+    }
+
+    /// Milliseconds since boot, the same clock /dev/timer reads
+    inline uint64_t get_ms() {
+        return get_ns() / 1'000'000;
+    }
 } // namespace sys
 
 #define CSTR(name)                                                                                                                         \
@@ -30,6 +30,9 @@ namespace terminal {
     // Colors
     static Color fg_color = WHITE;
 
+    // The lines of a cell are written with a single kernel entry
+    static sys::Ring<FONT_HEIGHT> ring;
+
     void init() {
         // Framebuffer
         if (!sys::open("/dev/framebuffer", sys::Mode::ReadWrite, sys::FileFlags::CloseOnExecute, fb)) {
@@ -66,6 +69,16 @@ namespace terminal {
         }
     }
 
+    /// The pixels need to stay valid until flush_cell
+    static void write_cell_line(const uint32_t x, const uint32_t y, const uint32_t* pixels) {
+        ring.submit(sys::RingOp::WriteAt, fb, reinterpret_cast<uint64_t>(pixels), FONT_WIDTH * 4, (y * pitch + x) * 4);
+    }
+
+    static void flush_cell() {
+        sys::enter(ring);
+        ring.discard();
+    }
+
     static void fill_cell(const uint32_t pixel) {
         const auto base_x = row * FONT_WIDTH;
         const auto base_y = column * FONT_HEIGHT;
@@ -77,9 +90,10 @@ namespace terminal {
         }
 
         for (auto y = 0u; y < FONT_HEIGHT; y++) {
-            sys::seek(fb, sys::SeekType::Start, ((base_y + y) * pitch + base_x) * 4);
-            sys::write(fb, line_pixels, FONT_WIDTH * 4);
+            write_cell_line(base_x, base_y + y, line_pixels);
         }
+
+        flush_cell();
     }
 
     static void new_line() {
@@ -90,11 +104,8 @@ namespace terminal {
             const auto line_pixels = __builtin_alloca(line_size);
 
             for (auto y = FONT_HEIGHT; y < height; y++) {
-                sys::seek(fb, sys::SeekType::Start, y * line_size);
-                sys::read(fb, line_pixels, line_size);
-
-                sys::seek(fb, sys::SeekType::Start, (y - 16) * line_size);
-                sys::write(fb, line_pixels, line_size);
+                sys::read_at(fb, line_pixels, line_size, y * line_size);
+                sys::write_at(fb, line_pixels, line_size, (y - 16) * line_size);
             }
 
             column--;
@@ -134,16 +145,17 @@ namespace terminal {
 
             const auto color = fg_color.pack();
 
-            for (auto y = 0u; y < FONT_HEIGHT; y++) {
-                uint32_t line_pixels[FONT_WIDTH];
+            uint32_t pixels[FONT_HEIGHT][FONT_WIDTH];
 
+            for (auto y = 0u; y < FONT_HEIGHT; y++) {
                 for (auto x = 0u; x < FONT_WIDTH; x++) {
-                    line_pixels[x] = glyph.is_set(x, y) ? color : 0xFF000000;
+                    pixels[y][x] = glyph.is_set(x, y) ? color : 0xFF000000;
                 }
 
-                sys::seek(fb, sys::SeekType::Start, ((base_y + y) * pitch + base_x) * 4);
-                sys::write(fb, line_pixels, FONT_WIDTH * 4);
+                write_cell_line(base_x, base_y + y, pixels[y]);
             }
+
+            flush_cell();
         }
 
         row++;
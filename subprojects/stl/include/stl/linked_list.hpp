@@ -55,9 +55,7 @@ namespace stl {
             return head != nullptr && head == tail;
         }
 
-        T* push_back_alloc(const size_t additional_size = 0) {
-            const auto node = static_cast<Node*>(aligned_alloc(sizeof(Node) + additional_size, alignof(Node)));
-
+        T* push_back(Node* node) {
             if (head == nullptr) {
                 head = node;
                 tail = node;
@@ -70,6 +68,10 @@ namespace stl {
             return &node->item;
         }
 
+        T* push_back_alloc(const size_t additional_size = 0) {
+            return push_back(static_cast<Node*>(aligned_alloc(sizeof(Node) + additional_size, alignof(Node))));
+        }
+
         T* insert_after_alloc(Node* current, const size_t additional_size = 0) {
             const auto node = static_cast<Node*>(aligned_alloc(sizeof(Node) + additional_size, alignof(Node)));
 
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <concepts>
+
+namespace stl {
+    struct RbNode {
+        RbNode* parent;
+        RbNode* left;
+        RbNode* right;
+        bool red;
+    };
+
+    /// Intrusive red-black tree, items derive from RbNode and are never allocated or freed by the tree.
+    /// Items are ordered by Less::operator()(const T&, const T&), equal items are kept in insertion order.
+    template <typename T, typename Less>
+        requires std::derived_from<T, RbNode>
+    struct RbTree {
+        struct Iterator {
+            RbNode* node;
+
+            bool operator==(const Iterator& other) const {
+                return node == other.node;
+            }
+
+            T* operator*() const {
+                return static_cast<T*>(node);
+            }
+
+            T* operator->() const {
+                return static_cast<T*>(node);
+            }
+
+            Iterator& operator++() {
+                node = next_node(node);
+                return *this;
+            }
+
+            T* operator++(int) {
+                const auto item = static_cast<T*>(node);
+                node = next_node(node);
+                return item;
+            }
+        };
+
+        RbNode* root = nullptr;
+
+        [[nodiscard]]
+        bool empty() const {
+            return root == nullptr;
+        }
+
+        T* first() const {
+            return root != nullptr ? static_cast<T*>(min_node(root)) : nullptr;
+        }
+
+        T* last() const {
+            return root != nullptr ? static_cast<T*>(max_node(root)) : nullptr;
+        }
+
+        static T* next(const T* item) {
+            return static_cast<T*>(next_node(item));
+        }
+
+        static T* prev(const T* item) {
+            return static_cast<T*>(prev_node(item));
+        }
+
+        /// Returns the first item for which the predicate returns true.
+        /// The predicate has to return false for all items before some point in the order and true for all after it.
+        template <typename Predicate>
+        T* find_first(Predicate predicate) const {
+            RbNode* found = nullptr;
+            auto node = root;
+
+            while (node != nullptr) {
+                if (predicate(*static_cast<const T*>(node))) {
+                    found = node;
+                    node = node->left;
+                } else {
+                    node = node->right;
+                }
+            }
+
+            return static_cast<T*>(found);
+        }
+
+        void insert(T* item) {
+            RbNode* parent = nullptr;
+            auto node = root;
+            auto left = false;
+
+            while (node != nullptr) {
+                parent = node;
+                left = Less()(*item, *static_cast<const T*>(node));
+                node = left ? node->left : node->right;
+            }
+
+            RbNode* x = item;
+            x->parent = parent;
+            x->left = nullptr;
+            x->right = nullptr;
+            x->red = true;
+
+            if (parent == nullptr) root = x;
+            else if (left) parent->left = x;
+            else parent->right = x;
+
+            insert_fixup(x);
+        }
+
+        void remove(T* item) {
+            RbNode* z = item;
+            RbNode* x;
+            RbNode* x_parent;
+            auto removed_red = z->red;
+
+            if (z->left == nullptr) {
+                x = z->right;
+                x_parent = z->parent;
+                transplant(z, z->right);
+            } else if (z->right == nullptr) {
+                x = z->left;
+                x_parent = z->parent;
+                transplant(z, z->left);
+            } else {
+                // Replace the item with its successor which has no left child
+                const auto y = min_node(z->right);
+                removed_red = y->red;
+                x = y->right;
+
+                if (y->parent == z) {
+                    x_parent = y;
+                } else {
+                    x_parent = y->parent;
+                    transplant(y, y->right);
+                    y->right = z->right;
+                    y->right->parent = y;
+                }
+
+                transplant(z, y);
+                y->left = z->left;
+                y->left->parent = y;
+                y->red = z->red;
+            }
+
+            if (!removed_red) remove_fixup(x, x_parent);
+
+            z->parent = nullptr;
+            z->left = nullptr;
+            z->right = nullptr;
+        }
+
+        Iterator begin() const {
+            return { root != nullptr ? min_node(root) : nullptr };
+        }
+
+        static Iterator end() {
+            return { nullptr };
+        }
+
+    private:
+        static RbNode* min_node(RbNode* node) {
+            while (node->left != nullptr) node = node->left;
+            return node;
+        }
+
+        static RbNode* max_node(RbNode* node) {
+            while (node->right != nullptr) node = node->right;
+            return node;
+        }
+
+        static RbNode* next_node(const RbNode* node) {
+            if (node->right != nullptr) return min_node(node->right);
+
+            auto parent = node->parent;
+
+            while (parent != nullptr && node == parent->right) {
+                node = parent;
+                parent = parent->parent;
+            }
+
+            return parent;
+        }
+
+        static RbNode* prev_node(const RbNode* node) {
+            if (node->left != nullptr) return max_node(node->left);
+
+            auto parent = node->parent;
+
+            while (parent != nullptr && node == parent->left) {
+                node = parent;
+                parent = parent->parent;
+            }
+
+            return parent;
+        }
+
+        static bool is_red(const RbNode* node) {
+            return node != nullptr && node->red;
+        }
+
+        void transplant(const RbNode* old_node, RbNode* new_node) {
+            if (old_node->parent == nullptr) root = new_node;
+            else if (old_node == old_node->parent->left) old_node->parent->left = new_node;
+            else old_node->parent->right = new_node;
+
+            if (new_node != nullptr) new_node->parent = old_node->parent;
+        }
+
+        void rotate_left(RbNode* x) {
+            const auto y = x->right;
+
+            x->right = y->left;
+            if (y->left != nullptr) y->left->parent = x;
+
+            transplant(x, y);
+
+            y->left = x;
+            x->parent = y;
+        }
+
+        void rotate_right(RbNode* x) {
+            const auto y = x->left;
+
+            x->left = y->right;
+            if (y->right != nullptr) y->right->parent = x;
+
+            transplant(x, y);
+
+            y->right = x;
+            x->parent = y;
+        }
+
+        void insert_fixup(RbNode* x) {
+            while (is_red(x->parent)) {
+                auto parent = x->parent;
+                const auto grandparent = parent->parent;
+
+                if (parent == grandparent->left) {
+                    const auto uncle = grandparent->right;
+
+                    if (is_red(uncle)) {
+                        parent->red = false;
+                        uncle->red = false;
+                        grandparent->red = true;
+                        x = grandparent;
+                        continue;
+                    }
+
+                    if (x == parent->right) {
+                        rotate_left(parent);
+                        x = parent;
+                        parent = x->parent;
+                    }
+
+                    parent->red = false;
+                    grandparent->red = true;
+                    rotate_right(grandparent);
+                } else {
+                    const auto uncle = grandparent->left;
+
+                    if (is_red(uncle)) {
+                        parent->red = false;
+                        uncle->red = false;
+                        grandparent->red = true;
+                        x = grandparent;
+                        continue;
+                    }
+
+                    if (x == parent->left) {
+                        rotate_right(parent);
+                        x = parent;
+                        parent = x->parent;
+                    }
+
+                    parent->red = false;
+                    grandparent->red = true;
+                    rotate_left(grandparent);
+                }
+            }
+
+            root->red = false;
+        }
+
+        void remove_fixup(RbNode* x, RbNode* parent) {
+            while (x != root && !is_red(x)) {
+                if (x == parent->left) {
+                    auto sibling = parent->right;
+
+                    if (is_red(sibling)) {
+                        sibling->red = false;
+                        parent->red = true;
+                        rotate_left(parent);
+                        sibling = parent->right;
+                    }
+
+                    if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                        sibling->red = true;
+                        x = parent;
+                        parent = x->parent;
+                        continue;
+                    }
+
+                    if (!is_red(sibling->right)) {
+                        sibling->left->red = false;
+                        sibling->red = true;
+                        rotate_right(sibling);
+                        sibling = parent->right;
+                    }
+
+                    sibling->red = parent->red;
+                    parent->red = false;
+                    sibling->right->red = false;
+                    rotate_left(parent);
+                    x = root;
+                } else {
+                    auto sibling = parent->left;
+
+                    if (is_red(sibling)) {
+                        sibling->red = false;
+                        parent->red = true;
+                        rotate_right(parent);
+                        sibling = parent->left;
+                    }
+
+                    if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                        sibling->red = true;
+                        x = parent;
+                        parent = x->parent;
+                        continue;
+                    }
+
+                    if (!is_red(sibling->left)) {
+                        sibling->right->red = false;
+                        sibling->red = true;
+                        rotate_left(sibling);
+                        sibling = parent->left;
+                    }
+
+                    sibling->red = parent->red;
+                    parent->red = false;
+                    sibling->left->red = false;
+                    rotate_right(parent);
+                    x = root;
+                }
+            }
+
+            if (x != nullptr) x->red = false;
+        }
+    };
+} // namespace stl